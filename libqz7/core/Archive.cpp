@@ -1,7 +1,10 @@
 #include "qz7/Archive.h"
+#include "qz7/AsyncWriteStream.h"
 #include "qz7/Stream.h"
+#include "qz7/UringStream.h"
 #include "qz7/Volume.h"
 
+#include <QtCore/QFile>
 #include <QtCore/QList>
 #include <QtCore/QMap>
 #include <QtCore/QObject>
@@ -20,8 +23,39 @@ Archive::~Archive()
 
 bool Archive::extractTo(uint id, QIODevice *target)
 {
+    QFile *file = qobject_cast<QFile *>(target);
     QioWriteStream ws(target);
-    return extractTo(id, &ws);
+    if (!file)
+        return extractTo(id, &ws);
+
+    // a file is written from another thread while decoding goes on, or
+    // with io_uring (QZ7_IO_URING=true) by the kernel
+    if (qgetenv("QZ7_IO_URING") == "true") {
+        UringFileWriteStream uws(file);
+        bool ok = extractTo(id, &uws);
+        uws.flush();
+        if (ok && uws.hasError()) {
+            setErrorString(uws.errorString());
+            ok = false;
+        }
+        return ok;
+    }
+
+    // the thread and its buffers only pay off for output that won't fit in
+    // the buffers anyway
+    const quint64 writeBehindSize = quint64(AsyncWriteStream::DefaultBufferSize) * AsyncWriteStream::DefaultBufferCount;
+    const ArchiveItem extracted = (id < count()) ? item(id) : ArchiveItem();
+    if (!extracted.isValid() || extracted.uncompressedSize() < writeBehindSize || qgetenv("QZ7_NO_MULTITHREADED") == "true")
+        return extractTo(id, &ws);
+
+    AsyncWriteStream aws(&ws);
+    bool ok = extractTo(id, &aws);
+    aws.flush();
+    if (ok && aws.hasError()) {
+        setErrorString(aws.errorString());
+        ok = false;
+    }
+    return ok;
 }
 
 bool Archive::writeTo(QIODevice *target)
@@ -102,6 +136,12 @@ void Archive::addItem(const ArchiveItem& item)
     mItems.append(item);
 }
 
+void Archive::updateItem(uint id, const ArchiveItem& item)
+{
+    Q_ASSERT_X(id < mItems.size(), "Archive::updateItem", "id does not exist");
+    mItems[id] = item;
+}
+
 void Archive::setProperty(const QString& prop, const QVariant& val)
 {
     mProperties.insert(prop, val);
@@ -0,0 +1,170 @@
+#include "qz7/AsyncWriteStream.h"
+
+#include <QtCore/QMutexLocker>
+#include <QtCore/QThread>
+
+#include <string.h>
+
+namespace qz7 {
+
+class WriteBehindThread : public QThread {
+public:
+    WriteBehindThread(AsyncWriteStream *stream) : mStream(stream) { }
+    virtual void run() { mStream->drain(); }
+
+private:
+    AsyncWriteStream *mStream;
+};
+
+AsyncWriteStream::AsyncWriteStream(WriteStream *target, int bufferSize, int bufferCount)
+    : mTarget(target), mThread(0), mBuffers(0), mBufferCount(qMax(bufferCount, 2)), mBufferSize(qMax(bufferSize, 4096))
+    , mQueued(0), mFailed(false), mStopping(false)
+    , mFillIndex(0), mAcquiredOwn(false), mBytesWritten(0)
+{
+    mBuffers = new Buffer[mBufferCount];
+    for (int i = 0; i < mBufferCount; i++)
+        mBuffers[i].data = new quint8[mBufferSize];
+
+    mThread = new WriteBehindThread(this);
+    mThread->start();
+}
+
+AsyncWriteStream::~AsyncWriteStream()
+{
+    flush();
+    {
+        QMutexLocker locker(&mLock);
+        mStopping = true;
+        mBufferQueued.wakeAll();
+    }
+    mThread->wait();
+    delete mThread;
+
+    for (int i = 0; i < mBufferCount; i++)
+        delete[] mBuffers[i].data;
+    delete[] mBuffers;
+}
+
+// runs in the thread: writes the buffers out in the order they were queued;
+// after a failure, they are only given back
+void AsyncWriteStream::drain()
+{
+    int index = 0;
+    while (true) {
+        bool failed;
+        {
+            QMutexLocker locker(&mLock);
+            while (mQueued == 0 && !mStopping)
+                mBufferQueued.wait(&mLock);
+            if (mQueued == 0)
+                return;
+            failed = mFailed;
+        }
+
+        Buffer& buffer = mBuffers[index];
+        const bool ok = failed || mTarget->write(buffer.data, buffer.size);
+        buffer.size = 0;
+        index = (index + 1) % mBufferCount;
+
+        QMutexLocker locker(&mLock);
+        if (!ok) {
+            mFailed = true;
+            mErrorString = mTarget->errorString();
+        }
+        mQueued--;
+        mBufferWritten.wakeAll();
+    }
+}
+
+// hands the buffer being filled over to the thread and waits for the next
+// one to be free; false if the target has failed
+bool AsyncWriteStream::queueBuffer()
+{
+    QMutexLocker locker(&mLock);
+    if (mBuffers[mFillIndex].size) {
+        mQueued++;
+        mBufferQueued.wakeOne();
+        mFillIndex = (mFillIndex + 1) % mBufferCount;
+    }
+    while (mQueued == mBufferCount)
+        mBufferWritten.wait(&mLock);
+    return !mFailed;
+}
+
+bool AsyncWriteStream::write(const quint8 *buffer, int bytes)
+{
+    if (hasError())
+        return false;
+
+    while (bytes) {
+        Buffer& current = mBuffers[mFillIndex];
+        const int n = qMin(bytes, mBufferSize - current.size);
+        ::memcpy(current.data + current.size, buffer, n);
+        current.size += n;
+        buffer += n;
+        bytes -= n;
+        mBytesWritten += n;
+        if (current.size == mBufferSize && !queueBuffer())
+            return false;
+    }
+    return true;
+}
+
+void AsyncWriteStream::flush()
+{
+    queueBuffer();
+
+    QMutexLocker locker(&mLock);
+    while (mQueued)
+        mBufferWritten.wait(&mLock);
+    locker.unlock();
+
+    mTarget->flush();
+}
+
+qint64 AsyncWriteStream::bytesWritten() const
+{
+    return mBytesWritten;
+}
+
+QString AsyncWriteStream::errorString() const
+{
+    QMutexLocker locker(&mLock);
+    return mErrorString;
+}
+
+quint8 *AsyncWriteStream::acquireBuffer(int bytes)
+{
+    // more than a buffer holds goes through write()
+    mAcquiredOwn = (bytes > mBufferSize);
+    if (mAcquiredOwn)
+        return WriteStream::acquireBuffer(bytes);
+
+    if (mBuffers[mFillIndex].size + bytes > mBufferSize)
+        queueBuffer();
+    Buffer& current = mBuffers[mFillIndex];
+    return current.data + current.size;
+}
+
+bool AsyncWriteStream::commit(int bytes)
+{
+    if (mAcquiredOwn)
+        return WriteStream::commit(bytes);
+    if (hasError())
+        return false;
+
+    Buffer& current = mBuffers[mFillIndex];
+    current.size += bytes;
+    mBytesWritten += bytes;
+    if (current.size == mBufferSize)
+        return queueBuffer();
+    return true;
+}
+
+bool AsyncWriteStream::hasError() const
+{
+    QMutexLocker locker(&mLock);
+    return mFailed;
+}
+
+}
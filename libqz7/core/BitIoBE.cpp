@@ -19,7 +19,7 @@ uint BitReaderBE::refill(uint nrBits)
     uint bytesNeeded = (nrBits - mBitPos + 7) / 8 - (mValid - mPos);
     uint pos = mValid + ((mValid || mBitPos) ? 1 : 0);
     
-    int read = mStream->readSome(&mBuffer[pos], bytesNeeded, BufferSize - pos);
+    int read = mStream->readSome(&mBuffer[pos], int(bytesNeeded), int(BufferSize - pos));
 
     if (read < 0)
         throw ReadError(mStream);
@@ -61,7 +61,7 @@ void BitWriterBE::flush()
 {
     if (mBitPos) {
         // write out any complete bytes we have
-        uint bytes = mBitPos / 8;
+        int bytes = mBitPos / 8;
 
         bool ok = mStream->write(mBuffer, bytes);
 
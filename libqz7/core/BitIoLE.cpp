@@ -8,67 +8,87 @@
 
 namespace qz7 {
 
-uint BitReaderLE::refill(uint nrBits, bool reversed)
+void BitReaderLE::refill(uint nrBits)
 {
-    // copy any potentially valid bits up to the front of the buffer
-    for (uint p = mPos, b = 0; p <= mValid; p++, b++)
-        mBuffer[b] = mBuffer[p];
-    mValid -= mPos;
-    mPos = 0;
+    Q_ASSERT(nrBits <= MaxEnsureBits);
+
+    while (mBitCount < nrBits) {
+        if (likely(mValid - mPos >= 8)) {
+            // the common case: one unaligned load tops the bit buffer up to
+            // at least 56 bits, and we advance by the whole bytes that fit
+            refillFast();
+            return;
+        }
 
-    uint bytesNeeded = (nrBits - mBitPos + 7) / 8 - (mValid - mPos);
-    uint pos = mValid + ((mValid || mBitPos) ? 1 : 0);
+        if (mPos < mValid) {
+            // near the end of the buffer: take what's left a byte at a time
+            while (mPos < mValid && mBitCount <= MaxEnsureBits) {
+                mBitBuf |= quint64(mBuffer[mPos++]) << mBitCount;
+                mBitCount += 8;
+            }
+            continue;
+        }
 
-    int read = mStream->readSome(&mBuffer[pos], bytesNeeded, BufferSize - pos);
+        if (!loadBuffer())
+            break;
+    }
 
-    if (read < 0)
-        throw ReadError(mStream);
+    // we pad the buffer with ones; we'll throw an error if anyone actually tries to consume them
+    if (mBitCount < nrBits)
+        mBitBuf |= ~Q_UINT64_C(0) << mBitCount;
+}
 
-    if (read && !(mValid || mBitPos)) {
-        // if the buffer is truly empty, the first byte we read
-        // goes to restore mBitPos to 8
-        mValid += read - 1;
-        mBitPos = 8;
-    } else {
-        mValid += read;
-    }
+// borrows the next piece of input from the stream; false at its end
+bool BitReaderLE::loadBuffer()
+{
+    if (mAtEnd || !mStream)
+        return false;
+
+    // everything peeked is consumed at once; it stays valid until the next
+    // load
+    int read;
+    const quint8 *data = mStream->peekBuffer(1, &read);
+    if (!data)
+        throw ReadError(mStream);
+    mStream->consume(read);
 
-    // now actually pull together the bits from the refilled buffer
-    if (!reversed) {
-        pos = mPos;
-        uint ret = mBuffer[pos] >> (8 - mBitPos);
-        bytesNeeded = (nrBits - mBitPos + 7) / 8;
-        uint bitpos = mBitPos;
-        while (bytesNeeded > 0) {
-            // we pad the buffer with ones; we'll throw an error if anyone actually tries to consume them
-            if (++pos <= mValid) {
-                ret |= mBuffer[pos] << bitpos;
-            } else {
-                ret |= quint8(0xff) << bitpos;
-            }
-            bitpos += 8;
-            --bytesNeeded;
-        }
+    mBuffer = data;
+    mPos = 0;
+    mValid = read;
+    mBytesLoaded += read;
+    if (!read)
+        mAtEnd = true;
+    return read != 0;
+}
 
-        return ret & ((1 << nrBits) - 1);
-    } else {
-        uint pos = mPos;
-        uint ret = bitReverse(mBuffer[pos]);
-        bytesNeeded = (nrBits - mBitPos + 7) / 8;
-        uint bits = mBitPos + 8 * bytesNeeded;
-        while (bytesNeeded > 0) {
-            // we pad the buffer with ones; we'll throw an error if anyone actually tries to consume them
-            ret <<= 8;
-            if (++pos <= mValid) {
-                ret |= bitReverse(mBuffer[pos]);
-            } else {
-                ret |= 0xff;
-            }
-            --bytesNeeded;
+const quint8 *BitReaderLE::readAlignedBytes(uint maxBytes, uint *bytes)
+{
+    Q_ASSERT((mBitCount & 7) == 0);
+
+    // the whole bytes the bit buffer was topped up with come first
+    if (mBitCount) {
+        const uint n = qMin(maxBytes, mBitCount / 8);
+        for (uint i = 0; i < n; i++) {
+            mAligned[i] = quint8(mBitBuf);
+            mBitBuf >>= 8;
         }
+        mBitCount -= n * 8;
+        *bytes = n;
+        return mAligned;
+    }
 
-        return (ret >> (bits - nrBits)) & ((1 << nrBits) - 1);
+    // what refillFast() loaded ahead is skipped over here
+    mBitBuf = 0;
+    if (mPos == mValid && !loadBuffer()) {
+        *bytes = 0;
+        return 0;
     }
+
+    const uint n = qMin(maxBytes, mValid - mPos);
+    const quint8 *data = mBuffer + mPos;
+    mPos += n;
+    *bytes = n;
+    return data;
 }
 
 const quint8 BitReaderLE::BitReverseTable[256] = {
@@ -111,7 +131,7 @@ void BitWriterLE::flush()
 {
     if (mBitPos) {
         // write out any complete bytes we have
-        uint bytes = mBitPos / 8;
+        int bytes = mBitPos / 8;
 
         bool ok = mStream->write(mBuffer, bytes);
 
@@ -11,4 +11,9 @@ Codec::~Codec()
 {
 }
 
+bool Codec::reset()
+{
+    return false;
+}
+
 }
@@ -22,35 +22,146 @@
 
 #include <byteswap.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define QZ7_CRC_CLMUL
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <smmintrin.h>
+#include <wmmintrin.h>
+#endif
+
 namespace qz7 {
 
-static quint32 Crc32IeeeLeData[1024];
-static bool inited;
+static const quint32 CrcPoly = 0xEDB88320;
+
+#define QZ7_CRC32_TABLE(K) QZ7_CRC_TABLE(quint32, CrcPoly, true, K)
+static const quint32 Crc32IeeeLeData[16][256] = {
+    QZ7_CRC32_TABLE(0), QZ7_CRC32_TABLE(1), QZ7_CRC32_TABLE(2), QZ7_CRC32_TABLE(3),
+    QZ7_CRC32_TABLE(4), QZ7_CRC32_TABLE(5), QZ7_CRC32_TABLE(6), QZ7_CRC32_TABLE(7),
+    QZ7_CRC32_TABLE(8), QZ7_CRC32_TABLE(9), QZ7_CRC32_TABLE(10), QZ7_CRC32_TABLE(11),
+    QZ7_CRC32_TABLE(12), QZ7_CRC32_TABLE(13), QZ7_CRC32_TABLE(14), QZ7_CRC32_TABLE(15)
+};
+
+#ifdef QZ7_CRC_CLMUL
+static bool detectClmul()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return false;
+    return (ecx & bit_PCLMUL) && (ecx & bit_SSE4_1);
+}
 
-// create the CRC table if needed
+// checked once when the library is loaded, before there are any threads
+static const bool hasClmul = detectClmul();
+#endif
+
+// a * b modulo the polynomial, both in the reflected bit order of the CRC
+static quint32 multModP(quint32 a, quint32 b)
+{
+    quint32 m = 1U << 31;
+    quint32 p = 0;
+    while (true) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0)
+                break;
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ CrcPoly : b >> 1;
+    }
+    return p;
+}
+
+// the tables are static, so there is nothing left to set up
 quint32 CrcInitValue()
 {
-    if (inited)
-        return 0xffffffff;
-
-    quint32 *ctx = Crc32IeeeLeData;
-    const quint32 poly = 0xEDB88320;
-    int i, j;
-    quint32 c;
-
-    for (i = 0; i < 256; i++) {
-        for (c = i, j = 0; j < 8; j++)
-            c = (c>>1)^(poly & (-(c&1)));
-        ctx[i] = c;
-    }   
-    for (i = 0; i < 256; i++)
-        for(j=0; j<3; j++)
-            ctx[256*(j+1) + i]= (ctx[256*j + i]>>8) ^ ctx[ ctx[256*j + i]&0xFF ];
-
-    inited = true;
     return 0xffffffff;
 }
 
+#ifdef QZ7_CRC_CLMUL
+/*
+ * Folds 64 bytes at a time with carry-less multiplies, as in Intel's "Fast
+ * CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction"
+ * paper, then Barrett-reduces the remaining 128 bits to the CRC. The length
+ * must be a multiple of 16 and at least 64.
+ */
+__attribute__((target("pclmul,sse4.1")))
+static quint32 crcUpdateClmul(quint32 crc, const quint8 *buffer, size_t length)
+{
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+    const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124LL);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL);
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+    __m128i x1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buffer));
+    __m128i x2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buffer + 16));
+    __m128i x3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buffer + 32));
+    __m128i x4 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buffer + 48));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(int(crc)));
+    buffer += 64;
+    length -= 64;
+
+    // four lanes of 128 bits, each folded 512 bits forward
+    while (length >= 64) {
+        __m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        __m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        __m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        __m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128(reinterpret_cast<const __m128i *>(buffer)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128(reinterpret_cast<const __m128i *>(buffer + 16)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128(reinterpret_cast<const __m128i *>(buffer + 32)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128(reinterpret_cast<const __m128i *>(buffer + 48)));
+        buffer += 64;
+        length -= 64;
+    }
+
+    // fold the lanes into one, then the rest of the buffer into that
+    __m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x4), x5);
+
+    while (length >= 16) {
+        x2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buffer));
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x2), x5);
+        buffer += 16;
+        length -= 16;
+    }
+
+    // 128 bits to 64
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k5k0, 0x00), x2);
+
+    // and Barrett reduction to 32
+    x2 = _mm_and_si128(x1, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return quint32(_mm_extract_epi32(x1, 1));
+}
+#endif
+
+static inline quint32 readWordLE(const quint32 *p)
+{
+    quint32 word = *p;
+    if (QSysInfo::ByteOrder == QSysInfo::BigEndian)
+        word = bswap_32(word);
+    return word;
+}
+
 /**
  * Calculate the CRC of a block
  * @param crcType the type of crc to calculate
@@ -59,31 +170,50 @@ quint32 CrcInitValue()
  */
 quint32 CrcUpdate(quint32 crc, const void *bufIn, size_t length)
 {
-    Q_ASSERT(inited);
-    const quint32 *ctx = Crc32IeeeLeData;
+    const quint32 *ctx = Crc32IeeeLeData[0];
     const quint8 *buffer = reinterpret_cast<const quint8 *>(bufIn);
     const quint8 *end = buffer+length;
 
+#ifdef QZ7_CRC_CLMUL
+    if (hasClmul && length >= 64) {
+        const size_t folded = length & ~size_t(15);
+        crc = crcUpdateClmul(crc, buffer, folded);
+        buffer += folded;
+    }
+#endif
+
     // fix up the initial alignment of the buffer
     while (buffer < end && (reinterpret_cast<unsigned long>(buffer) & 3)) {
         crc = ctx[((quint8)crc) ^ *buffer++] ^ (crc >> 8);
     }
 
-    // try to do a fast word-by-word CRC
+    // slicing-by-16: four words at a time through sixteen tables
     const quint32 *buffer32 = reinterpret_cast<const quint32 *>(buffer);
-    const quint32 *end32 = reinterpret_cast<const quint32 *>(reinterpret_cast<unsigned long>(end) & ~3UL);
+    const quint32 *end32 = buffer32 + (end - buffer) / 16 * 4;
 
     while (buffer32 < end32) {
-        quint32 word = *buffer32++;
-
-        if (QSysInfo::ByteOrder == QSysInfo::BigEndian)
-            word = bswap_32(word);
-
-        crc ^= word;
-        crc =  ctx[3*256 + ( crc     &0xFF)]
-                ^ctx[2*256 + ((crc>>8 )&0xFF)]
-                ^ctx[1*256 + ((crc>>16)&0xFF)]
-                ^ctx[0*256 + ((crc>>24)     )];
+        const quint32 a = readWordLE(buffer32) ^ crc;
+        const quint32 b = readWordLE(buffer32 + 1);
+        const quint32 c = readWordLE(buffer32 + 2);
+        const quint32 d = readWordLE(buffer32 + 3);
+        buffer32 += 4;
+
+        crc =  ctx[15*256 + ( a     &0xFF)]
+                ^ctx[14*256 + ((a>>8 )&0xFF)]
+                ^ctx[13*256 + ((a>>16)&0xFF)]
+                ^ctx[12*256 + ((a>>24)     )]
+                ^ctx[11*256 + ( b     &0xFF)]
+                ^ctx[10*256 + ((b>>8 )&0xFF)]
+                ^ctx[ 9*256 + ((b>>16)&0xFF)]
+                ^ctx[ 8*256 + ((b>>24)     )]
+                ^ctx[ 7*256 + ( c     &0xFF)]
+                ^ctx[ 6*256 + ((c>>8 )&0xFF)]
+                ^ctx[ 5*256 + ((c>>16)&0xFF)]
+                ^ctx[ 4*256 + ((c>>24)     )]
+                ^ctx[ 3*256 + ( d     &0xFF)]
+                ^ctx[ 2*256 + ((d>>8 )&0xFF)]
+                ^ctx[ 1*256 + ((d>>16)&0xFF)]
+                ^ctx[ 0*256 + ((d>>24)     )];
     }
     buffer = reinterpret_cast<const quint8 *>(end32);
 
@@ -95,4 +225,28 @@ quint32 CrcUpdate(quint32 crc, const void *bufIn, size_t length)
     return crc;
 }
 
+/**
+ * Combine the CRCs of two consecutive blocks
+ * @param crcA CRC value of the first block
+ * @param crcB CRC value of the second block
+ * @param lengthB length of the second block
+ * @return CRC value of both blocks together
+ */
+quint32 CrcCombine(quint32 crcA, quint32 crcB, quint64 lengthB)
+{
+    // crcA times x^(8 * lengthB), squaring x^8 for each bit of lengthB
+    quint32 square = 1U << 30;
+    for (int k = 0; k < 3; k++)
+        square = multModP(square, square);
+
+    quint32 p = 1U << 31;
+    for (; lengthB; lengthB >>= 1) {
+        if (lengthB & 1)
+            p = multModP(square, p);
+        square = multModP(square, square);
+    }
+
+    return multModP(p, crcA) ^ crcB;
+}
+
 }
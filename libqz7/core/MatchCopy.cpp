@@ -0,0 +1,77 @@
+#include "qz7/MatchCopy.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define QZ7_MATCH_COPY_X86
+#include <immintrin.h>
+#endif
+
+namespace qz7 {
+
+static void copyLongMatchGeneric(quint8 *dst, const quint8 *src, uint length)
+{
+    const quint8 *end = dst + length;
+
+    do {
+        copy8Bytes(dst, src);
+        copy8Bytes(dst + 8, src + 8);
+        copy8Bytes(dst + 16, src + 16);
+        copy8Bytes(dst + 24, src + 24);
+        dst += 32;
+        src += 32;
+    } while (dst < end);
+}
+
+#ifdef QZ7_MATCH_COPY_X86
+
+__attribute__((target("sse2")))
+static void copyLongMatchSse2(quint8 *dst, const quint8 *src, uint length)
+{
+    const quint8 *end = dst + length;
+
+    do {
+        __m128i a = _mm_loadu_si128((const __m128i *)src);
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+        _mm_storeu_si128((__m128i *)dst, a);
+        _mm_storeu_si128((__m128i *)(dst + 16), b);
+        dst += 32;
+        src += 32;
+    } while (dst < end);
+}
+
+__attribute__((target("avx2")))
+static void copyLongMatchAvx2(quint8 *dst, const quint8 *src, uint length)
+{
+    const quint8 *end = dst + length;
+
+    do {
+        _mm256_storeu_si256((__m256i *)dst, _mm256_loadu_si256((const __m256i *)src));
+        dst += 32;
+        src += 32;
+    } while (dst < end);
+}
+
+#endif
+
+int supportedLongMatchCopies(MatchCopyFunction *variants)
+{
+    int count = 0;
+    variants[count++] = copyLongMatchGeneric;
+#ifdef QZ7_MATCH_COPY_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        variants[count++] = copyLongMatchSse2;
+    if (__builtin_cpu_supports("avx2"))
+        variants[count++] = copyLongMatchAvx2;
+#endif
+    return count;
+}
+
+static MatchCopyFunction selectLongMatchCopy()
+{
+    MatchCopyFunction variants[MaxLongMatchCopies];
+    return variants[supportedLongMatchCopies(variants) - 1];
+}
+
+MatchCopyFunction copyLongMatch = selectLongMatchCopy();
+
+}
@@ -0,0 +1,216 @@
+#include "qz7/PrefetchReadStream.h"
+
+#include <QtCore/QMutexLocker>
+#include <QtCore/QThread>
+
+#include <string.h>
+
+namespace qz7 {
+
+class PrefetchThread : public QThread {
+public:
+    PrefetchThread(PrefetchReadStream *stream) : mStream(stream) { }
+    virtual void run() { mStream->fill(); }
+
+private:
+    PrefetchReadStream *mStream;
+};
+
+PrefetchReadStream::PrefetchReadStream(ReadStream *source, int bufferSize, int bufferCount)
+    : mSource(source), mThread(0), mBuffers(0), mBufferCount(qMax(bufferCount, 2)), mBufferSize(qMax(bufferSize, 4096))
+    , mFilled(0), mFinished(false), mFailed(false), mStopping(false)
+    , mReadIndex(0), mReadOffset(0), mBytesRead(0), mJoinedStart(0), mJoinedEnd(0)
+{
+    mBuffers = new Buffer[mBufferCount];
+    for (int i = 0; i < mBufferCount; i++)
+        mBuffers[i].data = new quint8[mBufferSize];
+
+    mThread = new PrefetchThread(this);
+    mThread->start();
+}
+
+PrefetchReadStream::~PrefetchReadStream()
+{
+    {
+        QMutexLocker locker(&mLock);
+        mStopping = true;
+        mBufferEmptied.wakeAll();
+    }
+    mThread->wait();
+    delete mThread;
+
+    for (int i = 0; i < mBufferCount; i++)
+        delete[] mBuffers[i].data;
+    delete[] mBuffers;
+}
+
+// runs in the thread: fills the buffers in turn as they are given back,
+// until the source runs out
+void PrefetchReadStream::fill()
+{
+    int index = 0;
+    while (true) {
+        {
+            QMutexLocker locker(&mLock);
+            while (mFilled == mBufferCount && !mStopping)
+                mBufferEmptied.wait(&mLock);
+            if (mStopping)
+                return;
+        }
+
+        Buffer& buffer = mBuffers[index];
+        const int r = mSource->readSome(buffer.data, mBufferSize, mBufferSize);
+
+        QMutexLocker locker(&mLock);
+        if (r < 0) {
+            mFailed = true;
+            mErrorString = mSource->errorString();
+        } else if (r > 0) {
+            buffer.size = r;
+            mFilled++;
+            index = (index + 1) % mBufferCount;
+        }
+        mFinished = (r < mBufferSize);
+        mBufferFilled.wakeAll();
+        if (mFinished)
+            return;
+    }
+}
+
+// waits for the buffer at mReadIndex to be filled; false if it never will be
+bool PrefetchReadStream::waitForBuffer() const
+{
+    QMutexLocker locker(&mLock);
+    while (mFilled == 0 && !mFinished)
+        mBufferFilled.wait(&mLock);
+    return mFilled > 0;
+}
+
+// moves on in the buffer at mReadIndex, giving it back once it's all read
+void PrefetchReadStream::advance(int bytes)
+{
+    mReadOffset += bytes;
+    if (mReadOffset < mBuffers[mReadIndex].size)
+        return;
+
+    mReadOffset = 0;
+    mReadIndex = (mReadIndex + 1) % mBufferCount;
+
+    QMutexLocker locker(&mLock);
+    mFilled--;
+    mBufferEmptied.wakeOne();
+}
+
+int PrefetchReadStream::takeFromRing(quint8 *buffer, int bytes)
+{
+    int taken = 0;
+    while (taken < bytes && waitForBuffer()) {
+        const Buffer& current = mBuffers[mReadIndex];
+        const int n = qMin(bytes - taken, current.size - mReadOffset);
+        ::memcpy(buffer + taken, current.data + mReadOffset, n);
+        taken += n;
+        advance(n);
+    }
+    return taken;
+}
+
+// copies out what was put together for a peek first, then the ring's data
+int PrefetchReadStream::takeBytes(quint8 *buffer, int bytes)
+{
+    const int joined = qMin(bytes, mJoinedEnd - mJoinedStart);
+    ::memcpy(buffer, mJoined.constData() + mJoinedStart, joined);
+    mJoinedStart += joined;
+
+    const int taken = joined + takeFromRing(buffer + joined, bytes - joined);
+    mBytesRead += taken;
+    return taken;
+}
+
+bool PrefetchReadStream::read(quint8 *buffer, int bytes)
+{
+    return takeBytes(buffer, bytes) == bytes;
+}
+
+int PrefetchReadStream::readSome(quint8 *buffer, int minBytes, int maxBytes)
+{
+    const int taken = takeBytes(buffer, maxBytes);
+    if (taken < minBytes && mFailed)
+        return -1;
+    return taken;
+}
+
+bool PrefetchReadStream::skipForward(qint64 bytes)
+{
+    const int joined = int(qMin(bytes, qint64(mJoinedEnd - mJoinedStart)));
+    mJoinedStart += joined;
+    bytes -= joined;
+
+    while (bytes && waitForBuffer()) {
+        const int n = int(qMin(bytes, qint64(mBuffers[mReadIndex].size - mReadOffset)));
+        advance(n);
+        bytes -= n;
+    }
+    return bytes == 0;
+}
+
+bool PrefetchReadStream::atEnd() const
+{
+    return mJoinedStart == mJoinedEnd && !waitForBuffer();
+}
+
+qint64 PrefetchReadStream::bytesRead() const
+{
+    return mBytesRead;
+}
+
+QString PrefetchReadStream::errorString() const
+{
+    QMutexLocker locker(&mLock);
+    return mErrorString;
+}
+
+const quint8 *PrefetchReadStream::peekBuffer(int minBytes, int *bytes)
+{
+    // lent straight from the ring where the current buffer has enough left
+    if (mJoinedStart == mJoinedEnd) {
+        mJoinedStart = mJoinedEnd = 0;
+        if (waitForBuffer()) {
+            const Buffer& current = mBuffers[mReadIndex];
+            if (current.size - mReadOffset >= minBytes) {
+                *bytes = current.size - mReadOffset;
+                return current.data + mReadOffset;
+            }
+        }
+    }
+
+    // otherwise what is asked for is put together from the buffers it spans
+    const int joined = mJoinedEnd - mJoinedStart;
+    if (joined < minBytes) {
+        if (mJoinedStart) {
+            ::memmove(mJoined.data(), mJoined.constData() + mJoinedStart, joined);
+            mJoinedStart = 0;
+            mJoinedEnd = joined;
+        }
+        if (mJoined.size() < minBytes)
+            mJoined.resize(minBytes);
+        mJoinedEnd += takeFromRing(reinterpret_cast<quint8 *>(mJoined.data()) + mJoinedEnd, minBytes - joined);
+        if (mJoinedEnd < minBytes && mFailed)
+            return 0;
+    }
+
+    *bytes = mJoinedEnd - mJoinedStart;
+    return reinterpret_cast<const quint8 *>(mJoined.constData()) + mJoinedStart;
+}
+
+void PrefetchReadStream::consume(int bytes)
+{
+    mBytesRead += bytes;
+    if (mJoinedStart < mJoinedEnd) {
+        Q_ASSERT(bytes <= mJoinedEnd - mJoinedStart);
+        mJoinedStart += bytes;
+    } else {
+        advance(bytes);
+    }
+}
+
+}
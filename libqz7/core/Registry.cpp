@@ -1,3 +1,4 @@
+#include "qz7/Codec.h"
 #include "qz7/Plugin.h"
 
 #include <QtCore/QCoreApplication>
@@ -9,11 +10,34 @@
 #include <QtCore/QSet>
 #include <QtCore/QString>
 #include <QtCore/QStringList>
+#include <QtCore/QThreadStorage>
 
 Q_IMPORT_PLUGIN(qz7builtin)
 
 namespace qz7 {
 
+namespace {
+
+// the decoders a thread has released, by name, and the names of all the
+// ones it handed out; as they have no parent, nothing else deletes them
+class DecoderPool {
+public:
+    enum { MaxIdlePerName = 16 };
+
+    ~DecoderPool()
+    {
+        for (QMap<QString, QList<Codec *> >::iterator it = idle.begin(); it != idle.end(); ++it)
+            qDeleteAll(*it);
+    }
+
+    QMap<QString, QList<Codec *> > idle;
+    QMap<Codec *, QString> names;
+};
+
+QThreadStorage<DecoderPool *> decoderPools;
+
+}
+
 Registry::Registry()
 {
     loadPlugins();
@@ -168,6 +192,45 @@ Codec *Registry::createDecoder(int id, QObject *parent)
     return factory->createDecoder(id, parent);
 }
 
+Codec *Registry::acquireDecoder(const QString& name)
+{
+    if (!decoderPools.hasLocalData())
+        decoderPools.setLocalData(new DecoderPool);
+    DecoderPool *pool = decoderPools.localData();
+
+    QList<Codec *>& idle = pool->idle[name];
+    if (!idle.isEmpty())
+        return idle.takeLast();
+
+    Codec *codec = createDecoder(name, 0);
+    if (codec)
+        pool->names.insert(codec, name);
+    return codec;
+}
+
+void Registry::releaseDecoder(Codec *codec)
+{
+    if (!codec)
+        return;
+
+    DecoderPool *pool = decoderPools.hasLocalData() ? decoderPools.localData() : 0;
+    if (!pool || !pool->names.contains(codec)) {
+        delete codec;
+        return;
+    }
+
+    // it mustn't go on telling its last user about its progress
+    codec->disconnect();
+
+    QList<Codec *>& idle = pool->idle[pool->names.value(codec)];
+    if (idle.count() >= DecoderPool::MaxIdlePerName || !codec->reset()) {
+        pool->names.remove(codec);
+        delete codec;
+        return;
+    }
+    idle.append(codec);
+}
+
 Codec *Registry::createEncoder(const QString& name, QObject *parent)
 {
     QObject *o = the()->findEncoder(name);
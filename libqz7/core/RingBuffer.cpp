@@ -1,5 +1,6 @@
 #include "qz7/RingBuffer.h"
 
+#include "qz7/Analyzer.h"
 #include "qz7/Error.h"
 #include "qz7/Stream.h"
 
@@ -9,18 +10,43 @@ namespace qz7 {
     
 void RingBuffer::flush()
 {
-    if (!mStream->write(mBuffer, mPos))
+    if (mPos == mFlushPos)
+        return;
+
+    if (mAnalyzer)
+        mAnalyzer->analyze(&mBuffer[mFlushPos], mPos - mFlushPos);
+    if (!mStream->write(&mBuffer[mFlushPos], int(mPos - mFlushPos)))
         throw WriteError(mStream);
-    
-    // if we're flushing in the middle, we need to rearrange the buffer
-    if (mPos != mSize) {
-        quint8 temp[mSize];
-        
-        ::memcpy(temp, &mBuffer[mPos], mSize - mPos);
-        ::memcpy(&temp[mSize - mPos], mBuffer, mPos);
-        ::memcpy(mBuffer, temp, mSize);
+    mFlushed += mPos - mFlushPos;
+    mFlushPos = mPos;
+}
+
+void RingBuffer::putBytesDirect(const quint8 *bytes, uint length)
+{
+    flush();
+
+    if (mAnalyzer)
+        mAnalyzer->analyze(bytes, length);
+    if (!mStream->write(bytes, int(length)))
+        throw WriteError(mStream);
+    mFlushed += length;
+
+    // the history is now the end of the run, after what is left of the old one
+    if (length >= mHistorySize) {
+        ::memcpy(mBuffer, bytes + length - mHistorySize, mHistorySize);
+    } else {
+        ::memmove(mBuffer, &mBuffer[mPos - (mHistorySize - length)], mHistorySize - length);
+        ::memcpy(&mBuffer[mHistorySize - length], bytes, length);
     }
-    mPos = 0;
+    mPos = mFlushPos = mHistorySize;
+}
+
+void RingBuffer::makeRoom()
+{
+    flush();
+
+    ::memmove(mBuffer, &mBuffer[mPos - mHistorySize], mHistorySize);
+    mPos = mFlushPos = mHistorySize;
 }
 
 }
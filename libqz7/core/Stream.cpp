@@ -1,20 +1,137 @@
 #include "qz7/Stream.h"
+#include <QtCore/QBuffer>
 #include <QtCore/QCoreApplication>
+#include <QtCore/QFile>
 #include <QtCore/QIODevice>
 #include <QtCore/QString>
 
+#include <string.h>
+
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#endif
+
 namespace qz7 {
 
 ReadStream::~ReadStream()
 {
+    delete[] mPeekBuffer;
+}
+
+const quint8 *ReadStream::peekBuffer(int minBytes, int *bytes)
+{
+    // keep what hasn't been consumed yet at the front
+    if (mPeekStart) {
+        ::memmove(mPeekBuffer, mPeekBuffer + mPeekStart, mPeekEnd - mPeekStart);
+        mPeekEnd -= mPeekStart;
+        mPeekStart = 0;
+    }
+
+    const int capacity = qMax(minBytes, int(PeekBufferSize));
+    if (capacity > mPeekCapacity) {
+        quint8 *buffer = new quint8[capacity];
+        ::memcpy(buffer, mPeekBuffer, mPeekEnd);
+        delete[] mPeekBuffer;
+        mPeekBuffer = buffer;
+        mPeekCapacity = capacity;
+    }
+
+    if (mPeekEnd < minBytes) {
+        const int r = readSome(mPeekBuffer + mPeekEnd, minBytes - mPeekEnd, mPeekCapacity - mPeekEnd);
+        if (r < 0)
+            return 0;
+        mPeekEnd += r;
+    }
+
+    *bytes = mPeekEnd;
+    return mPeekBuffer;
+}
+
+void ReadStream::consume(int bytes)
+{
+    Q_ASSERT(bytes <= mPeekEnd - mPeekStart);
+    mPeekStart += bytes;
+}
+
+bool ReadStream::read(quint8 *buffer, qint64 bytes)
+{
+    while (bytes) {
+        const int chunk = int(qMin(bytes, qint64(MaxChunk)));
+        if (!read(buffer, chunk))
+            return false;
+        buffer += chunk;
+        bytes -= chunk;
+    }
+    return true;
+}
+
+qint64 ReadStream::readSome(quint8 *buffer, qint64 minBytes, qint64 maxBytes)
+{
+    qint64 ret = 0;
+    while (ret < maxBytes) {
+        const int chunk = int(qMin(maxBytes - ret, qint64(MaxChunk)));
+        const int r = readSome(buffer + ret, int(qBound(qint64(0), minBytes - ret, qint64(chunk))), chunk);
+        if (r < 0)
+            return -1;
+        ret += r;
+        if (r < chunk)
+            break;
+    }
+    return ret;
+}
+
+const quint8 *ReadStream::peekBuffer(qint64 minBytes, qint64 *bytes)
+{
+    int b;
+    const quint8 *data = peekBuffer(int(qMin(minBytes, qint64(MaxChunk))), &b);
+    *bytes = b;
+    return data;
+}
+
+void ReadStream::consume(qint64 bytes)
+{
+    while (bytes) {
+        const int chunk = int(qMin(bytes, qint64(MaxChunk)));
+        consume(chunk);
+        bytes -= chunk;
+    }
 }
 
 WriteStream::~WriteStream()
 {
+    delete[] mAcquireBuffer;
+}
+
+quint8 *WriteStream::acquireBuffer(int bytes)
+{
+    if (bytes > mAcquireCapacity) {
+        delete[] mAcquireBuffer;
+        mAcquireBuffer = new quint8[bytes];
+        mAcquireCapacity = bytes;
+    }
+    return mAcquireBuffer;
+}
+
+bool WriteStream::commit(int bytes)
+{
+    Q_ASSERT(bytes <= mAcquireCapacity);
+    return write(mAcquireBuffer, bytes);
+}
+
+bool WriteStream::write(const quint8 *buffer, qint64 bytes)
+{
+    while (bytes) {
+        const int chunk = int(qMin(bytes, qint64(MaxChunk)));
+        if (!write(buffer, chunk))
+            return false;
+        buffer += chunk;
+        bytes -= chunk;
+    }
+    return true;
 }
 
 QioReadStream::QioReadStream(QIODevice *dev)
-    : mBytesRead(0), mDevice(dev)
+    : mBytesRead(0), mDevice(dev), mBuffer(qobject_cast<QBuffer *>(dev))
 {
 //    Q_ASSERT(dev->isReadable());
 }
@@ -25,10 +142,23 @@ QioReadStream::~QioReadStream()
 
 bool QioReadStream::read(quint8 *buffer, int bytes)
 {
-    int b = bytes;
+    return QioReadStream::read(buffer, qint64(bytes));
+}
+
+int QioReadStream::readSome(quint8 *buffer, int minBytes, int maxBytes)
+{
+    return int(QioReadStream::readSome(buffer, qint64(minBytes), qint64(maxBytes)));
+}
+
+bool QioReadStream::read(quint8 *buffer, qint64 bytes)
+{
+    // it would come after what was peeked but not consumed
+    Q_ASSERT(peekedBytes() == 0);
+
+    const qint64 b = bytes;
 
     while (bytes) {
-        int r = device()->read(reinterpret_cast<char *>(buffer), bytes);
+        const qint64 r = device()->read(reinterpret_cast<char *>(buffer), bytes);
         if (r < 0 || (r == 0 && !device()->waitForReadyRead(-1)))
             return false;
         buffer += r;
@@ -39,11 +169,11 @@ bool QioReadStream::read(quint8 *buffer, int bytes)
     return true;
 }
 
-int QioReadStream::readSome(quint8 *buffer, int minBytes, int maxBytes)
+qint64 QioReadStream::readSome(quint8 *buffer, qint64 minBytes, qint64 maxBytes)
 {
-    int ret = 0;
+    qint64 ret = 0;
     while (maxBytes) {
-        int r = device()->read(reinterpret_cast<char *>(buffer), maxBytes);
+        const qint64 r = device()->read(reinterpret_cast<char *>(buffer), maxBytes);
 
         if (r <= 0) {
             if (ret >= minBytes)
@@ -65,6 +195,14 @@ done:
 
 bool QioReadStream::skipForward(qint64 bytes)
 {
+    // what was peeked is skipped first; it has been read already
+    const int peeked = int(qMin(bytes, qint64(peekedBytes())));
+    if (peeked)
+        ReadStream::consume(peeked);
+    bytes -= peeked;
+    if (!bytes)
+        return true;
+
     // try to seek; otherwise fall back to reading
     if (device()->seek(device()->pos() + bytes))
         return true;
@@ -83,7 +221,7 @@ bool QioReadStream::skipForward(qint64 bytes)
 
 bool QioReadStream::atEnd() const
 {
-    return device()->atEnd();
+    return peekedBytes() == 0 && device()->atEnd();
 }
 
 qint64 QioReadStream::bytesRead() const
@@ -96,6 +234,28 @@ QString QioReadStream::errorString() const
     return device()->errorString();
 }
 
+const quint8 *QioReadStream::peekBuffer(int minBytes, int *bytes)
+{
+    if (!mBuffer)
+        return ReadStream::peekBuffer(minBytes, bytes);
+
+    // a QBuffer's data is all there already
+    const QByteArray& data = mBuffer->buffer();
+    const qint64 pos = mBuffer->pos();
+    *bytes = int(qMax(qint64(0), data.size() - pos));
+    return reinterpret_cast<const quint8 *>(data.constData()) + pos;
+}
+
+void QioReadStream::consume(int bytes)
+{
+    if (!mBuffer) {
+        ReadStream::consume(bytes);
+        return;
+    }
+    mBuffer->seek(mBuffer->pos() + bytes);
+    mBytesRead += bytes;
+}
+
 QioSeekableReadStream::QioSeekableReadStream(QIODevice *dev)
     : QioReadStream(dev)
 {
@@ -136,6 +296,36 @@ QString QioSeekableReadStream::errorString() const
     return QioReadStream::errorString();
 }
 
+const quint8 *QioSeekableReadStream::peekBuffer(int minBytes, int *bytes)
+{
+    return QioReadStream::peekBuffer(minBytes, bytes);
+}
+
+void QioSeekableReadStream::consume(int bytes)
+{
+    QioReadStream::consume(bytes);
+}
+
+bool QioSeekableReadStream::read(quint8 *buffer, qint64 bytes)
+{
+    return QioReadStream::read(buffer, bytes);
+}
+
+qint64 QioSeekableReadStream::readSome(quint8 *buffer, qint64 minBytes, qint64 maxBytes)
+{
+    return QioReadStream::readSome(buffer, minBytes, maxBytes);
+}
+
+const quint8 *QioSeekableReadStream::peekBuffer(qint64 minBytes, qint64 *bytes)
+{
+    return QioReadStream::peekBuffer(minBytes, bytes);
+}
+
+void QioSeekableReadStream::consume(qint64 bytes)
+{
+    QioReadStream::consume(bytes);
+}
+
 qint64 QioSeekableReadStream::size() const
 {
     return device()->size();
@@ -143,16 +333,156 @@ qint64 QioSeekableReadStream::size() const
 
 qint64 QioSeekableReadStream::pos() const
 {
-    return device()->pos();
+    return device()->pos() - QioReadStream::peekedBytes();
 }
 
 bool QioSeekableReadStream::setPos(qint64 pos)
 {
+    QioReadStream::discardPeeked();
     return device()->seek(pos);
 }
 
+MappedFileReadStream::MappedFileReadStream(QFile *file)
+    : mFile(file), mData(0), mSize(file->size()), mPos(0), mBytesRead(0), mAdvisedStart(0), mAdvisedEnd(0)
+{
+    if (mSize > 0 && quint64(mSize) == quint64(size_t(mSize)))
+        mData = file->map(0, mSize);
+#ifdef Q_OS_UNIX
+    if (mData)
+        ::madvise(mData, size_t(mSize), MADV_SEQUENTIAL);
+#endif
+    if (mData)
+        adviseAhead();
+}
+
+MappedFileReadStream::~MappedFileReadStream()
+{
+    if (mData)
+        mFile->unmap(mData);
+}
+
+// asks the kernel to start reading the next ReadAhead bytes whenever reading
+// gets halfway through the last stretch asked for (or seeks away from it)
+void MappedFileReadStream::adviseAhead()
+{
+#ifdef Q_OS_UNIX
+    if (mPos >= mAdvisedStart && mPos + ReadAhead / 2 < mAdvisedEnd)
+        return;
+    if (mPos >= mSize)
+        return;
+
+    // 64 KB alignment keeps the address on a page boundary
+    const qint64 start = mPos & ~Q_INT64_C(0xffff);
+    const qint64 end = qMin(start + ReadAhead, mSize);
+    ::madvise(mData + start, size_t(end - start), MADV_WILLNEED);
+    mAdvisedStart = start;
+    mAdvisedEnd = end;
+#endif
+}
+
+bool MappedFileReadStream::read(quint8 *buffer, int bytes)
+{
+    return MappedFileReadStream::read(buffer, qint64(bytes));
+}
+
+int MappedFileReadStream::readSome(quint8 *buffer, int minBytes, int maxBytes)
+{
+    return int(MappedFileReadStream::readSome(buffer, qint64(minBytes), qint64(maxBytes)));
+}
+
+bool MappedFileReadStream::read(quint8 *buffer, qint64 bytes)
+{
+    if (bytes > mSize - mPos)
+        return false;
+    ::memcpy(buffer, mData + mPos, size_t(bytes));
+    mPos += bytes;
+    mBytesRead += bytes;
+    adviseAhead();
+    return true;
+}
+
+qint64 MappedFileReadStream::readSome(quint8 *buffer, qint64 minBytes, qint64 maxBytes)
+{
+    Q_UNUSED(minBytes);
+    const qint64 bytes = qMin(maxBytes, mSize - mPos);
+    ::memcpy(buffer, mData + mPos, size_t(bytes));
+    mPos += bytes;
+    mBytesRead += bytes;
+    adviseAhead();
+    return bytes;
+}
+
+bool MappedFileReadStream::skipForward(qint64 bytes)
+{
+    if (bytes > mSize - mPos)
+        return false;
+    mPos += bytes;
+    adviseAhead();
+    return true;
+}
+
+bool MappedFileReadStream::atEnd() const
+{
+    return mPos >= mSize;
+}
+
+qint64 MappedFileReadStream::bytesRead() const
+{
+    return mBytesRead;
+}
+
+QString MappedFileReadStream::errorString() const
+{
+    return mFile->errorString();
+}
+
+const quint8 *MappedFileReadStream::peekBuffer(int minBytes, int *bytes)
+{
+    Q_UNUSED(minBytes);
+    *bytes = int(qMin(mSize - mPos, qint64(MaxChunk)));
+    return mData + mPos;
+}
+
+void MappedFileReadStream::consume(int bytes)
+{
+    MappedFileReadStream::consume(qint64(bytes));
+}
+
+const quint8 *MappedFileReadStream::peekBuffer(qint64 minBytes, qint64 *bytes)
+{
+    Q_UNUSED(minBytes);
+    *bytes = mSize - mPos;
+    return mData + mPos;
+}
+
+void MappedFileReadStream::consume(qint64 bytes)
+{
+    mPos += bytes;
+    mBytesRead += bytes;
+    adviseAhead();
+}
+
+qint64 MappedFileReadStream::size() const
+{
+    return mSize;
+}
+
+qint64 MappedFileReadStream::pos() const
+{
+    return mPos;
+}
+
+bool MappedFileReadStream::setPos(qint64 pos)
+{
+    if (pos < 0 || pos > mSize)
+        return false;
+    mPos = pos;
+    adviseAhead();
+    return true;
+}
+
 QioWriteStream::QioWriteStream(QIODevice *dev)
-    : mBytesWritten(0), mDevice(dev)
+    : mBytesWritten(0), mDevice(dev), mBuffer(qobject_cast<QBuffer *>(dev)), mSizeBeforeAcquire(0)
 {
 //    Q_ASSERT(device()->isWritable());
 }
@@ -162,9 +492,14 @@ QioWriteStream::~QioWriteStream()
 }
 
 bool QioWriteStream::write(const quint8 *buffer, int bytes)
+{
+    return QioWriteStream::write(buffer, qint64(bytes));
+}
+
+bool QioWriteStream::write(const quint8 *buffer, qint64 bytes)
 {
     while (bytes) {
-        int w = device()->write(reinterpret_cast<const char *>(buffer), bytes);
+        const qint64 w = device()->write(reinterpret_cast<const char *>(buffer), bytes);
         if (w < 0 || (w == 0 && !device()->waitForBytesWritten(-1)))
             return false;
         buffer += w;
@@ -192,6 +527,34 @@ QString QioWriteStream::errorString() const
     return device()->errorString();
 }
 
+quint8 *QioWriteStream::acquireBuffer(int bytes)
+{
+    if (!mBuffer)
+        return WriteStream::acquireBuffer(bytes);
+
+    // a QBuffer is grown and written in place
+    QByteArray& data = mBuffer->buffer();
+    const qint64 pos = mBuffer->pos();
+    mSizeBeforeAcquire = data.size();
+    if (data.size() < pos + bytes)
+        data.resize(int(pos + bytes));
+    return reinterpret_cast<quint8 *>(data.data()) + pos;
+}
+
+bool QioWriteStream::commit(int bytes)
+{
+    if (!mBuffer)
+        return WriteStream::commit(bytes);
+
+    // drop whatever was acquired but not committed
+    QByteArray& data = mBuffer->buffer();
+    const qint64 pos = mBuffer->pos();
+    data.resize(int(qMax(mSizeBeforeAcquire, pos + bytes)));
+    mBuffer->seek(pos + bytes);
+    mBytesWritten += bytes;
+    return true;
+}
+
 LimitedReadStream::LimitedReadStream(ReadStream *source, qint64 byteLimit)
     : mBytesLeft(byteLimit), mBytesInitial(byteLimit), mStream(source)
 {
@@ -233,6 +596,52 @@ qint64 LimitedReadStream::bytesRead() const
     return (mBytesInitial - mBytesLeft);
 }
 
+const quint8 *LimitedReadStream::peekBuffer(int minBytes, int *bytes)
+{
+    const quint8 *data = mStream->peekBuffer(int(qMin(qint64(minBytes), mBytesLeft)), bytes);
+    if (data && *bytes > mBytesLeft)
+        *bytes = int(mBytesLeft);
+    return data;
+}
+
+void LimitedReadStream::consume(int bytes)
+{
+    mBytesLeft -= bytes;
+    mStream->consume(bytes);
+}
+
+bool LimitedReadStream::read(quint8 *buffer, qint64 bytes)
+{
+    if (bytes > mBytesLeft)
+        return false;
+    mBytesLeft -= bytes;
+    return mStream->read(buffer, bytes);
+}
+
+qint64 LimitedReadStream::readSome(quint8 *buffer, qint64 minBytes, qint64 maxBytes)
+{
+    if (!mBytesLeft)
+        return 0;
+    qint64 read = mStream->readSome(buffer, qMin(minBytes, mBytesLeft), qMin(maxBytes, mBytesLeft));
+    if (read >= 0)
+        mBytesLeft -= read;
+    return read;
+}
+
+const quint8 *LimitedReadStream::peekBuffer(qint64 minBytes, qint64 *bytes)
+{
+    const quint8 *data = mStream->peekBuffer(qMin(minBytes, mBytesLeft), bytes);
+    if (data && *bytes > mBytesLeft)
+        *bytes = mBytesLeft;
+    return data;
+}
+
+void LimitedReadStream::consume(qint64 bytes)
+{
+    mBytesLeft -= bytes;
+    mStream->consume(bytes);
+}
+
 QString LimitedReadStream::errorString() const
 {
     if (!mStream->errorString().isEmpty())
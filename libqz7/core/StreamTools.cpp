@@ -5,19 +5,20 @@ namespace tools {
 
 bool copyData(ReadStream& src, WriteStream& dst)
 {
-    const int BufferSize = 64 * 1024;
-    quint8 buffer[BufferSize];
-
-    while (!src.atEnd()) {
-        int r = src.readSome(buffer, 0, BufferSize);
-        
-        if (r < 0)
+    // straight from the source's buffer where it has one, as much of it
+    // at once as it lends out
+    while (true) {
+        qint64 r;
+        const quint8 *data = src.peekBuffer(1, &r);
+        if (!data)
             return false;
-            
-        if (!dst.write(buffer, r))
+        if (r == 0)
+            return true;
+
+        if (!dst.write(data, r))
             return false;
+        src.consume(r);
     }
-    return true;
 }
 
 }
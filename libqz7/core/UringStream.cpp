@@ -0,0 +1,596 @@
+#include "qz7/UringStream.h"
+
+#include <QtCore/QFile>
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef QZ7_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+namespace qz7 {
+
+#ifdef QZ7_HAVE_IO_URING
+
+// UringQueue is a bare io_uring (set up with the system calls, so no
+// liburing is needed) for one stream's reads or writes of its buffers,
+// which are registered with it; a request's buffer index comes back with
+// its completion. It isn't shared: a stream is only ever used from one
+// thread at a time, and the ring needs no locking that way.
+class UringQueue {
+public:
+    static UringQueue *create(quint8 **buffers, int count, int size);
+    ~UringQueue();
+
+    void queue(bool write, int fd, int index, quint8 *data, int length, qint64 offset);
+    void submit();
+    bool wait(int *index, int *result);
+
+private:
+    UringQueue() : mFd(-1), mSqRing(MAP_FAILED), mCqRing(MAP_FAILED), mSqes(MAP_FAILED), mToSubmit(0) { }
+    bool setUp(unsigned entries);
+    int enter(unsigned minComplete);
+
+    int mFd;
+    void *mSqRing;
+    size_t mSqRingSize;
+    void *mCqRing;
+    size_t mCqRingSize;
+    void *mSqes;
+    size_t mSqesSize;
+
+    unsigned *mSqTail;
+    unsigned *mSqMask;
+    unsigned *mSqArray;
+    unsigned *mCqHead;
+    unsigned *mCqTail;
+    unsigned *mCqMask;
+    io_uring_cqe *mCqes;
+    unsigned mToSubmit;
+};
+
+UringQueue *UringQueue::create(quint8 **buffers, int count, int size)
+{
+    UringQueue *ring = new UringQueue;
+    if (!ring->setUp(count)) {
+        delete ring;
+        return 0;
+    }
+
+    // registered buffers spare the kernel mapping them for every request
+    iovec *iov = new iovec[count];
+    for (int i = 0; i < count; i++) {
+        iov[i].iov_base = buffers[i];
+        iov[i].iov_len = size;
+    }
+    const long r = ::syscall(__NR_io_uring_register, ring->mFd, IORING_REGISTER_BUFFERS, iov, count);
+    delete[] iov;
+    if (r < 0) {
+        delete ring;
+        return 0;
+    }
+    return ring;
+}
+
+bool UringQueue::setUp(unsigned entries)
+{
+    io_uring_params params;
+    ::memset(&params, 0, sizeof(params));
+    mFd = int(::syscall(__NR_io_uring_setup, entries, &params));
+    if (mFd < 0)
+        return false;
+
+    mSqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    mCqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    mSqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    mSqRing = ::mmap(0, mSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_SQ_RING);
+    mCqRing = ::mmap(0, mCqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_CQ_RING);
+    mSqes = ::mmap(0, mSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_SQES);
+    if (mSqRing == MAP_FAILED || mCqRing == MAP_FAILED || mSqes == MAP_FAILED)
+        return false;
+
+    char *sq = static_cast<char *>(mSqRing);
+    char *cq = static_cast<char *>(mCqRing);
+    mSqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    mSqMask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    mSqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    mCqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    mCqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    mCqMask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    mCqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+    return true;
+}
+
+UringQueue::~UringQueue()
+{
+    if (mSqes != MAP_FAILED)
+        ::munmap(mSqes, mSqesSize);
+    if (mCqRing != MAP_FAILED)
+        ::munmap(mCqRing, mCqRingSize);
+    if (mSqRing != MAP_FAILED)
+        ::munmap(mSqRing, mSqRingSize);
+    if (mFd >= 0)
+        ::close(mFd);
+}
+
+// the caller never has more requests out than it has buffers, which is
+// how many entries the ring has
+void UringQueue::queue(bool write, int fd, int index, quint8 *data, int length, qint64 offset)
+{
+    const unsigned tail = *mSqTail;
+    const unsigned slot = tail & *mSqMask;
+    io_uring_sqe *sqe = static_cast<io_uring_sqe *>(mSqes) + slot;
+    ::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<quint64>(data);
+    sqe->len = length;
+    sqe->off = offset;
+    sqe->buf_index = index;
+    sqe->user_data = index;
+    mSqArray[slot] = slot;
+    __atomic_store_n(mSqTail, tail + 1, __ATOMIC_RELEASE);
+    mToSubmit++;
+}
+
+int UringQueue::enter(unsigned minComplete)
+{
+    const int r = int(::syscall(__NR_io_uring_enter, mFd, mToSubmit, minComplete,
+                                minComplete ? IORING_ENTER_GETEVENTS : 0, 0, 0));
+    if (r > 0)
+        mToSubmit -= qMin(unsigned(r), mToSubmit);
+    return r;
+}
+
+// everything queued goes to the kernel in one call
+void UringQueue::submit()
+{
+    while (mToSubmit && enter(0) < 0 && errno == EINTR)
+        ;
+}
+
+bool UringQueue::wait(int *index, int *result)
+{
+    while (true) {
+        const unsigned head = *mCqHead;
+        if (head != __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE)) {
+            const io_uring_cqe *cqe = mCqes + (head & *mCqMask);
+            *index = int(cqe->user_data);
+            *result = cqe->res;
+            __atomic_store_n(mCqHead, head + 1, __ATOMIC_RELEASE);
+            return true;
+        }
+        if (enter(1) < 0 && errno != EINTR)
+            return false;
+    }
+}
+
+#else
+
+class UringQueue {
+public:
+    static UringQueue *create(quint8 **, int, int) { return 0; }
+    void queue(bool, int, int, quint8 *, int, qint64) { }
+    void submit() { }
+    bool wait(int *, int *) { return false; }
+};
+
+#endif
+
+UringFileReadStream::UringFileReadStream(QFile *file, int bufferSize, int bufferCount, bool useRing)
+    : mFd(file->handle()), mRing(0), mBlocks(0), mBlockCount(qMax(bufferCount, 1)), mBlockSize(qMax(bufferSize, 4096))
+    , mSize(file->size()), mPos(0), mBytesRead(0)
+{
+    mBlocks = new Block[mBlockCount];
+    quint8 **buffers = new quint8 *[mBlockCount];
+    for (int i = 0; i < mBlockCount; i++)
+        buffers[i] = mBlocks[i].data = new quint8[mBlockSize];
+    if (useRing && mBlockCount > 1)
+        mRing = UringQueue::create(buffers, mBlockCount, mBlockSize);
+    delete[] buffers;
+}
+
+UringFileReadStream::~UringFileReadStream()
+{
+    // the kernel mustn't be left reading into freed buffers
+    for (int i = 0; i < mBlockCount; i++) {
+        while (mBlocks[i].state == Pending && reapOne())
+            ;
+    }
+    delete mRing;
+
+    for (int i = 0; i < mBlockCount; i++)
+        delete[] mBlocks[i].data;
+    delete[] mBlocks;
+}
+
+// reads a block, or queues the read with the ring (to be submitted with
+// those of the blocks after it)
+void UringFileReadStream::readBlock(Block *block)
+{
+    const qint64 offset = block->number * mBlockSize;
+    const int length = int(qMin(qint64(mBlockSize), mSize - offset));
+    block->size = 0;
+
+    if (mRing) {
+        mRing->queue(false, mFd, int(block - mBlocks), block->data, length, offset);
+        block->state = Pending;
+        return;
+    }
+
+    while (block->size < length) {
+        const ssize_t r = ::pread(mFd, block->data + block->size, length - block->size, offset + block->size);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0) {
+            mErrorString = qt_error_string(errno);
+            block->size = -1;
+            break;
+        }
+        if (r == 0)
+            break;
+        block->size += int(r);
+    }
+    block->state = Ready;
+}
+
+// waits for a read to complete; one that came up short (which the kernel
+// may do) is finished off with pread()
+bool UringFileReadStream::reapOne()
+{
+    int index, result;
+    if (!mRing->wait(&index, &result)) {
+        mErrorString = qt_error_string(errno);
+        return false;
+    }
+
+    Block& block = mBlocks[index];
+    block.state = Ready;
+    if (result < 0) {
+        mErrorString = qt_error_string(-result);
+        block.size = -1;
+        return true;
+    }
+
+    const qint64 offset = block.number * mBlockSize;
+    const int length = int(qMin(qint64(mBlockSize), mSize - offset));
+    block.size = result;
+    while (block.size > 0 && block.size < length) {
+        const ssize_t r = ::pread(mFd, block.data + block.size, length - block.size, offset + block.size);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            break;
+        block.size += int(r);
+    }
+    return true;
+}
+
+// the block that the position is in, once it has been read; with the ring,
+// reads of the blocks after it are kept queued. 0 at the end or on error.
+const UringFileReadStream::Block *UringFileReadStream::currentBlock()
+{
+    if (mPos >= mSize)
+        return 0;
+
+    const qint64 first = mPos / mBlockSize;
+    const qint64 last = mRing ? qMin(first + mBlockCount, (mSize + mBlockSize - 1) / mBlockSize) : first + 1;
+    bool queued = false;
+    for (qint64 n = first; n < last; n++) {
+        Block& block = mBlocks[n % mBlockCount];
+        if (block.number == n && block.size >= 0)
+            continue;
+        // left over from before a seek
+        while (block.state == Pending) {
+            if (!reapOne())
+                return 0;
+        }
+        block.number = n;
+        readBlock(&block);
+        queued = true;
+    }
+    if (queued && mRing)
+        mRing->submit();
+
+    Block& current = mBlocks[first % mBlockCount];
+    while (current.state == Pending) {
+        if (!reapOne())
+            return 0;
+    }
+    if (current.size < 0 || mPos - first * mBlockSize >= current.size)
+        return 0;
+    return &current;
+}
+
+bool UringFileReadStream::read(quint8 *buffer, int bytes)
+{
+    while (bytes) {
+        const Block *block = currentBlock();
+        if (!block)
+            return false;
+        const int offset = int(mPos - block->number * mBlockSize);
+        const int n = qMin(bytes, block->size - offset);
+        ::memcpy(buffer, block->data + offset, n);
+        buffer += n;
+        bytes -= n;
+        mPos += n;
+        mBytesRead += n;
+    }
+    return true;
+}
+
+int UringFileReadStream::readSome(quint8 *buffer, int minBytes, int maxBytes)
+{
+    int ret = 0;
+    while (ret < maxBytes) {
+        const Block *block = currentBlock();
+        if (!block) {
+            if (ret < minBytes && mPos < mSize)
+                return -1;
+            break;
+        }
+        const int offset = int(mPos - block->number * mBlockSize);
+        const int n = qMin(maxBytes - ret, block->size - offset);
+        ::memcpy(buffer + ret, block->data + offset, n);
+        ret += n;
+        mPos += n;
+        mBytesRead += n;
+    }
+    return ret;
+}
+
+bool UringFileReadStream::skipForward(qint64 bytes)
+{
+    if (bytes > mSize - mPos)
+        return false;
+    mPos += bytes;
+    return true;
+}
+
+bool UringFileReadStream::atEnd() const
+{
+    return mPos >= mSize;
+}
+
+qint64 UringFileReadStream::bytesRead() const
+{
+    return mBytesRead;
+}
+
+QString UringFileReadStream::errorString() const
+{
+    return mErrorString;
+}
+
+const quint8 *UringFileReadStream::peekBuffer(int minBytes, int *bytes)
+{
+    *bytes = 0;
+    const Block *block = currentBlock();
+    if (!block)
+        return (mPos >= mSize) ? reinterpret_cast<const quint8 *>(mJoined.constData()) : 0;
+
+    const int offset = int(mPos - block->number * mBlockSize);
+    const int available = block->size - offset;
+    if (available >= minBytes || mPos + available >= mSize) {
+        *bytes = available;
+        return block->data + offset;
+    }
+
+    // across the end of the block (rarely), it is put together here
+    const int wanted = int(qMin(qint64(minBytes), mSize - mPos));
+    mJoined.resize(wanted);
+    ::memcpy(mJoined.data(), block->data + offset, available);
+    int joined = available;
+    while (joined < wanted) {
+        const ssize_t r = ::pread(mFd, mJoined.data() + joined, wanted - joined, mPos + joined);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0) {
+            mErrorString = qt_error_string(errno);
+            return 0;
+        }
+        if (r == 0)
+            break;
+        joined += int(r);
+    }
+    *bytes = joined;
+    return reinterpret_cast<const quint8 *>(mJoined.constData());
+}
+
+void UringFileReadStream::consume(int bytes)
+{
+    mPos += bytes;
+    mBytesRead += bytes;
+}
+
+qint64 UringFileReadStream::size() const
+{
+    return mSize;
+}
+
+qint64 UringFileReadStream::pos() const
+{
+    return mPos;
+}
+
+bool UringFileReadStream::setPos(qint64 pos)
+{
+    if (pos < 0 || pos > mSize)
+        return false;
+    mPos = pos;
+    return true;
+}
+
+UringFileWriteStream::UringFileWriteStream(QFile *file, int bufferSize, int bufferCount, bool useRing)
+    : mFile(file), mFd(-1), mRing(0), mBuffers(0), mBufferCount(qMax(bufferCount, 1)), mBufferSize(qMax(bufferSize, 4096))
+    , mFillIndex(0), mAcquiredOwn(false), mOffset(0), mBytesWritten(0), mFailed(false)
+{
+    // whatever QFile has buffered goes first
+    file->flush();
+    mFd = file->handle();
+    mOffset = file->pos();
+
+    mBuffers = new Buffer[mBufferCount];
+    quint8 **buffers = new quint8 *[mBufferCount];
+    for (int i = 0; i < mBufferCount; i++)
+        buffers[i] = mBuffers[i].data = new quint8[mBufferSize];
+    if (useRing && mBufferCount > 1)
+        mRing = UringQueue::create(buffers, mBufferCount, mBufferSize);
+    delete[] buffers;
+}
+
+UringFileWriteStream::~UringFileWriteStream()
+{
+    flush();
+    delete mRing;
+
+    for (int i = 0; i < mBufferCount; i++)
+        delete[] mBuffers[i].data;
+    delete[] mBuffers;
+}
+
+// writes what is left of a buffer, or submits the write to the ring
+void UringFileWriteStream::writeBuffer(int index)
+{
+    Buffer& buffer = mBuffers[index];
+    if (mRing) {
+        mRing->queue(true, mFd, index, buffer.data + buffer.done, buffer.size - buffer.done, buffer.offset + buffer.done);
+        mRing->submit();
+        buffer.pending = true;
+        return;
+    }
+
+    while (buffer.done < buffer.size) {
+        const ssize_t w = ::pwrite(mFd, buffer.data + buffer.done, buffer.size - buffer.done, buffer.offset + buffer.done);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0) {
+            mFailed = true;
+            mErrorString = qt_error_string(w < 0 ? errno : ENOSPC);
+            break;
+        }
+        buffer.done += int(w);
+    }
+    buffer.size = 0;
+}
+
+// waits for a write to complete; one that came up short is resubmitted
+bool UringFileWriteStream::reapOne()
+{
+    int index, result;
+    if (!mRing->wait(&index, &result)) {
+        mFailed = true;
+        mErrorString = qt_error_string(errno);
+        return false;
+    }
+
+    Buffer& buffer = mBuffers[index];
+    if (result > 0)
+        buffer.done += result;
+    if (result > 0 && buffer.done < buffer.size) {
+        writeBuffer(index);
+        return true;
+    }
+    if (result <= 0) {
+        mFailed = true;
+        mErrorString = qt_error_string(result < 0 ? -result : ENOSPC);
+    }
+    buffer.pending = false;
+    buffer.size = 0;
+    return true;
+}
+
+// hands the buffer being filled over and moves on to the next one, waiting
+// for it to have been written if need be; false if a write failed
+bool UringFileWriteStream::submitBuffer()
+{
+    Buffer& current = mBuffers[mFillIndex];
+    if (current.size) {
+        current.offset = mOffset;
+        current.done = 0;
+        mOffset += current.size;
+        writeBuffer(mFillIndex);
+        mFillIndex = (mFillIndex + 1) % mBufferCount;
+    }
+    while (mBuffers[mFillIndex].pending) {
+        if (!reapOne())
+            break;
+    }
+    return !mFailed;
+}
+
+bool UringFileWriteStream::write(const quint8 *buffer, int bytes)
+{
+    if (mFailed)
+        return false;
+
+    while (bytes) {
+        Buffer& current = mBuffers[mFillIndex];
+        const int n = qMin(bytes, mBufferSize - current.size);
+        ::memcpy(current.data + current.size, buffer, n);
+        current.size += n;
+        buffer += n;
+        bytes -= n;
+        mBytesWritten += n;
+        if (current.size == mBufferSize && !submitBuffer())
+            return false;
+    }
+    return true;
+}
+
+void UringFileWriteStream::flush()
+{
+    submitBuffer();
+    for (int i = 0; i < mBufferCount; i++) {
+        while (mBuffers[i].pending) {
+            if (!reapOne())
+                return;
+        }
+    }
+    mFile->seek(mOffset);
+}
+
+qint64 UringFileWriteStream::bytesWritten() const
+{
+    return mBytesWritten;
+}
+
+QString UringFileWriteStream::errorString() const
+{
+    return mErrorString;
+}
+
+quint8 *UringFileWriteStream::acquireBuffer(int bytes)
+{
+    // more than a buffer holds goes through write()
+    mAcquiredOwn = (bytes > mBufferSize);
+    if (mAcquiredOwn)
+        return WriteStream::acquireBuffer(bytes);
+
+    if (mBuffers[mFillIndex].size + bytes > mBufferSize)
+        submitBuffer();
+    Buffer& current = mBuffers[mFillIndex];
+    return current.data + current.size;
+}
+
+bool UringFileWriteStream::commit(int bytes)
+{
+    if (mAcquiredOwn)
+        return WriteStream::commit(bytes);
+    if (mFailed)
+        return false;
+
+    Buffer& current = mBuffers[mFillIndex];
+    current.size += bytes;
+    mBytesWritten += bytes;
+    if (current.size == mBufferSize)
+        return submitBuffer();
+    return true;
+}
+
+}
@@ -0,0 +1,41 @@
+#ifndef QZ7_ADLER_ANALYZER_H
+#define QZ7_ADLER_ANALYZER_H
+#include "qz7/Analyzer.h"
+namespace qz7 {
+// the checksum of zlib streams (RFC 1950)
+class Adler32 {
+public:
+    Adler32() { clear(); }
+    void clear() { mA = 1; mB = 0; }
+    quint32 value() const { return (mB << 16) | mA; }
+    void update(const quint8 *buffer, int bytes);
+private:
+    enum { Base = 65521, MaxRun = 5552 };  // the most bytes before b can overflow
+    quint32 mA;
+    quint32 mB;
+};
+inline void Adler32::update(const quint8 *buffer, int bytes)
+{
+    while (bytes > 0) {
+        int run = qMin(bytes, int(MaxRun));
+        bytes -= run;
+        while (run--) {
+            mA += *buffer++;
+            mB += mA;
+        }
+        mA %= Base;
+        mB %= Base;
+    }
+}
+class Adler32Analyzer : public Analyzer {
+public:
+    Adler32Analyzer() : mAdler() { }
+    ~Adler32Analyzer() { }
+    quint32 value() const { return mAdler.value(); }
+    virtual void analyze(const quint8 *data, int length) { mAdler.update(data, length); }
+private:
+    Adler32 mAdler;
+};
+QZ7_DECLARE_STREAMS_FOR_ANALYZER(Adler32)
+}
+#endif
@@ -15,6 +15,19 @@ public:
     virtual void analyze(const quint8 *data, int length) = 0;
 };
 
+/**
+ * analyzeAll() runs an Analyzer over more than 2 GB of data, a piece at a time.
+ */
+template<class AnalyzerType> inline void analyzeAll(AnalyzerType *analyzer, const quint8 *data, qint64 length)
+{
+    while (length) {
+        const int piece = int(qMin(length, qint64(1 << 30)));
+        analyzer->analyze(data, piece);
+        data += piece;
+        length -= piece;
+    }
+}
+
 /**
  * AnalyzerReadStream provides a Stream which automatically runs the Analyzer on
  * the data read from it.
@@ -27,6 +40,8 @@ public:
     const AnalyzerType *analyzer() const { return mAnalyzer; }
     virtual bool read(quint8 *buffer, int bytes);
     virtual int readSome(quint8 *buffer, int minBytes, int maxBytes);
+    virtual bool read(quint8 *buffer, qint64 bytes);
+    virtual qint64 readSome(quint8 *buffer, qint64 minBytes, qint64 maxBytes);
     virtual bool skipForward(qint64 bytes);
     virtual qint64 bytesRead() const;
     virtual QString errorString() const;
@@ -55,6 +70,24 @@ template<class AnalyzerType> inline int AnalyzerReadStream<AnalyzerType>::readSo
     return r;
 };
 
+template<class AnalyzerType> inline bool AnalyzerReadStream<AnalyzerType>::read(quint8 *buffer, qint64 bytes)
+{
+    bool ok = mStream->read(buffer, bytes);
+    if (!ok)
+        return ok;
+    analyzeAll(mAnalyzer, buffer, bytes);
+    return true;
+};
+
+template<class AnalyzerType> inline qint64 AnalyzerReadStream<AnalyzerType>::readSome(quint8 *buffer, qint64 minBytes, qint64 maxBytes)
+{
+    qint64 r = mStream->readSome(buffer, minBytes, maxBytes);
+    if (r < 0 || r == 0)
+        return r;
+    analyzeAll(mAnalyzer, buffer, r);
+    return r;
+};
+
 template<class AnalyzerType> inline bool AnalyzerReadStream<AnalyzerType>::skipForward(qint64 bytes)
 {
     // we can't actually skip -- we have to read and analyze the bytes in between...
@@ -94,6 +127,7 @@ public:
 
     const AnalyzerType *analyzer() const { return mAnalyzer; }
     virtual bool write(const quint8 *buffer, int bytes);
+    virtual bool write(const quint8 *buffer, qint64 bytes);
     virtual void flush();
     virtual qint64 bytesWritten() const;
     virtual QString errorString() const;
@@ -109,6 +143,12 @@ template<class AnalyzerType> inline bool AnalyzerWriteStream<AnalyzerType>::writ
     return mStream->write(buffer, bytes);
 };
 
+template<class AnalyzerType> inline bool AnalyzerWriteStream<AnalyzerType>::write(const quint8 *buffer, qint64 bytes)
+{
+    analyzeAll(mAnalyzer, buffer, bytes);
+    return mStream->write(buffer, bytes);
+};
+
 template<class AnalyzerType> inline void AnalyzerWriteStream<AnalyzerType>::flush()
 {
     return mStream->flush();
@@ -30,7 +30,7 @@ public:
     ArchiveItem(const QString& path, const QString& name) : d(new Private) { d->path = path; d->name = name; }
     ArchiveItem(const ArchiveItem& other) : d(other.d) { }
 
-    const ArchiveItem& operator=(const ArchiveItem& other) { if (&other == this) return *this; d = other.d; }
+    const ArchiveItem& operator=(const ArchiveItem& other) { d = other.d; return *this; }
 
     bool isValid() const { return (d != 0); }
 
@@ -261,6 +261,8 @@ protected:
     SeekableReadStream *openFile(uint n);
 
     void addItem(const ArchiveItem& item);
+    // for what only turns up after open(), such as while extracting
+    void updateItem(uint id, const ArchiveItem& item);
     void setProperty(const QString& prop, const QVariant& val);
     void setErrorString(const QString& str);
 
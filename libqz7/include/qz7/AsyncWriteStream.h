@@ -0,0 +1,75 @@
+#ifndef QZ7_ASYNCWRITESTREAM_H
+#define QZ7_ASYNCWRITESTREAM_H
+
+#include "qz7/Stream.h"
+
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+#include <QtCore/QWaitCondition>
+
+namespace qz7 {
+
+class WriteBehindThread;
+
+// AsyncWriteStream writes behind: what is written to it is copied into a
+// ring of bufferCount buffers of bufferSize bytes, which a thread of its own
+// writes to the target, so the writer only waits when they are all full.
+// A failure of the target shows at the next write() or commit() (or in
+// hasError() after flush(), which waits for everything to be written).
+// bytesWritten() counts what was accepted. The target belongs to that
+// thread until the stream is flushed or destroyed.
+class AsyncWriteStream : public WriteStream {
+public:
+    enum { DefaultBufferSize = 1 << 20, DefaultBufferCount = 4 };
+
+    AsyncWriteStream(WriteStream *target, int bufferSize = DefaultBufferSize, int bufferCount = DefaultBufferCount);
+    virtual ~AsyncWriteStream();
+
+    using WriteStream::write;
+
+    virtual bool write(const quint8 *buffer, int bytes);
+    virtual void flush();
+    virtual qint64 bytesWritten() const;
+    virtual QString errorString() const;
+    virtual quint8 *acquireBuffer(int bytes);
+    virtual bool commit(int bytes);
+
+    bool hasError() const;
+
+private:
+    friend class WriteBehindThread;
+
+    class Buffer {
+    public:
+        Buffer() : data(0), size(0) { }
+        quint8 *data;
+        int size;
+    };
+
+    void drain();
+    bool queueBuffer();
+
+    WriteStream *mTarget;
+    WriteBehindThread *mThread;
+    Buffer *mBuffers;
+    int mBufferCount;
+    int mBufferSize;
+
+    // shared with the thread: how many buffers from the one it writes next
+    // are waiting for it
+    mutable QMutex mLock;
+    QWaitCondition mBufferQueued;
+    QWaitCondition mBufferWritten;
+    int mQueued;
+    bool mFailed;
+    bool mStopping;
+    QString mErrorString;
+
+    int mFillIndex;
+    bool mAcquiredOwn;      // acquireBuffer() handed out the base class' room
+    qint64 mBytesWritten;
+};
+
+}
+
+#endif
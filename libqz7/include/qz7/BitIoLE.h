@@ -6,6 +6,9 @@
 
 #include <QtCore/QtGlobal>
 
+#include <byteswap.h>
+#include <string.h>
+
 namespace qz7 {
 
 class ReadStream;
@@ -13,106 +16,124 @@ class WriteStream;
 
 class BitReaderLE {
 public:
-    BitReaderLE(ReadStream *stream) : mStream(stream), mBuffer(new quint8[BufferSize]),
-        mValid(0), mPos(0), mBitPos(0) { }
-    BitReaderLE() : mStream(0), mBuffer(new quint8[BufferSize]), mValid(0), mPos(0), mBitPos(0) { }
-    ~BitReaderLE() { delete[] mBuffer; }
+    BitReaderLE(ReadStream *stream) : mStream(stream) { reset(); }
+    BitReaderLE() : mStream(0) { reset(); }
 
-    void setBackingStream(ReadStream *stream) { mStream = stream; mValid = 0; mPos = 0; mBitPos = 0; }
+    void setBackingStream(ReadStream *stream) { mStream = stream; reset(); }
     const ReadStream *backingStream() const { return mStream; }
 
-    uint peekBits(uint nrBits) {
-        // check if we have enough data in our buffer to easily satisfy the request
-        // note the refill() will synthesize extra 0xff bytes if needed to fullfill a peek request
-        if (unlikely(needRefill(nrBits)))
-            return refill(nrBits, false);
+    // the largest request ensureBits() can satisfy without consuming in between
+    enum { MaxEnsureBits = 56 };
+
+    // make sure at least nrBits (<= MaxEnsureBits) are in the bit buffer; past
+    // the end of the stream, the buffer is padded with 1 bits, which will cause
+    // a TruncatedArchiveError if anyone actually tries to consume them
+    void ensureBits(uint nrBits) {
+        if (unlikely(mBitCount < nrBits))
+            refill(nrBits);
+    }
 
-        return fetchBits(nrBits);
+    uint peekBits(uint nrBits) {
+        ensureBits(nrBits);
+        return uint(mBitBuf & ((Q_UINT64_C(1) << nrBits) - 1));
     }
 
     uint peekReversedBits(uint nrBits) {
-        // ensure that we have enough bytes in the buffer
-        if (unlikely(needRefill(nrBits)))
-            return refill(nrBits, true);
-
-        uint pos = mPos;
-        uint ret = bitReverse(mBuffer[pos]);
-        uint bytesNeeded = (nrBits - mBitPos + 7) / 8;
-        uint bits = mBitPos + 8 * bytesNeeded;
-        while (bytesNeeded > 0) {
-            // we pad the buffer with ones; we'll throw an error if anyone actually tries to consume them
-            ret <<= 8;
-            ret |= bitReverse(mBuffer[++pos]);
-            --bytesNeeded;
-        }
+        if (!nrBits)
+            return 0;
 
+        uint bits = peekBits(nrBits);
+        uint ret = (bitReverse(bits & 0xff) << 24) | (bitReverse((bits >> 8) & 0xff) << 16) |
+                   (bitReverse((bits >> 16) & 0xff) << 8) | bitReverse(bits >> 24);
 
-        return (ret >> (bits - nrBits)) & ((1 << nrBits) - 1);
+        return ret >> (32 - nrBits);
     }
 
     void consumeBits(uint nrBits) {
-        if (unlikely(needRefill(nrBits))) {
+        if (unlikely(mBitCount < nrBits)) {
             // we should always have the bits we're trying to consume!
-            throw TruncatedArchiveError();
+            refill(nrBits);
+            if (mBitCount < nrBits)
+                throw TruncatedArchiveError();
         }
 
-        int bitpos = int(mBitPos) - nrBits;
-        while (bitpos < 0) {
-            ++mPos;
-            bitpos += 8;
-        }
-        mBitPos = bitpos;
+        mBitBuf >>= nrBits;
+        mBitCount -= nrBits;
     }
 
     void alignToByte() {
-        peekBits(8); // make sure we have another byte
-
-        if (mBitPos != 8) {
-            if (needRefill(16 - mBitPos))  // can't get another byte?
-                throw TruncatedArchiveError();
-            mPos += 1;
-            mBitPos = 8;
-        }
+        // the bit buffer is always filled a whole byte at a time, so any
+        // partial byte is at its bottom
+        consumeBits(mBitCount & 7);
     }
 
     uint readBits(uint nrBits) { uint ret = peekBits(nrBits); consumeBits(nrBits); return ret; }
 
+    // for byte-aligned input (after alignToByte()): lends up to maxBytes of
+    // it, consumed, without going through the bit buffer; *bytes is how many
+    // (0 only at the end of the stream). The pointer is good until the next
+    // call on the reader.
+    const quint8 *readAlignedBytes(uint maxBytes, uint *bytes);
+
+    // the number of bits consumed since the backing stream was set
+    quint64 position() const { return (mBytesLoaded - (mValid - mPos)) * 8 - mBitCount; }
+
+    // The *Fast() variants skip all checks, for decoder inner loops that
+    // have made sure beforehand that enough input is buffered: refillFast()
+    // may only be called while bufferedBytes() >= 8, and leaves at least
+    // MaxEnsureBits bits to be peeked and consumed.
+    uint bufferedBytes() const { return mValid - mPos; }
+
+    void refillFast() {
+        mBitBuf |= load64LE(&mBuffer[mPos]) << mBitCount;
+        mPos += 7 - (mBitCount >> 3);
+        mBitCount |= MaxEnsureBits;
+    }
+
+    uint peekBitsFast(uint nrBits) const { return uint(mBitBuf & ((Q_UINT64_C(1) << nrBits) - 1)); }
+    void consumeBitsFast(uint nrBits) { mBitBuf >>= nrBits; mBitCount -= nrBits; }
+    uint readBitsFast(uint nrBits) { uint ret = peekBitsFast(nrBits); consumeBitsFast(nrBits); return ret; }
+
 private:
-    enum { BufferSize = 4096 };
     static const quint8 BitReverseTable[256];
-    bool needRefill(uint nrBits) const { return ((mValid - mPos) * 8 + mBitPos) < nrBits; }
 
-    uint fetchBits(uint nrBits) const {
-        if (!nrBits)
-            return 0;
+    static quint64 load64LE(const quint8 *p) {
+        quint64 word;
+        ::memcpy(&word, p, sizeof(word));
 
-        uint pos = mPos;
-        uint ret = mBuffer[pos] >> (8 - mBitPos);
-        uint bytesNeeded = (nrBits - mBitPos + 7) / 8;
-        uint bitpos = mBitPos;
-        while (bytesNeeded > 0) {
-            ret |= mBuffer[++pos] << bitpos;
-            bitpos += 8;
-            --bytesNeeded;
-        }
-
-        return ret & ((1 << nrBits) - 1);
+        if (QSysInfo::ByteOrder == QSysInfo::BigEndian)
+            word = bswap_64(word);
+        return word;
     }
 
-    quint8 bitReverse(quint8 b) { return BitReverseTable[b]; }
-    uint refill(uint nrBits, bool reversed);
+
+    void reset() { mBuffer = 0; mBitBuf = 0; mBitCount = 0; mPos = 0; mValid = 0; mBytesLoaded = 0; mAtEnd = false; }
+    uint bitReverse(quint8 b) const { return BitReverseTable[b]; }
+    void refill(uint nrBits);
+    bool loadBuffer();
 
     ReadStream *mStream;
-    quint8 *mBuffer;
 
-    // the last byte with potentially valid bits in it
-    uint mValid;
+    // the input, borrowed from the stream (see ReadStream::peekBuffer()) and
+    // good until the next refill
+    const quint8 *mBuffer;
 
-    // the current position within the buffer
+    // the bits not yet consumed, next bit at the bottom, and how many of them are real
+    quint64 mBitBuf;
+    uint mBitCount;
+
+    // the next byte to go into the bit buffer, and the number of bytes in mBuffer
     uint mPos;
+    uint mValid;
 
-    // the number of valid bits within the current byte
-    uint mBitPos;
+    // the number of bytes read from the backing stream so far
+    quint64 mBytesLoaded;
+
+    // whether the backing stream has run dry
+    bool mAtEnd;
+
+    // what readAlignedBytes() took out of the bit buffer
+    quint8 mAligned[8];
 };
 
 class BitWriterLE {
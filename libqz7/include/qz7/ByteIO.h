@@ -64,8 +64,8 @@ public:
     }
 
     void readBuffer(QByteArray *ba, uint size) {
-        ba->reserve(size);
-        if (!mStream->read(reinterpret_cast<quint8 *>(ba->data()), size))
+        ba->resize(size);
+        if (!mStream->read(reinterpret_cast<quint8 *>(ba->data()), int(size)))
             throw TruncatedArchiveError();
     }
 
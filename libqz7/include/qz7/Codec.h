@@ -35,6 +35,11 @@ public:
     virtual QByteArray serializeProperties() const = 0;
     virtual bool applySerializedProperties(const QByteArray& serializedProperties) = 0;
 
+    // puts the properties back to their defaults for the codec to be used
+    // again, keeping whatever memory it holds on to; false if the codec
+    // can't do that (as by default), in which case it isn't reused
+    virtual bool reset();
+
 signals:
     void progress(quint64 bytesIn, quint64 bytesOut);
 };
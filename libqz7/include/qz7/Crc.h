@@ -22,8 +22,127 @@
 #define CRC_H
 #include <QtCore/QtGlobal>
 namespace qz7 {
+
+/*
+ * CRC tables computed by the compiler, so that they are ready (and constant)
+ * before any thread can look at them. CrcEntry<..., I, K>::value is entry I
+ * of slicing table K: the CRC of byte I followed by K zero bytes.
+ */
+template <typename T, T Poly, bool Reflected, T C, int Bits> struct CrcBits {
+    static const T next = (C & 1) ? T((C >> 1) ^ Poly) : T(C >> 1);
+    static const T value = CrcBits<T, Poly, Reflected, next, Bits - 1>::value;
+};
+template <typename T, T Poly, T C, int Bits> struct CrcBits<T, Poly, false, C, Bits> {
+    static const T next = ((C >> (sizeof(T) * 8 - 1)) & 1) ? T((C << 1) ^ Poly) : T(C << 1);
+    static const T value = CrcBits<T, Poly, false, next, Bits - 1>::value;
+};
+template <typename T, T Poly, bool Reflected, T C> struct CrcBits<T, Poly, Reflected, C, 0> {
+    static const T value = C;
+};
+template <typename T, T Poly, T C> struct CrcBits<T, Poly, false, C, 0> {
+    static const T value = C;
+};
+
+template <typename T, T Poly, bool Reflected, unsigned I, int K> struct CrcEntry {
+    static const T prev = CrcEntry<T, Poly, Reflected, I, K - 1>::value;
+    static const T value = T(prev >> 8) ^ CrcEntry<T, Poly, Reflected, unsigned(prev & 0xff), 0>::value;
+};
+template <typename T, T Poly, unsigned I, int K> struct CrcEntry<T, Poly, false, I, K> {
+    static const T prev = CrcEntry<T, Poly, false, I, K - 1>::value;
+    static const T value = T(prev << 8) ^ CrcEntry<T, Poly, false, unsigned(prev >> (sizeof(T) * 8 - 8)), 0>::value;
+};
+template <typename T, T Poly, unsigned I> struct CrcEntry<T, Poly, true, I, 0> {
+    static const T value = CrcBits<T, Poly, true, T(I), 8>::value;
+};
+template <typename T, T Poly, unsigned I> struct CrcEntry<T, Poly, false, I, 0> {
+    static const T value = CrcBits<T, Poly, false, T(static_cast<T>(I) << (sizeof(T) * 8 - 8)), 8>::value;
+};
+
+// the 256 entries of slicing table K, as an array initializer
+#define QZ7_CRC_ENTRY(T, Poly, Reflected, K, I) qz7::CrcEntry<T, Poly, Reflected, (I), K>::value
+#define QZ7_CRC_ENTRY4(T, Poly, Reflected, K, I) \
+    QZ7_CRC_ENTRY(T, Poly, Reflected, K, (I)), QZ7_CRC_ENTRY(T, Poly, Reflected, K, (I) + 1), \
+    QZ7_CRC_ENTRY(T, Poly, Reflected, K, (I) + 2), QZ7_CRC_ENTRY(T, Poly, Reflected, K, (I) + 3)
+#define QZ7_CRC_ENTRY16(T, Poly, Reflected, K, I) \
+    QZ7_CRC_ENTRY4(T, Poly, Reflected, K, (I)), QZ7_CRC_ENTRY4(T, Poly, Reflected, K, (I) + 4), \
+    QZ7_CRC_ENTRY4(T, Poly, Reflected, K, (I) + 8), QZ7_CRC_ENTRY4(T, Poly, Reflected, K, (I) + 12)
+#define QZ7_CRC_TABLE(T, Poly, Reflected, K) { \
+    QZ7_CRC_ENTRY16(T, Poly, Reflected, K, 0), QZ7_CRC_ENTRY16(T, Poly, Reflected, K, 16), \
+    QZ7_CRC_ENTRY16(T, Poly, Reflected, K, 32), QZ7_CRC_ENTRY16(T, Poly, Reflected, K, 48), \
+    QZ7_CRC_ENTRY16(T, Poly, Reflected, K, 64), QZ7_CRC_ENTRY16(T, Poly, Reflected, K, 80), \
+    QZ7_CRC_ENTRY16(T, Poly, Reflected, K, 96), QZ7_CRC_ENTRY16(T, Poly, Reflected, K, 112), \
+    QZ7_CRC_ENTRY16(T, Poly, Reflected, K, 128), QZ7_CRC_ENTRY16(T, Poly, Reflected, K, 144), \
+    QZ7_CRC_ENTRY16(T, Poly, Reflected, K, 160), QZ7_CRC_ENTRY16(T, Poly, Reflected, K, 176), \
+    QZ7_CRC_ENTRY16(T, Poly, Reflected, K, 192), QZ7_CRC_ENTRY16(T, Poly, Reflected, K, 208), \
+    QZ7_CRC_ENTRY16(T, Poly, Reflected, K, 224), QZ7_CRC_ENTRY16(T, Poly, Reflected, K, 240) }
+
+/*
+ * Crc<T, Poly, Reflected> is a running CRC of width T with the given
+ * polynomial, shifting bits out at the bottom (Reflected) or at the top,
+ * starting from all ones and inverted at the end. Its update() goes a byte
+ * at a time; the IEEE CRC of gzip and zip has a faster one.
+ */
+template <typename T, T Poly, bool Reflected> class Crc {
+public:
+    typedef T Value;
+
+    Crc() { clear(); }
+    void clear() { mVal = T(~T(0)); }
+    T value() const { return T(~mVal); }
+    void update(const quint8 *buffer, int bytes) { mVal = update(mVal, buffer, bytes); }
+    void update(const char *buffer, int bytes) { mVal = update(mVal, buffer, bytes); }
+    void update(quint32 word) { mVal = update(mVal, &word, 4); }
+    void update(qint32 word) { mVal = update(mVal, &word, 4); }
+    void update(quint16 word) { mVal = update(mVal, &word, 2); }
+    void update(qint16 word) { mVal = update(mVal, &word, 2); }
+    void update(quint8 byte) { mVal = update(mVal, &byte, 1); }
+    void update(qint8 byte) { mVal = update(mVal, &byte, 1); }
+
+    static T update(T crc, const void *buffer, size_t length);
+
+    static const T table[256];
+
+private:
+    T mVal;
+};
+
+template <typename T, T Poly, bool Reflected>
+const T Crc<T, Poly, Reflected>::table[256] = QZ7_CRC_TABLE(T, Poly, Reflected, 0);
+
+template <typename T, T Poly, bool Reflected>
+inline T Crc<T, Poly, Reflected>::update(T crc, const void *bufIn, size_t length)
+{
+    const quint8 *buffer = reinterpret_cast<const quint8 *>(bufIn);
+    const quint8 *end = buffer + length;
+
+    if (Reflected) {
+        while (buffer < end)
+            crc = table[quint8(crc) ^ *buffer++] ^ T(crc >> 8);
+    } else {
+        while (buffer < end)
+            crc = table[quint8(crc >> (sizeof(T) * 8 - 8)) ^ *buffer++] ^ T(crc << 8);
+    }
+    return crc;
+}
+
 quint32 CrcUpdate(quint32 crcInit, const void *buffer, size_t length);
 quint32 CrcInitValue();
+// the CRC value of two blocks from the values of each one
+quint32 CrcCombine(quint32 crcA, quint32 crcB, quint64 lengthB);
 inline quint32 CrcValue(quint32 crc) { return crc ^ 0xffffffff; };
+
+// gzip, zip and friends
+typedef Crc<quint32, 0xEDB88320U, true> Crc32;
+template <> inline quint32 Crc32::update(quint32 crc, const void *buffer, size_t length)
+{
+    return CrcUpdate(crc, buffer, length);
+}
+
+// bzip2
+typedef Crc<quint32, 0x04C11DB7U, false> Crc32BZip2;
+
+// xz
+typedef Crc<quint64, Q_UINT64_C(0xC96C5795D7870F42), true> Crc64;
+
 }
 #endif
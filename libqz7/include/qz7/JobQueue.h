@@ -0,0 +1,87 @@
+#ifndef QZ7_JOB_QUEUE_H
+#define QZ7_JOB_QUEUE_H
+
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QWaitCondition>
+
+namespace qz7 {
+
+// JobQueue hands out jobs to worker threads in the order they were queued,
+// and lets the thread queueing them wait for each one. A Job only needs a
+// bool done, which the queue sets (under its lock) in finished(); the jobs
+// belong to whoever queued them.
+template <typename Job> class JobQueue {
+public:
+    JobQueue() : mStopping(false) { }
+
+    void enqueue(Job *job)
+    {
+        QMutexLocker locker(&mLock);
+
+        mPending.append(job);
+        mWorkAvailable.wakeOne();
+    }
+
+    // for the workers: the next job, or 0 once stop() has been called
+    Job *dequeue()
+    {
+        QMutexLocker locker(&mLock);
+
+        while (mPending.isEmpty() && !mStopping)
+            mWorkAvailable.wait(&mLock);
+
+        if (mStopping)
+            return 0;
+        return mPending.takeFirst();
+    }
+
+    void finished(Job *job)
+    {
+        QMutexLocker locker(&mLock);
+
+        job->done = true;
+        mJobFinished.wakeAll();
+    }
+
+    void waitFor(Job *job)
+    {
+        QMutexLocker locker(&mLock);
+
+        while (!job->done)
+            mJobFinished.wait(&mLock);
+    }
+
+    // takes back a job that is no longer wanted, so that it can be deleted
+    void discard(Job *job)
+    {
+        QMutexLocker locker(&mLock);
+
+        // a job a worker has already started on has to be waited for
+        if (mPending.removeAll(job))
+            return;
+        while (!job->done)
+            mJobFinished.wait(&mLock);
+    }
+
+    void stop()
+    {
+        QMutexLocker locker(&mLock);
+
+        mStopping = true;
+        mWorkAvailable.wakeAll();
+    }
+
+private:
+    QList<Job *> mPending;
+    bool mStopping;
+
+    QMutex mLock;
+    QWaitCondition mWorkAvailable;
+    QWaitCondition mJobFinished;
+};
+
+}
+
+#endif
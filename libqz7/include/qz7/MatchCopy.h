@@ -0,0 +1,76 @@
+#ifndef QZ7_MATCH_COPY_H
+#define QZ7_MATCH_COPY_H
+
+#include "qz7/CompilerTools.h"
+
+#include <QtCore/QtGlobal>
+
+#include <string.h>
+
+namespace qz7 {
+
+// copyMatch() may write up to this many bytes past the end of the copy, so
+// buffers it's used on need that much extra space at their end
+enum { MatchCopySlack = 32 };
+
+// copies length bytes from src to dst in 32-byte steps; dst - src must be at
+// least 32. The best variant for the CPU we're running on is picked at startup.
+typedef void (*MatchCopyFunction)(quint8 *dst, const quint8 *src, uint length);
+extern MatchCopyFunction copyLongMatch;
+
+// puts every variant the CPU can run into variants (best last, which is the
+// one copyLongMatch starts out as) and returns how many there are
+enum { MaxLongMatchCopies = 3 };
+int supportedLongMatchCopies(MatchCopyFunction *variants);
+
+inline void copy8Bytes(quint8 *dst, const quint8 *src)
+{
+    quint64 v;
+    ::memcpy(&v, src, 8);
+    ::memcpy(dst, &v, 8);
+}
+
+// repeats the length bytes starting distance bytes before dst at dst, the way
+// an LZ77 back-reference does, so the source may overlap the destination
+inline void copyMatch(quint8 *dst, uint distance, uint length)
+{
+    const quint8 *src = dst - distance;
+    const quint8 *end = dst + length;
+
+    if (likely(distance >= 8)) {
+        if (distance >= 32 && length > 64) {
+            copyLongMatch(dst, src, length);
+            return;
+        }
+        // each 8 byte piece only reads bytes that have already been written
+        do {
+            copy8Bytes(dst, src);
+            copy8Bytes(dst + 8, src + 8);
+            dst += 16;
+            src += 16;
+        } while (dst < end);
+        return;
+    }
+
+    if (distance == 1) {
+        ::memset(dst, *src, length);
+        return;
+    }
+
+    // a short repeating pattern: it repeats just as well with a period that
+    // is a multiple of distance and at least 8, so write bytewise until that
+    // period is available and go on in 8 byte pieces from there
+    uint prime = qMin(((distance + 7) / distance - 1) * distance, length);
+    for (uint i = 0; i < prime; ++i)
+        dst[i] = src[i];
+    dst += prime;
+    while (dst < end) {
+        copy8Bytes(dst, src);
+        dst += 8;
+        src += 8;
+    }
+}
+
+}
+
+#endif
@@ -48,6 +48,15 @@ public:
     static Codec *createEncoder(int id, QObject *parent);
     static Volume *createVolume(const QString& mimeType, const QString& memberFile, QObject *parent);
 
+    // A decoder from the calling thread's pool of released ones (or a new
+    // one if there is none), reset() to its defaults; releasing it gives it
+    // back to the pool with the memory it set up for decoding, instead of
+    // deleting it. Both have to be called in the same thread. The decoder
+    // has no parent: it belongs to the pool and must be released rather
+    // than deleted. One that can't be reset() is deleted on release.
+    static Codec *acquireDecoder(const QString& name);
+    static void releaseDecoder(Codec *codec);
+
 private:
     Registry();
     ~Registry();
@@ -0,0 +1,86 @@
+#ifndef QZ7_PREFETCHREADSTREAM_H
+#define QZ7_PREFETCHREADSTREAM_H
+
+#include "qz7/Stream.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+#include <QtCore/QWaitCondition>
+
+namespace qz7 {
+
+class PrefetchThread;
+
+// PrefetchReadStream reads its source ahead of whoever reads from it, in a
+// thread of its own, into a ring of bufferCount buffers of bufferSize bytes;
+// peekBuffer() lends them out as they are, so decoding and waiting for the
+// disk overlap. The source belongs to that thread until the stream is
+// destroyed, and may have been read further than this stream was.
+class PrefetchReadStream : public ReadStream {
+public:
+    enum { DefaultBufferSize = 2 << 20, DefaultBufferCount = 4 };
+
+    PrefetchReadStream(ReadStream *source, int bufferSize = DefaultBufferSize, int bufferCount = DefaultBufferCount);
+    virtual ~PrefetchReadStream();
+
+    using ReadStream::read;
+    using ReadStream::readSome;
+    using ReadStream::peekBuffer;
+    using ReadStream::consume;
+
+    virtual bool read(quint8 *buffer, int bytes);
+    virtual int readSome(quint8 *buffer, int minBytes, int maxBytes);
+    virtual bool skipForward(qint64 bytes);
+    virtual bool atEnd() const;
+    virtual qint64 bytesRead() const;
+    virtual QString errorString() const;
+    virtual const quint8 *peekBuffer(int minBytes, int *bytes);
+    virtual void consume(int bytes);
+
+private:
+    friend class PrefetchThread;
+
+    class Buffer {
+    public:
+        Buffer() : data(0), size(0) { }
+        quint8 *data;
+        int size;
+    };
+
+    void fill();
+    bool waitForBuffer() const;
+    int takeBytes(quint8 *buffer, int bytes);
+    int takeFromRing(quint8 *buffer, int bytes);
+    void advance(int bytes);
+
+    ReadStream *mSource;
+    PrefetchThread *mThread;
+    Buffer *mBuffers;
+    int mBufferCount;
+    int mBufferSize;
+
+    // shared with the thread: how many buffers after mReadIndex are full,
+    // and whether the source has run out (or failed)
+    mutable QMutex mLock;
+    mutable QWaitCondition mBufferFilled;
+    QWaitCondition mBufferEmptied;
+    int mFilled;
+    bool mFinished;
+    bool mFailed;
+    bool mStopping;
+    QString mErrorString;
+
+    int mReadIndex;
+    int mReadOffset;
+    qint64 mBytesRead;
+
+    // what a peek asked for across the end of a buffer, put together
+    QByteArray mJoined;
+    int mJoinedStart;
+    int mJoinedEnd;
+};
+
+}
+
+#endif
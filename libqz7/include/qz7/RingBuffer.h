@@ -1,6 +1,9 @@
 #ifndef QZ7_RING_BUFFER_H
 #define QZ7_RING_BUFFER_H
 
+#include "qz7/CompilerTools.h"
+#include "qz7/MatchCopy.h"
+
 #include <QtCore/QtGlobal>
 #include <QtCore/QDebug>
 
@@ -8,125 +11,139 @@
 
 namespace qz7 {
 
+class Analyzer;
 class WriteStream;
 
+// The output window of an LZ77-style decoder. Despite its name the buffer
+// doesn't wrap: it holds the last historySize bytes followed by a linear
+// output area, so back-references are always plain forward copies. When the
+// output area fills up it is written out in one piece and the history is
+// moved back to the front of the buffer.
 class RingBuffer {
 public:
-    RingBuffer(uint size) : mStream(0), mBuffer(new quint8[size]), mSize(size), mPos(0) { }
-    RingBuffer() : mStream(0), mBuffer(0), mSize(0), mPos(0) { }
+    RingBuffer(uint size) : mStream(0), mAnalyzer(0), mBuffer(0), mHistorySize(0), mCapacity(0), mPos(0),
+        mFlushPos(0), mFlushed(0) { setBufferSize(size); }
+    RingBuffer() : mStream(0), mAnalyzer(0), mBuffer(0), mHistorySize(0), mCapacity(0), mPos(0), mFlushPos(0),
+        mFlushed(0) { }
     ~RingBuffer() { delete[] mBuffer; }
     
     void setBackingStream(WriteStream *stream) { mStream = stream; }
     WriteStream *backingStream() const { return mStream; }
-    void setBufferSize(uint size);
+    // runs over the output as it is written out, while it is still in the
+    // cache (e.g. to checksum it)
+    void setAnalyzer(Analyzer *analyzer) { mAnalyzer = analyzer; }
+    // size is the number of bytes that can be referred back to; outputSize
+    // the number of bytes that are collected before being written out
+    // (by default the same as size)
+    void setBufferSize(uint size, uint outputSize = 0);
+    uint historySize() const { return mHistorySize; }
     void clear();
     void flush();
     void putByte(quint8 byte);
     void putBytes(const quint8 *buf, uint length);
     quint8 peekByte(uint bytesBackwards) const;
     void repeatBytes(uint offset, uint bytes);
+
+    // the number of bytes put since clear()
+    quint64 position() const { return mFlushed + (mPos - mFlushPos); }
+    // copy out the last length bytes put, or make length bytes (right after
+    // clear()) the history without them becoming output
+    void copyHistory(quint8 *buf, uint length) const { ::memcpy(buf, &mBuffer[mPos - length], length); }
+    void setHistory(const quint8 *buf, uint length) { ::memcpy(&mBuffer[mPos - length], buf, length); }
+
+    // the number of bytes that can be put before the buffer has to be flushed;
+    // the NoFlush variants below must stay within it
+    uint available() const { return mCapacity - mPos; }
+    void putByteNoFlush(quint8 byte) { mBuffer[mPos++] = byte; }
+    void repeatBytesNoFlush(uint offset, uint bytes);
     
 private:
+    void makeRoom();
+    void putBytesDirect(const quint8 *buf, uint length);
+
     WriteStream *mStream;
+    Analyzer *mAnalyzer;
     quint8 *mBuffer;
-    uint mSize;
+    uint mHistorySize;
+    uint mCapacity;
     uint mPos;
+    uint mFlushPos;
+    quint64 mFlushed;
 };
 
-inline void RingBuffer::setBufferSize(uint size)
+inline void RingBuffer::setBufferSize(uint size, uint outputSize)
 {
-    if (size == mSize)
+    if (!outputSize)
+        outputSize = size;
+    if (size == mHistorySize && size + outputSize == mCapacity)
         return;
 
     delete[] mBuffer;
-    mBuffer = new quint8[size];
-    mSize = size;
+    mCapacity = size + outputSize;
+    mBuffer = new quint8[mCapacity + MatchCopySlack];
+    mHistorySize = size;
+    mPos = mFlushPos = size;
 }
 
 inline void RingBuffer::clear()
 {
-    ::memset(mBuffer, 0, mSize);
-    mPos = 0;
+    // references before the start of the data read zeroes
+    ::memset(mBuffer, 0, mHistorySize);
+    mPos = mFlushPos = mHistorySize;
+    mFlushed = 0;
 }
 
 inline void RingBuffer::putByte(quint8 byte)
 {
     mBuffer[mPos++] = byte;
     
-    if (mPos == mSize)
-        flush();
+    if (mPos == mCapacity)
+        makeRoom();
 };
 
 inline void RingBuffer::putBytes(const quint8 *bytes, uint length)
 {
+    // a run that would fill the output area is written out from where it is
+    if (length >= mCapacity - mHistorySize && mStream) {
+        putBytesDirect(bytes, length);
+        return;
+    }
+
     while (length) {
-        // apply Duff's Device
-        uint block = qMin(length, mSize - mPos);
-        uint n = (block + 7) / 8;
-
-        const quint8 *src = bytes;
-        quint8 *dst = &mBuffer[mPos];
-        switch (block & 7) {
-        case 0: do { *dst++ = *src++;
-        case 7: *dst++ = *src++;
-        case 6: *dst++ = *src++;
-        case 5: *dst++ = *src++;
-        case 4: *dst++ = *src++;
-        case 3: *dst++ = *src++;
-        case 2: *dst++ = *src++;
-        case 1: *dst++ = *src++; } while (--n);
-        }
+        uint block = qMin(length, mCapacity - mPos);
 
+        ::memcpy(&mBuffer[mPos], bytes, block);
+        bytes += block;
         mPos += block;
         length -= block;
-        if (mPos == mSize)
-            flush();
+        if (mPos == mCapacity)
+            makeRoom();
     }
 }
 
 inline quint8 RingBuffer::peekByte(uint bytesBackwards) const
 {
-    int pos = int(mPos) - int(bytesBackwards) - 1;
-    
-    if (pos < 0)
-        pos += mSize;
-    
-    return mBuffer[pos];
+    return mBuffer[mPos - bytesBackwards - 1];
 };
 
 inline void RingBuffer::repeatBytes(uint offset, uint bytes)
 {
-    // use unsigned arithmetic to find the source
-    uint srcOff = qMin(mPos - offset - 1, mSize + mPos - offset - 1);
-
     while (bytes) {
-        // apply Duff's Device
-        uint block = qMin(qMin(bytes, mSize - mPos), mSize - srcOff);
-        uint n = (block + 7) / 8;
-
-        quint8 *src = &mBuffer[srcOff];
-        quint8 *dst = &mBuffer[mPos];
-        switch (block & 7) {
-        case 0: do { *dst++ = *src++;
-        case 7: *dst++ = *src++;
-        case 6: *dst++ = *src++;
-        case 5: *dst++ = *src++;
-        case 4: *dst++ = *src++;
-        case 3: *dst++ = *src++;
-        case 2: *dst++ = *src++;
-        case 1: *dst++ = *src++; } while (--n);
-        }
+        uint block = qMin(bytes, mCapacity - mPos);
+
+        repeatBytesNoFlush(offset, block);
         bytes -= block;
-        srcOff += block;
-        mPos += block;
-        
-        if (mPos == mSize)
-            flush();
-        if (srcOff == mSize)
-            srcOff = 0;
+        if (mPos == mCapacity)
+            makeRoom();
     }
 };
 
+inline void RingBuffer::repeatBytesNoFlush(uint offset, uint bytes)
+{
+    copyMatch(&mBuffer[mPos], offset + 1, bytes);
+    mPos += bytes;
+}
+
 }
 
 #endif
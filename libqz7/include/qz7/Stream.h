@@ -5,11 +5,14 @@
 
 class QString;
 class QIODevice;
+class QBuffer;
+class QFile;
 
 namespace qz7 {
 
 class ReadStream {
 public:
+    ReadStream() : mPeekBuffer(0), mPeekCapacity(0), mPeekStart(0), mPeekEnd(0) { }
     virtual ~ReadStream();
     virtual bool read(quint8 *buffer, int bytes) = 0;
     virtual int readSome(quint8 *buffer, int minBytes, int maxBytes) = 0;
@@ -17,24 +20,82 @@ public:
     virtual bool atEnd() const = 0;
     virtual qint64 bytesRead() const = 0;   // meant for I/O statistics: doesn't include actually skipped bytes
     virtual QString errorString() const = 0;
+
+    // Borrowing instead of copying: peekBuffer() returns the next *bytes
+    // bytes of the stream where they already are (at least minBytes of them,
+    // fewer only at its end; 0 on error) and consume() then moves past the
+    // first bytes of them. The data stays valid until the next call on the
+    // stream other than consume(); what was peeked but not consumed mustn't
+    // be followed by read(). By default, they read into a buffer of the
+    // stream's own.
+    virtual const quint8 *peekBuffer(int minBytes, int *bytes);
+    virtual void consume(int bytes);
+
+    // 64-bit versions of the above, for moving more than 2 GB in one call
+    // (such as out of a mapping). By default they are done a piece at a
+    // time with the int versions; subclasses that override only those bring
+    // these into scope with a using-declaration.
+    virtual bool read(quint8 *buffer, qint64 bytes);
+    virtual qint64 readSome(quint8 *buffer, qint64 minBytes, qint64 maxBytes);
+    virtual const quint8 *peekBuffer(qint64 minBytes, qint64 *bytes);
+    virtual void consume(qint64 bytes);
+
+protected:
+    // forget what was peeked but not consumed (e.g. after a seek)
+    void discardPeeked() { mPeekStart = mPeekEnd = 0; }
+    // what the default peekBuffer() has read from the stream but nobody
+    // has consumed yet
+    int peekedBytes() const { return mPeekEnd - mPeekStart; }
+
+    // the most the int versions are asked for at once
+    enum { MaxChunk = 1 << 30 };
+
+private:
+    enum { PeekBufferSize = 64 * 1024 };
+
+    quint8 *mPeekBuffer;
+    int mPeekCapacity;
+    int mPeekStart;
+    int mPeekEnd;
 };
 
 class WriteStream {
 public:
+    WriteStream() : mAcquireBuffer(0), mAcquireCapacity(0) { }
     virtual ~WriteStream();
     virtual bool write(const quint8 *buffer, int bytes) = 0;
     virtual void flush() = 0;
     virtual qint64 bytesWritten() const = 0;
     virtual QString errorString() const = 0;
+
+    // Filling the stream's memory in place: acquireBuffer() returns room for
+    // bytes bytes and commit() then writes the first bytes of them (at most
+    // as many as were acquired). By default the room is a buffer of the
+    // stream's own that commit() write()s.
+    virtual quint8 *acquireBuffer(int bytes);
+    virtual bool commit(int bytes);
+
+    // the same for more than 2 GB; by default a piece at a time
+    virtual bool write(const quint8 *buffer, qint64 bytes);
+
+protected:
+    enum { MaxChunk = 1 << 30 };
+
+private:
+    quint8 *mAcquireBuffer;
+    int mAcquireCapacity;
 };
 
 class SeekableReadStream : public ReadStream {
 public:
     virtual qint64 size() const = 0;
     virtual qint64 pos() const = 0;
-    virtual bool setPos(qint64 pos) = 0;
+    virtual bool setPos(qint64 pos) = 0;  // also discards what was peeked
 };
 
+// Over a QBuffer, peekBuffer() lends out the buffer's data; over any other
+// device, what was peeked has been read from it already, and atEnd(),
+// skipForward() (and QioSeekableReadStream::pos()) take it into account.
 class QioReadStream : public ReadStream {
 public:
     QioReadStream(QIODevice *dev);
@@ -45,13 +106,24 @@ public:
     virtual bool atEnd() const;
     virtual qint64 bytesRead() const;
     virtual QString errorString() const;
+    virtual const quint8 *peekBuffer(int minBytes, int *bytes);
+    virtual void consume(int bytes);
+    virtual bool read(quint8 *buffer, qint64 bytes);
+    virtual qint64 readSome(quint8 *buffer, qint64 minBytes, qint64 maxBytes);
+    using ReadStream::peekBuffer;
+    using ReadStream::consume;
 
     QIODevice *device() { return mDevice; }
     const QIODevice *device() const { return mDevice; }
 
+protected:
+    void discardPeeked() { ReadStream::discardPeeked(); }
+    int peekedBytes() const { return ReadStream::peekedBytes(); }
+
 private:
     qint64 mBytesRead;
     QIODevice *mDevice;
+    QBuffer *mBuffer;       // the device, if its data can be lent out
 };
 
 class QioSeekableReadStream : public QioReadStream, public SeekableReadStream {
@@ -64,9 +136,57 @@ public:
     virtual bool atEnd() const;
     virtual qint64 bytesRead() const;
     virtual QString errorString() const;
+    virtual const quint8 *peekBuffer(int minBytes, int *bytes);
+    virtual void consume(int bytes);
+    virtual bool read(quint8 *buffer, qint64 bytes);
+    virtual qint64 readSome(quint8 *buffer, qint64 minBytes, qint64 maxBytes);
+    virtual const quint8 *peekBuffer(qint64 minBytes, qint64 *bytes);
+    virtual void consume(qint64 bytes);
+    virtual qint64 size() const;
+    virtual qint64 pos() const;
+    virtual bool setPos(qint64 pos);
+};
+
+// A file mapped into memory: reads are memcpy()s from the page cache and
+// peekBuffer() lends out the mapping itself (all of it, with the 64-bit
+// version). The file has to stay open (and
+// mustn't shrink) while the stream is in use; isMapped() is false if it
+// couldn't be mapped (e.g. it is empty, or too large for the address space).
+class MappedFileReadStream : public SeekableReadStream {
+public:
+    MappedFileReadStream(QFile *file);
+    virtual ~MappedFileReadStream();
+    bool isMapped() const { return mData != 0; }
+
+    virtual bool read(quint8 *buffer, int bytes);
+    virtual int readSome(quint8 *buffer, int minBytes, int maxBytes);
+    virtual bool skipForward(qint64 bytes);
+    virtual bool atEnd() const;
+    virtual qint64 bytesRead() const;
+    virtual QString errorString() const;
+    virtual const quint8 *peekBuffer(int minBytes, int *bytes);
+    virtual void consume(int bytes);
+    virtual bool read(quint8 *buffer, qint64 bytes);
+    virtual qint64 readSome(quint8 *buffer, qint64 minBytes, qint64 maxBytes);
+    virtual const quint8 *peekBuffer(qint64 minBytes, qint64 *bytes);
+    virtual void consume(qint64 bytes);
     virtual qint64 size() const;
     virtual qint64 pos() const;
     virtual bool setPos(qint64 pos);
+
+private:
+    // how far ahead the kernel is asked to read
+    enum { ReadAhead = 8 << 20 };
+
+    void adviseAhead();
+
+    QFile *mFile;
+    quint8 *mData;
+    qint64 mSize;
+    qint64 mPos;
+    qint64 mBytesRead;
+    qint64 mAdvisedStart;
+    qint64 mAdvisedEnd;
 };
 
 class QioWriteStream : public WriteStream {
@@ -77,6 +197,9 @@ public:
     virtual void flush();
     virtual qint64 bytesWritten() const;
     virtual QString errorString() const;
+    virtual quint8 *acquireBuffer(int bytes);
+    virtual bool commit(int bytes);
+    virtual bool write(const quint8 *buffer, qint64 bytes);
 
     QIODevice *device() { return mDevice; }
     const QIODevice *device() const { return mDevice; }
@@ -84,6 +207,8 @@ public:
 private:
     qint64 mBytesWritten;
     QIODevice *mDevice;
+    QBuffer *mBuffer;       // the device, if it can be written in place
+    qint64 mSizeBeforeAcquire;
 };
 
 class LimitedReadStream : public ReadStream {
@@ -95,6 +220,12 @@ public:
     virtual bool atEnd() const;
     virtual qint64 bytesRead() const;
     virtual QString errorString() const;
+    virtual const quint8 *peekBuffer(int minBytes, int *bytes);
+    virtual void consume(int bytes);
+    virtual bool read(quint8 *buffer, qint64 bytes);
+    virtual qint64 readSome(quint8 *buffer, qint64 minBytes, qint64 maxBytes);
+    virtual const quint8 *peekBuffer(qint64 minBytes, qint64 *bytes);
+    virtual void consume(qint64 bytes);
 
 private:
     qint64 mBytesLeft;
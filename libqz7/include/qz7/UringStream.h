@@ -0,0 +1,136 @@
+#ifndef QZ7_URINGSTREAM_H
+#define QZ7_URINGSTREAM_H
+
+#include "qz7/Stream.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+
+class QFile;
+
+namespace qz7 {
+
+class UringQueue;
+
+// File streams that queue their I/O with io_uring on Linux: reads are
+// submitted bufferCount blocks of bufferSize bytes ahead of the position,
+// in one system call, into buffers registered with the kernel, and writes
+// are submitted as buffers fill up; the calling thread only waits for a
+// block that isn't there yet (or a buffer that isn't free yet). Each
+// stream sets up a ring of its own, sized to its buffers, so what this
+// buys is read-ahead and write-behind without a thread, not one submitter
+// shared between streams. Without io_uring (where the kernel refuses it,
+// or with useRing false), they do pread()/pwrite() of the same blocks, and
+// usesRing() is false. Both work on the file's descriptor: the file must
+// stay open while they are in use.
+//
+// SingleFileVolume and Archive::extractTo() only use them with
+// QZ7_IO_URING=true in the environment.
+class UringFileReadStream : public SeekableReadStream {
+public:
+    enum { DefaultBufferSize = 1 << 20, DefaultBufferCount = 4 };
+
+    UringFileReadStream(QFile *file, int bufferSize = DefaultBufferSize, int bufferCount = DefaultBufferCount, bool useRing = true);
+    virtual ~UringFileReadStream();
+    bool usesRing() const { return mRing != 0; }
+
+    using ReadStream::read;
+    using ReadStream::readSome;
+    using ReadStream::peekBuffer;
+    using ReadStream::consume;
+
+    virtual bool read(quint8 *buffer, int bytes);
+    virtual int readSome(quint8 *buffer, int minBytes, int maxBytes);
+    virtual bool skipForward(qint64 bytes);
+    virtual bool atEnd() const;
+    virtual qint64 bytesRead() const;
+    virtual QString errorString() const;
+    virtual const quint8 *peekBuffer(int minBytes, int *bytes);
+    virtual void consume(int bytes);
+    virtual qint64 size() const;
+    virtual qint64 pos() const;
+    virtual bool setPos(qint64 pos);
+
+private:
+    enum BlockState { Empty, Pending, Ready };
+
+    class Block {
+    public:
+        Block() : data(0), number(-1), state(Empty), size(0) { }
+        quint8 *data;
+        qint64 number;
+        BlockState state;
+        int size;
+    };
+
+    const Block *currentBlock();
+    void readBlock(Block *block);
+    bool reapOne();
+
+    int mFd;
+    UringQueue *mRing;
+    Block *mBlocks;
+    int mBlockCount;
+    int mBlockSize;
+
+    qint64 mSize;
+    qint64 mPos;
+    qint64 mBytesRead;
+    QString mErrorString;
+
+    QByteArray mJoined;     // a peek across the end of a block
+};
+
+class UringFileWriteStream : public WriteStream {
+public:
+    enum { DefaultBufferSize = 1 << 20, DefaultBufferCount = 4 };
+
+    // writes from the file's current position on
+    UringFileWriteStream(QFile *file, int bufferSize = DefaultBufferSize, int bufferCount = DefaultBufferCount, bool useRing = true);
+    virtual ~UringFileWriteStream();
+    bool usesRing() const { return mRing != 0; }
+
+    using WriteStream::write;
+
+    virtual bool write(const quint8 *buffer, int bytes);
+    virtual void flush();           // waits for everything, then moves the file's position past it
+    virtual qint64 bytesWritten() const;
+    virtual QString errorString() const;
+    virtual quint8 *acquireBuffer(int bytes);
+    virtual bool commit(int bytes);
+
+    bool hasError() const { return mFailed; }
+
+private:
+    class Buffer {
+    public:
+        Buffer() : data(0), size(0), done(0), offset(0), pending(false) { }
+        quint8 *data;
+        int size;
+        int done;
+        qint64 offset;
+        bool pending;
+    };
+
+    bool submitBuffer();
+    void writeBuffer(int index);
+    bool reapOne();
+
+    QFile *mFile;
+    int mFd;
+    UringQueue *mRing;
+    Buffer *mBuffers;
+    int mBufferCount;
+    int mBufferSize;
+    int mFillIndex;
+    bool mAcquiredOwn;      // acquireBuffer() handed out the base class' room
+
+    qint64 mOffset;
+    qint64 mBytesWritten;
+    bool mFailed;
+    QString mErrorString;
+};
+
+}
+
+#endif
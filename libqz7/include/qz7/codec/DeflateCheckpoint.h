@@ -0,0 +1,47 @@
+#ifndef QZ7_DEFLATECHECKPOINT_H
+#define QZ7_DEFLATECHECKPOINT_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QDataStream>
+#include <QtCore/QList>
+#include <QtCore/QMetaType>
+
+namespace qz7 {
+
+// A block boundary in a deflate stream from which decoding can be resumed
+// without decoding everything before it (as zlib's zran example does): the
+// decoder starts at bit compressedBitOffset of the stream with window as the
+// history that back-references may reach into, and its output continues at
+// uncompressedOffset.
+//
+// A deflate decoder records them with its "checkpointInterval" property set
+// (hands them out as its "checkpoints" property) and resumes from one given
+// as its "resumeFrom" property, with the input positioned at byte
+// compressedBitOffset / 8 of the stream.
+class DeflateCheckpoint {
+public:
+    DeflateCheckpoint() : uncompressedOffset(0), compressedBitOffset(0) { }
+
+    quint64 uncompressedOffset;
+    quint64 compressedBitOffset;
+    QByteArray window;
+};
+
+typedef QList<DeflateCheckpoint> DeflateCheckpointList;
+
+inline QDataStream& operator<<(QDataStream& str, const DeflateCheckpoint& checkpoint)
+{
+    return str << checkpoint.uncompressedOffset << checkpoint.compressedBitOffset << checkpoint.window;
+}
+
+inline QDataStream& operator>>(QDataStream& str, DeflateCheckpoint& checkpoint)
+{
+    return str >> checkpoint.uncompressedOffset >> checkpoint.compressedBitOffset >> checkpoint.window;
+}
+
+}
+
+Q_DECLARE_METATYPE(qz7::DeflateCheckpoint)
+Q_DECLARE_METATYPE(qz7::DeflateCheckpointList)
+
+#endif
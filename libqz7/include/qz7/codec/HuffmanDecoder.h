@@ -10,6 +10,23 @@ namespace qz7 {
 
 enum { HUFFMAN_TABLE_BITS = 9 };
 
+// How a HuffmanDecoder turns the next MAX_BITS of input into a symbol:
+//  - HuffmanDecodeLimits looks the code length up in a small table (or
+//    searches the per-length limits for long codes) and then computes the
+//    symbol's index from the length; it keeps the decoder compact.
+//  - HuffmanDecodeTable keeps a table indexed directly by the first
+//    TABLE_BITS of the code whose entries hold both the symbol and its
+//    length, with second-level tables for the (rare) longer codes; a
+//    short code is decoded with a single lookup.
+//  - HuffmanDecodeReversedTable is the same, but builds the tables indexed
+//    by the bit-reversed codes, so that the MSB-first codes of an LSB-first
+//    stream can be looked up straight from peekBits() (as zlib does).
+enum HuffmanDecodeMode {
+    HuffmanDecodeLimits,
+    HuffmanDecodeTable,
+    HuffmanDecodeReversedTable
+};
+
 // For reasons which are unclear to me, Huffman tables in DEFLATE-derived
 // compression formats store their symbols most-significant-bit first, even
 // in an otherwise LSBF bit stream (c.f. RFC 1951). Work around
@@ -28,7 +45,8 @@ template<> inline uint SymbolReader<BitReaderBE>::peekSymbol(BitReaderBE& stream
     return stream.peekBits(bits);
 };
 
-template <uint MAX_BITS, uint NR_SYMBOLS> class HuffmanDecoder
+template <uint MAX_BITS, uint NR_SYMBOLS, HuffmanDecodeMode MODE = HuffmanDecodeLimits,
+          uint TABLE_BITS = HUFFMAN_TABLE_BITS> class HuffmanDecoder
 {
 public:
     HuffmanDecoder() {}
@@ -66,8 +84,8 @@ public:
             m_Positions[i] = m_Positions[i - 1] + lenCounts[i - 1];
             tmpPositions[i] = m_Positions[i];
 
-            if (i <= HUFFMAN_TABLE_BITS) {
-                quint32 limit = (m_Limits[i] >> (MAX_BITS - HUFFMAN_TABLE_BITS));
+            if (i <= TABLE_BITS) {
+                quint32 limit = (m_Limits[i] >> (MAX_BITS - TABLE_BITS));
                 for (; index < limit; index++)
                     m_Lengths[index] = (quint8)i;
             }
@@ -87,10 +105,10 @@ public:
 
         value = SymbolReader<TBitDecoder>::peekSymbol(bitStream, MAX_BITS);
 
-        if (likely(value < m_Limits[HUFFMAN_TABLE_BITS])) {
-            numBits = m_Lengths[value >> (MAX_BITS - HUFFMAN_TABLE_BITS)];
+        if (likely(value < m_Limits[TABLE_BITS])) {
+            numBits = m_Lengths[value >> (MAX_BITS - TABLE_BITS)];
         } else {
-            for (numBits = HUFFMAN_TABLE_BITS + 1; value >= m_Limits[numBits]; numBits++)
+            for (numBits = TABLE_BITS + 1; value >= m_Limits[numBits]; numBits++)
                 ;
         }
 
@@ -108,7 +126,207 @@ private:
     quint32 m_Limits[MAX_BITS + 1];     // m_Limits[i] = value limit for symbols with length = i
     quint32 m_Positions[MAX_BITS + 1];  // m_Positions[i] = index in m_Symbols[] of first symbol with length = i
     quint32 m_Symbols[NR_SYMBOLS];
-    quint8 m_Lengths[1 << HUFFMAN_TABLE_BITS];   // Table of length for short codes.
+    quint8 m_Lengths[1 << TABLE_BITS];   // Table of length for short codes.
+};
+
+template <uint MAX_BITS, uint NR_SYMBOLS, uint TABLE_BITS, bool REVERSED>
+class HuffmanTableDecoder
+{
+public:
+    HuffmanTableDecoder() {}
+
+    void setCodeLengths(const quint8 *codeLengths) {
+        uint lenCounts[MAX_BITS + 1], nextCode[MAX_BITS + 1], sortPositions[MAX_BITS + 1];
+        quint16 usedSymbols[NR_SYMBOLS], sortedSymbols[NR_SYMBOLS], sortedCodes[NR_SYMBOLS];
+        uint numUsed = 0;
+        uint i;
+
+        for (i = 0; i <= MAX_BITS; i++)
+            lenCounts[i] = 0;
+
+        // this is the only pass over all NR_SYMBOLS lengths: everything
+        // after it works on the symbols which actually have a code, which
+        // for typical dynamic blocks is a fraction of the alphabet
+        for (uint symbol = 0; symbol < NR_SYMBOLS; symbol++) {
+            uint len = codeLengths[symbol];
+            if (len != 0) {
+                if (len > MAX_BITS)
+                    throw CorruptedError();
+                lenCounts[len]++;
+                usedSymbols[numUsed++] = symbol;
+            }
+        }
+
+        // assign the canonical (MSB-first) codes, checking that the lengths
+        // don't describe more codes than there is room for
+        const uint MaxValue = (1 << MAX_BITS);
+        uint code = 0, codeSpace = 0, pos = 0;
+        lenCounts[0] = 0;
+        for (i = 1; i <= MAX_BITS; i++) {
+            code = (code + lenCounts[i - 1]) << 1;
+            nextCode[i] = code;
+            sortPositions[i] = pos;
+            pos += lenCounts[i];
+            codeSpace += lenCounts[i] << (MAX_BITS - i);
+            if (codeSpace > MaxValue)
+                throw CorruptedError();
+        }
+
+        // sort the used symbols by code length (and then by symbol); since
+        // the codes are canonical, this also sorts them by code
+        for (uint u = 0; u < numUsed; u++) {
+            uint symbol = usedSymbols[u];
+            uint len = codeLengths[symbol];
+            pos = sortPositions[len]++;
+            sortedSymbols[pos] = symbol;
+            sortedCodes[pos] = nextCode[len]++;
+        }
+
+        // a complete code covers every root entry and every entry of its
+        // sub-tables, so only an incomplete one (which deflate allows for
+        // e.g. a single distance code) needs the unused entries invalidated
+        const bool complete = (codeSpace == MaxValue);
+        if (!complete) {
+            for (i = 0; i < (1U << RootBits); i++)
+                m_Table[i] = InvalidEntry;
+        }
+
+        // short codes fill every root entry that they are a prefix of: a
+        // contiguous run for MSB-first codes, every (1 << len)'th entry for
+        // reversed ones
+        uint s = 0;
+        for (; s < numUsed; s++) {
+            uint len = codeLengths[sortedSymbols[s]];
+            if (len > RootBits)
+                break;
+            quint32 entry = (quint32(sortedSymbols[s]) << 16) | len;
+            if (REVERSED) {
+                for (i = reverse(sortedCodes[s], len); i < (1U << RootBits); i += (1 << len))
+                    m_Table[i] = entry;
+            } else {
+                uint first = uint(sortedCodes[s]) << (RootBits - len);
+                for (i = first; i < first + (1 << (RootBits - len)); i++)
+                    m_Table[i] = entry;
+            }
+        }
+
+        // long codes go into second-level tables, one per distinct root
+        // prefix; working backwards means that the first code we see with
+        // a given prefix is the longest one, which sizes its table
+        uint used = (1 << RootBits);
+        uint curPrefix = ~0U, subStart = 0, subBits = 0;
+        for (uint t = numUsed; t > s; t--) {
+            uint len = codeLengths[sortedSymbols[t - 1]];
+            uint longCode = sortedCodes[t - 1];
+            uint prefix = longCode >> (len - RootBits);
+
+            if (prefix != curPrefix) {
+                curPrefix = prefix;
+                subBits = len - RootBits;
+                subStart = used;
+                used += (1 << subBits);
+                Q_ASSERT(used <= TableSize);
+                if (!complete) {
+                    for (i = subStart; i < used; i++)
+                        m_Table[i] = InvalidEntry;
+                }
+                m_Table[REVERSED ? reverse(prefix, RootBits) : prefix] =
+                    (quint32(subStart) << 16) | SubTableFlag | subBits;
+            }
+
+            quint32 entry = (quint32(sortedSymbols[t - 1]) << 16) | len;
+            uint suffixBits = len - RootBits;
+            uint suffix = longCode & ((1 << suffixBits) - 1);
+            if (REVERSED) {
+                for (i = reverse(suffix, suffixBits); i < (1U << subBits); i += (1 << suffixBits))
+                    m_Table[subStart + i] = entry;
+            } else {
+                uint fill = subBits - suffixBits;
+                uint first = subStart + (suffix << fill);
+                for (i = first; i < first + (1 << fill); i++)
+                    m_Table[i] = entry;
+            }
+        }
+    }
+
+    template <class TBitDecoder>
+    quint32 decodeSymbol(TBitDecoder& bitStream) {
+        // for reversed tables, the first bit of the code is simply the
+        // lowest bit of what we peek
+        quint32 entry = lookup(REVERSED ? bitStream.peekBits(MAX_BITS) :
+                                          SymbolReader<TBitDecoder>::peekSymbol(bitStream, MAX_BITS));
+
+        quint32 symbol = entry >> 16;
+        if (unlikely(symbol >= NR_SYMBOLS))
+            throw CorruptedError();
+
+        bitStream.consumeBits(entry & LengthMask);
+        return symbol;
+    }
+
+    // for decoder inner loops which have already made sure that the bit
+    // stream holds at least MAX_BITS bits: no refills and no checks, so an
+    // invalid code comes back as a symbol >= NR_SYMBOLS for the caller to
+    // reject
+    template <class TBitDecoder>
+    quint32 decodeSymbolFast(TBitDecoder& bitStream) {
+        quint32 entry = lookup(REVERSED ? bitStream.peekBitsFast(MAX_BITS) :
+                                          SymbolReader<TBitDecoder>::peekSymbol(bitStream, MAX_BITS));
+
+        bitStream.consumeBitsFast(entry & LengthMask);
+        return entry >> 16;
+    }
+
+private:
+    quint32 lookup(quint32 value) const {
+        quint32 entry;
+
+        if (REVERSED) {
+            entry = m_Table[value & ((1 << RootBits) - 1)];
+            if (unlikely(entry & SubTableFlag)) {
+                uint subBits = entry & LengthMask;
+                entry = m_Table[(entry >> 16) + ((value >> RootBits) & ((1 << subBits) - 1))];
+            }
+        } else {
+            entry = m_Table[value >> (MAX_BITS - RootBits)];
+            if (unlikely(entry & SubTableFlag)) {
+                uint subBits = entry & LengthMask;
+                entry = m_Table[(entry >> 16) + ((value >> (MAX_BITS - RootBits - subBits)) & ((1 << subBits) - 1))];
+            }
+        }
+        return entry;
+    }
+
+    static uint reverse(uint code, uint bits) {
+        uint ret = 0;
+        for (uint i = 0; i < bits; i++, code >>= 1)
+            ret = (ret << 1) | (code & 1);
+        return ret;
+    }
+
+    // table entries are (symbol << 16 | code length) or, for the root entry
+    // of long codes, (sub-table offset << 16 | SubTableFlag | sub-table bits)
+    enum { LengthMask = 0xff, SubTableFlag = 0x100, InvalidEntry = 0xffff0000 };
+    enum { RootBits = (TABLE_BITS < MAX_BITS) ? TABLE_BITS : MAX_BITS };
+
+    // canonical codes fill the code space in order, so every sub-table but
+    // the last one is complete; that bounds the sub-tables' total size by
+    // the number of symbols plus twice the largest possible sub-table
+    enum { TableSize = (1 << RootBits) + ((RootBits < MAX_BITS) ? NR_SYMBOLS + (2 << (MAX_BITS - RootBits)) : 0) };
+
+    quint32 m_Table[TableSize];
+};
+
+template <uint MAX_BITS, uint NR_SYMBOLS, uint TABLE_BITS>
+class HuffmanDecoder<MAX_BITS, NR_SYMBOLS, HuffmanDecodeTable, TABLE_BITS>
+    : public HuffmanTableDecoder<MAX_BITS, NR_SYMBOLS, TABLE_BITS, false>
+{
+};
+
+template <uint MAX_BITS, uint NR_SYMBOLS, uint TABLE_BITS>
+class HuffmanDecoder<MAX_BITS, NR_SYMBOLS, HuffmanDecodeReversedTable, TABLE_BITS>
+    : public HuffmanTableDecoder<MAX_BITS, NR_SYMBOLS, TABLE_BITS, true>
+{
 };
 
 }
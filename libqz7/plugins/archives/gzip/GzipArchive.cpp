@@ -1,17 +1,57 @@
 #include "GzipArchive.h"
+#include "GzipMembers_p.h"
 
 #include "qz7/ByteIO.h"
 #include "qz7/Codec.h"
+#include "qz7/Crc.h"
 #include "qz7/CrcAnalyzer.h"
 #include "qz7/Plugin.h"
 #include "qz7/Stream.h"
 #include "qz7/Volume.h"
 
+#include <QtCore/QDataStream>
 #include <QtCore/QDateTime>
+#include <QtCore/QIODevice>
+#include <QtCore/QThread>
+#include <QtCore/QtAlgorithms>
 
 namespace qz7 {
 namespace gzip {
 
+namespace {
+
+// passes on what is written to it after dropping the first skip bytes;
+// without a target, it drops everything
+class RangeWriteStream : public WriteStream {
+public:
+    RangeWriteStream(WriteStream *target, quint64 skip) : mTarget(target), mSkip(skip), mBytesWritten(0) { }
+
+    using WriteStream::write;
+
+    virtual bool write(const quint8 *buffer, int bytes)
+    {
+        mBytesWritten += bytes;
+        if (mSkip >= quint64(bytes)) {
+            mSkip -= bytes;
+            return true;
+        }
+        buffer += mSkip;
+        bytes -= int(mSkip);
+        mSkip = 0;
+        return !mTarget || mTarget->write(buffer, bytes);
+    }
+    virtual void flush() { if (mTarget) mTarget->flush(); }
+    virtual qint64 bytesWritten() const { return mBytesWritten; }
+    virtual QString errorString() const { return mTarget ? mTarget->errorString() : QString(); }
+
+private:
+    WriteStream *mTarget;
+    quint64 mSkip;
+    qint64 mBytesWritten;
+};
+
+}
+
 ArchiveItem::HostOperatingSystem GzipArchive::mapToArchive(quint8 gzip)
 {
     static struct {
@@ -42,12 +82,17 @@ ArchiveItem::HostOperatingSystem GzipArchive::mapToArchive(quint8 gzip)
 }
 
 GzipArchive::GzipArchive(Volume *volume)
-    : Archive(volume), mStream(0), mCodec(0)
+    : Archive(volume), mStream(0), mCodec(0), mMemberDecoder(0), mThreadCount(QThread::idealThreadCount()), mTrailerCrc(0), mBgzf(false)
 {
+    if (qgetenv("QZ7_NO_MULTITHREADED") == "true")
+        mThreadCount = 1;
 }
 
 GzipArchive::~GzipArchive()
 {
+    // its workers are done with their decoders before this one goes back
+    delete mMemberDecoder;
+    Registry::releaseDecoder(mCodec);
 }
 
 bool GzipArchive::open()
@@ -65,98 +110,127 @@ bool GzipArchive::open()
     }
 }
 
-bool GzipArchive::doOpen()
+bool GzipArchive::readHeader(ByteIoReader& in, ArchiveItem *item)
 {
-    ArchiveItem item(true);
-    ByteIoReader in(mStream);
     Crc32 crc;
 
-    item.setItemType(ArchiveItem::ItemTypeFile);
-
     quint8 id1 = in.read8();
     crc.update(id1);
-    if (id1 != ID1) {
-        setErrorString(tr("does not look like a gzip file"));
+    if (id1 != ID1)
         return false;
-    }
 
     quint8 id2 = in.read8();
     crc.update(id2);
-    if (id2 != ID2) {
-        setErrorString(tr("does not look like a gzip file"));
+    if (id2 != ID2)
         return false;
-    }
 
     quint8 compressionMethod = in.read8();
     crc.update(compressionMethod);
 
     if (compressionMethod == GzipMethodDeflate)
-        item.setCompressionMethod(ArchiveItem::CompressionMethodDeflate);
+        item->setCompressionMethod(ArchiveItem::CompressionMethodDeflate);
     else
-        item.setCompressionMethod(ArchiveItem::CompressionMethod(compressionMethod));
+        item->setCompressionMethod(ArchiveItem::CompressionMethod(compressionMethod));
 
     quint8 flags = in.read8();
     quint32 mtime = in.read32LE();
     crc.update(flags);
     crc.update(mtime);
-    item.setMTime(QDateTime::fromTime_t(mtime));
+    item->setMTime(QDateTime::fromTime_t(mtime));
 
     quint8 xflags = in.read8();
     quint8 hostOs = in.read8();
     crc.update(xflags);
     crc.update(hostOs);
-    item.setHostOs(mapToArchive(hostOs));
+    item->setHostOs(mapToArchive(hostOs));
 
-    int headerSize = 10;
     if (flags & FMBZ)
         throw CorruptedError();
     if (flags & FHasExtra) {
         quint16 extraSize = in.read16LE();
-        headerSize += extraSize + 2;
         QByteArray extra;
         in.readBuffer(&extra, extraSize);
         crc.update(extraSize);
         crc.update(extra.constData(), extraSize);
-        item.setProperty("GzipItemExtra", QVariant::fromValue(extra));
+        item->setProperty("GzipItemExtra", QVariant::fromValue(extra));
     }
     if (flags & FHasName) {
         QByteArray name;
         in.readStringZ(&name);
-        headerSize += name.length();
-        crc.update(name.constData(), name.length());
-        item.setName(QString::fromLatin1(name));
+        crc.update(name.constData(), name.length() + 1);
+        item->setName(QString::fromLatin1(name));
     }
     if (flags & FHasComment) {
         QByteArray comment;
         in.readStringZ(&comment);
-        headerSize += comment.length();
-        crc.update(comment.constData(), comment.length());
-        item.setProperty("comment", QVariant::fromValue(QString::fromLatin1(comment)));
+        crc.update(comment.constData(), comment.length() + 1);
+        item->setProperty("comment", QVariant::fromValue(QString::fromLatin1(comment)));
     }
     if (flags & FHasCrc) {
-        headerSize += 2;
         quint16 expectedCrc = in.read16LE();
         if (expectedCrc != (crc.value() & 0xffff))
             throw CorruptedError();
     }
+    return true;
+}
+
+bool GzipArchive::doOpen()
+{
+    ArchiveItem item(true);
+    ByteIoReader in(mStream);
+
+    item.setItemType(ArchiveItem::ItemTypeFile);
+
+    if (!readHeader(in, &item)) {
+        setErrorString(tr("does not look like a gzip file"));
+        return false;
+    }
 
     item.setPosition(mStream->pos());
+    mBgzf = bgzfBlockSize(item.property("GzipItemExtra").value<QByteArray>()) != 0;
 
     qint64 size = mStream->size();
-    item.setCompressedSize(size - headerSize - 8);
+    item.setCompressedSize(size - item.position() - 8);
 
+    // the trailer at the end of the file tells it apart for the index
     if (!mStream->setPos(size - 8))
         throw ReadError(mStream);
-
-    quint32 dataCrc = in.read32LE();
-    item.setCrc(dataCrc);
-
-    quint32 uncompressedSize = in.read32LE();
+    mTrailerCrc = in.read32LE();
+    quint64 uncompressedSize = in.read32LE();
+
+    if (mBgzf && findBgzfBlocks()) {
+        // every block ends with its own trailer
+        quint32 crc = 0;
+        uncompressedSize = 0;
+        for (int i = 0; i < mBgzfBlocks.count(); ++i) {
+            const qint64 end = (i + 1 < mBgzfBlocks.count()) ? mBgzfBlocks.at(i + 1) :
+                mBgzfBlocks.at(i) + bgzfBlockSizeAt(mBgzfBlocks.at(i));
+            if (!mStream->setPos(end - 8))
+                throw ReadError(mStream);
+            const quint32 blockCrc = in.read32LE();
+            const quint32 blockSize = in.read32LE();
+            crc = CrcCombine(crc, blockCrc, blockSize);
+            uncompressedSize += blockSize;
+        }
+        item.setCrc(crc);
+    } else {
+        // other members can only be told from false alarms by decoding
+        // them, so this is the last member's trailer; extractTo() corrects
+        // it once it has been through all of them. ISIZE is the size modulo
+        // 2^32; as deflate makes nothing more than about 1/13000th larger,
+        // a single member's size that wrapped around shows in the compressed
+        // one (but only there)
+        item.setCrc(mTrailerCrc);
+        const quint64 leastSize = item.compressedSize() - item.compressedSize() / 13107;
+        if (leastSize > Q_UINT64_C(0xffffffff) && leastSize > uncompressedSize)
+            uncompressedSize += (leastSize - uncompressedSize + Q_UINT64_C(0xffffffff)) & ~Q_UINT64_C(0xffffffff);
+    }
     item.setUncompressedSize(uncompressedSize);
 
     addItem(item);
     return true;
 }
+
 bool GzipArchive::extractTo(uint id, WriteStream *target)
 {
     mInterrupted = false;
@@ -168,30 +242,318 @@ bool GzipArchive::extractTo(uint id, WriteStream *target)
         setErrorString(tr("unsupported compression method"));
         return false;
     }
-    if (!mStream->setPos(item.position())) {
-        setErrorString(ReadError(mStream).message());
+
+    if (!createCodec())
+        return false;
+
+    // the first member starts the file; in BGZF the others needn't be
+    // looked for
+    try {
+        bool ok;
+        if (mBgzf && mThreadCount > 1 && findBgzfBlocks())
+            ok = mMemberDecoder->decodeBlocks(mBgzfBlocks, 0, target);
+        else
+            ok = mMemberDecoder->decode(0, target);
+        if (!ok) {
+            setDecodeError(mMemberDecoder->errorString());
+            return false;
+        }
+    } catch (Error e) {
+        setErrorString(e.message());
         return false;
     }
 
+    // now that the members are known, the item is all of them
+    if (mMemberDecoder->memberCount() > 1 && !mBgzf) {
+        item.setUncompressedSize(mMemberDecoder->bytesDecoded());
+        item.setCrc(mMemberDecoder->crc());
+        updateItem(id, item);
+    }
+    return true;
+}
+
+bool GzipArchive::createCodec()
+{
     if (!mCodec)
-        mCodec = Registry::createDecoder("deflate", this);
+        mCodec = Registry::acquireDecoder("deflate");
     if (!mCodec) {
         setErrorString(tr("unable to create deflate decoder"));
         return false;
     }
+    if (!mMemberDecoder) {
+        mMemberDecoder = new GzipMemberDecoder(mStream, mCodec, this);
+        mMemberDecoder->setThreadCount(mThreadCount);
+    }
+    return true;
+}
 
-    LimitedReadStream ls(mStream, item.compressedSize());
-    Crc32WriteStream ws(target);
-    if (!mCodec->stream(&ls, &ws)) {
-        if (!mInterrupted)
-            setErrorString(mCodec->errorString());
-        else
-            setErrorString(tr("the operation was interrupted"));
+void GzipArchive::setDecodeError(const QString& error)
+{
+    if (!mInterrupted)
+        setErrorString(error);
+    else
+        setErrorString(tr("the operation was interrupted"));
+}
+
+void GzipArchive::setThreadCount(int threadCount)
+{
+    mThreadCount = qMax(threadCount, 1);
+    if (mMemberDecoder)
+        mMemberDecoder->setThreadCount(mThreadCount);
+}
+
+bool GzipArchive::buildIndex(uint id, quint64 interval)
+{
+    if (interval == 0 || id >= count() || !createCodec())
+        return false;
+
+    // checkpoint offsets are relative to the start of the item's data
+    DeflateCheckpointList checkpoints;
+    RangeWriteStream discard(0, 0);
+    mMemberDecoder->setIndex(&checkpoints, Archive::item(id).position(), interval);
+    const bool ok = extractTo(id, &discard);
+    mMemberDecoder->setIndex(0, 0, 0);
+    if (!ok)
+        return false;
+
+    mIndex.insert(id, checkpoints);
+    return true;
+}
+
+bool GzipArchive::hasIndex(uint id) const
+{
+    return mIndex.contains(id);
+}
+
+bool GzipArchive::extractRange(uint id, quint64 offset, quint64 length, WriteStream *target)
+{
+    mInterrupted = false;
+    if (id >= count())
+        return false;
+
+    ArchiveItem item = Archive::item(id);
+    if (item.compressionMethod() != ArchiveItem::CompressionMethodDeflate) {
+        setErrorString(tr("unsupported compression method"));
+        return false;
+    }
+    if (length == 0)
+        return true;
+    if (!createCodec())
+        return false;
+
+    // without an index (or before its first checkpoint) this decodes from
+    // the start of the item
+    const DeflateCheckpointList checkpoints = mIndex.value(id);
+    int i = checkpoints.count();
+    while (i > 0 && checkpoints.at(i - 1).uncompressedOffset > offset)
+        i--;
+    const DeflateCheckpoint start = (i > 0) ? checkpoints.at(i - 1) : DeflateCheckpoint();
+    const quint64 skipBytes = start.compressedBitOffset / 8;
+
+    if (skipBytes >= quint64(item.compressedSize())) {
+        setErrorString(CorruptedError().message());
+        return false;
+    }
+
+    const quint64 limit = offset - start.uncompressedOffset + length;
+    RangeWriteStream ws(target, offset - start.uncompressedOffset);
+    try {
+        if (i == 0) {
+            if (!mMemberDecoder->decode(0, &ws, limit)) {
+                setDecodeError(mMemberDecoder->errorString());
+                return false;
+            }
+            return true;
+        }
+
+        const qint64 dataPos = item.position() + skipBytes;
+        if (!mStream->setPos(dataPos))
+            throw ReadError(mStream);
+
+        // the rest of the member the checkpoint is in; no CRC can be checked
+        LimitedReadStream ls(mStream, mStream->size() - dataPos);
+        mCodec->setProperty("resumeFrom", QVariant::fromValue(start));
+        mCodec->setProperty("bytesExpected", limit);
+        const bool ok = mCodec->stream(&ls, &ws);
+        mCodec->setProperty("bytesExpected", quint64(0));
+        if (!ok) {
+            setDecodeError(mCodec->errorString());
+            return false;
+        }
+
+        // and the members after it, as far as the range (or the item) goes
+        if (quint64(ws.bytesWritten()) < limit) {
+            const qint64 next = dataPos + mCodec->property("bytesConsumed").toLongLong() + 8;
+            if (!mMemberDecoder->decode(next, &ws, limit - ws.bytesWritten())) {
+                setDecodeError(mMemberDecoder->errorString());
+                return false;
+            }
+        }
+    } catch (Error e) {
+        setErrorString(e.message());
         return false;
     }
+    return true;
+}
 
-    if (ws.analyzer()->value() != item.crc()) {
-        setErrorString(CrcError().message() + " (expected " + QString::number(item.crc(), 16) + ", got " + QString::number(ws.analyzer()->value(), 16) + ')');
+static const quint16 INDEX_MAGIC = 0x1f8b;
+static const quint8 INDEX_VERSION = 0;
+
+bool GzipArchive::saveIndex(QIODevice *device) const
+{
+    if (!mStream)
+        return false;
+
+    QDataStream str(device);
+    str.setVersion(QDataStream::Qt_4_3);
+
+    str << INDEX_MAGIC << INDEX_VERSION;
+    str << qint64(mStream->size());
+    str << quint32(mIndex.count());
+    for (QMap<uint, DeflateCheckpointList>::const_iterator it = mIndex.constBegin(); it != mIndex.constEnd(); ++it)
+        str << quint32(it.key()) << mTrailerCrc << it.value();
+
+    return str.status() == QDataStream::Ok;
+}
+
+bool GzipArchive::loadIndex(QIODevice *device)
+{
+    if (!mStream)
+        return false;
+
+    QDataStream str(device);
+    str.setVersion(QDataStream::Qt_4_3);
+
+    quint16 m;
+    str >> m;
+    if (m != INDEX_MAGIC)
+        return false;
+    quint8 v;
+    str >> v;
+    if (v != INDEX_VERSION)
+        return false;
+    qint64 size;
+    str >> size;
+    if (size != mStream->size())
+        return false;
+
+    quint32 items;
+    str >> items;
+    QMap<uint, DeflateCheckpointList> index;
+    for (quint32 i = 0; i < items && str.status() == QDataStream::Ok; i++) {
+        quint32 id, crc;
+        DeflateCheckpointList checkpoints;
+        str >> id >> crc >> checkpoints;
+        if (id >= count() || crc != mTrailerCrc)
+            return false;
+        index.insert(id, checkpoints);
+    }
+    if (str.status() != QDataStream::Ok)
+        return false;
+
+    mIndex = index;
+    return true;
+}
+
+// the size of a BGZF block from the BC subfield of its header, or 0
+uint GzipArchive::bgzfBlockSize(const QByteArray& extra)
+{
+    const uchar *p = reinterpret_cast<const uchar *>(extra.constData());
+    int i = 0;
+    while (i + 4 <= extra.size()) {
+        const uint length = p[i + 2] | (p[i + 3] << 8);
+        if (p[i] == 'B' && p[i + 1] == 'C' && length == 2 && i + 6 <= extra.size())
+            return (p[i + 4] | (p[i + 5] << 8)) + 1;
+        i += 4 + length;
+    }
+    return 0;
+}
+
+uint GzipArchive::bgzfBlockSizeAt(qint64 pos)
+{
+    quint8 header[12];
+    if (pos + 12 > mStream->size())
+        return 0;
+    if (!mStream->setPos(pos) || !mStream->read(header, 12))
+        throw ReadError(mStream);
+    if (header[0] != ID1 || header[1] != ID2 || header[2] != GzipMethodDeflate || !(header[3] & FHasExtra))
+        return 0;
+
+    ByteIoReader in(mStream);
+    QByteArray extra;
+    in.readBuffer(&extra, header[10] | (header[11] << 8));
+    return bgzfBlockSize(extra);
+}
+
+// walks the chain of block headers; a file that turns out to have members
+// without a BC field isn't treated as BGZF after all
+bool GzipArchive::findBgzfBlocks()
+{
+    if (!mBgzfBlocks.isEmpty())
+        return true;
+
+    QList<qint64> blocks;
+    const qint64 size = mStream->size();
+    qint64 pos = 0;
+    while (pos < size) {
+        const uint blockSize = bgzfBlockSizeAt(pos);
+        if (blockSize == 0)
+            break;
+        blocks.append(pos);
+        pos += blockSize;
+    }
+
+    quint8 magic[2];
+    if (pos + 2 <= size && (!mStream->setPos(pos) || !mStream->read(magic, 2)))
+        throw ReadError(mStream);
+    if (blocks.isEmpty() || (pos + 2 <= size && magic[0] == ID1 && magic[1] == ID2)) {
+        mBgzf = false;
+        return false;
+    }
+
+    mBgzfBlocks = blocks;
+    return true;
+}
+
+bool GzipArchive::extractBgzf(quint64 virtualOffset, quint64 length, WriteStream *target)
+{
+    mInterrupted = false;
+    if (!mBgzf) {
+        setErrorString(tr("not a BGZF file"));
+        return false;
+    }
+    if (length == 0)
+        return true;
+    if (!createCodec())
+        return false;
+
+    const qint64 blockPos = qint64(virtualOffset >> 16);
+    const uint offset = uint(virtualOffset & 0xffff);
+    RangeWriteStream ws(target, offset);
+    try {
+        if (bgzfBlockSizeAt(blockPos) == 0) {
+            setErrorString(tr("invalid BGZF virtual offset"));
+            return false;
+        }
+
+        // the blocks are only enumerated to hand them out to the workers
+        bool ok;
+        if (mThreadCount > 1 && findBgzfBlocks()) {
+            const int first = qLowerBound(mBgzfBlocks.constBegin(), mBgzfBlocks.constEnd(), blockPos) - mBgzfBlocks.constBegin();
+            if (first == mBgzfBlocks.count() || mBgzfBlocks.at(first) != blockPos) {
+                setErrorString(tr("invalid BGZF virtual offset"));
+                return false;
+            }
+            ok = mMemberDecoder->decodeBlocks(mBgzfBlocks, first, &ws, offset + length);
+        } else {
+            ok = mMemberDecoder->decode(blockPos, &ws, offset + length);
+        }
+        if (!ok) {
+            setDecodeError(mMemberDecoder->errorString());
+            return false;
+        }
+    } catch (Error e) {
+        setErrorString(e.message());
         return false;
     }
     return true;
@@ -209,6 +571,8 @@ bool GzipArchive::writeTo(WriteStream *target)
 
 void GzipArchive::interrupt()
 {
+    if (mMemberDecoder)
+        mMemberDecoder->interrupt();
     if (mCodec)
         mCodec->interrupt();
     mInterrupted = true;
@@ -2,16 +2,24 @@
 #define QZ7_GZIP_ARCHIVE_H
 
 #include "qz7/Archive.h"
+#include "qz7/codec/DeflateCheckpoint.h"
 
+#include <QtCore/QList>
+#include <QtCore/QMap>
 #include <QtCore/QObject>
 
+class QIODevice;
+
 namespace qz7 {
 
+class ByteIoReader;
 class Codec;
 class SeekableReadStream;
 
 namespace gzip {
 
+class GzipMemberDecoder;
+
 class GzipArchive : public Archive {
     Q_OBJECT
 
@@ -27,8 +35,44 @@ public:
 
     virtual void interrupt();
 
+    // the item is the concatenation of all the members in the file, which
+    // are decoded on up to threadCount threads
+    void setThreadCount(int threadCount);
+
+    // reads a member header into item; false if it isn't one
+    static bool readHeader(ByteIoReader& in, ArchiveItem *item);
+
+    // Random access into an item: buildIndex() decodes it once, taking a
+    // checkpoint every interval bytes of output; extractRange() then starts
+    // decoding at the last checkpoint before offset rather than at the start.
+    enum { DefaultCheckpointInterval = 4 << 20 };
+    bool buildIndex(uint id, quint64 interval = DefaultCheckpointInterval);
+    bool hasIndex(uint id) const;
+    bool extractRange(uint id, quint64 offset, quint64 length, WriteStream *target);
+
+    // the checkpoints as a sidecar file, so that they needn't be rebuilt
+    // when the archive is opened again; loadIndex() rejects an index made
+    // for a different file
+    bool saveIndex(QIODevice *device) const;
+    bool loadIndex(QIODevice *device);
+
+    // BGZF (the blocked gzip of samtools/htslib) is a series of members of at
+    // most 64 KB, each giving its own size in a "BC" extra field, so they can
+    // be found without decoding anything. A virtual offset is the position of
+    // a member in the file shifted left by 16 bits plus an offset into its
+    // uncompressed data; extractBgzf() starts decoding right at that member.
+    bool isBgzf() const { return mBgzf; }
+    static quint64 bgzfVirtualOffset(qint64 blockPos, uint offsetInBlock)
+        { return (quint64(blockPos) << 16) | (offsetInBlock & 0xffff); }
+    bool extractBgzf(quint64 virtualOffset, quint64 length, WriteStream *target);
+
 private:
     bool doOpen();
+    bool createCodec();
+    void setDecodeError(const QString& error);
+    static uint bgzfBlockSize(const QByteArray& extra);
+    uint bgzfBlockSizeAt(qint64 pos);
+    bool findBgzfBlocks();
 
     enum { ID1 = 0x1f, ID2 = 0x8b };
     enum { GzipMethodDeflate = 8 };
@@ -56,7 +100,15 @@ private:
 
     SeekableReadStream *mStream;
     Codec *mCodec;
+    GzipMemberDecoder *mMemberDecoder;
+    int mThreadCount;
     bool mInterrupted;
+    quint32 mTrailerCrc;
+
+    QMap<uint, DeflateCheckpointList> mIndex;
+
+    bool mBgzf;
+    QList<qint64> mBgzfBlocks;
 };
 
 }
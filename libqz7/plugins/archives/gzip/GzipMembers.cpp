@@ -0,0 +1,487 @@
+#include "GzipMembers_p.h"
+#include "GzipArchive.h"
+
+#include "qz7/ByteIO.h"
+#include "qz7/Codec.h"
+#include "qz7/Crc.h"
+#include "qz7/Plugin.h"
+#include "qz7/PrefetchReadStream.h"
+#include "qz7/Stream.h"
+
+#include <QtCore/QBuffer>
+#include <QtCore/QtEndian>
+#include <QtCore/QVariant>
+
+#include <string.h>
+
+namespace qz7 {
+namespace gzip {
+
+// a header, the smallest deflate stream and the trailer
+static const qint64 MinMemberSize = 10 + 2 + 8;
+static const int ScanBlockSize = 1 << 20;
+
+// only a device read through QIODevice (such as a file that couldn't be
+// mapped) gains from being read ahead in a thread of its own; a mapping or
+// a buffer is already in memory, and io_uring reads ahead by itself
+static bool worthPrefetching(SeekableReadStream *stream)
+{
+    QioSeekableReadStream *qio = dynamic_cast<QioSeekableReadStream *>(stream);
+    return qio && !qobject_cast<QBuffer *>(qio->device()) && qgetenv("QZ7_NO_PREFETCH") != "true";
+}
+
+/*
+ * MemberWorkerThread decodes whole members in memory
+ */
+
+MemberWorkerThread::MemberWorkerThread(MemberJobQueue *jobQueue, QObject *parent)
+    : QThread(parent)
+    , mQueue(jobQueue)
+    , mCodec(0)
+{
+}
+
+// the codec is acquired and released here, in the thread that uses it (the
+// pools are per thread, and the codec creates its decoders as its children)
+void MemberWorkerThread::run()
+{
+    mCodec = Registry::acquireDecoder("deflate");
+    // the workers already keep all the threads busy
+    if (mCodec) {
+        mCodec->setProperty("threadCount", 1);
+        mCodec->setProperty("checksum", QString("crc32"));
+    }
+
+    while (MemberJob *job = mQueue->dequeue()) {
+        decodeMember(job);
+        mQueue->finished(job);
+    }
+
+    Registry::releaseDecoder(mCodec);
+    mCodec = 0;
+}
+
+void MemberWorkerThread::decodeMember(MemberJob *job)
+{
+    if (!mCodec)
+        return;
+
+    try {
+        QBuffer input(&job->input);
+        input.open(QIODevice::ReadOnly);
+        QioReadStream in(&input);
+        ByteIoReader reader(&in);
+
+        ArchiveItem item(true);
+        if (!GzipArchive::readHeader(reader, &item))
+            return;
+        const qint64 dataPos = in.bytesRead();
+
+        QBuffer output(&job->output);
+        output.open(QIODevice::WriteOnly);
+        QioWriteStream out(&output);
+
+        // a member that inflates too much is left to be streamed
+        mCodec->setProperty("bytesExpected", quint64(GzipMemberDecoder::MaxJobOutput) + 1);
+        if (!mCodec->stream(&in, &out) || job->output.size() > GzipMemberDecoder::MaxJobOutput) {
+            job->output.clear();
+            return;
+        }
+
+        // if the trailer isn't there, the input ended at a false alarm
+        const qint64 trailer = dataPos + mCodec->property("bytesConsumed").toLongLong();
+        if (trailer + 8 > job->input.size()) {
+            job->output.clear();
+            return;
+        }
+        const uchar *t = reinterpret_cast<const uchar *>(job->input.constData()) + trailer;
+        job->crc = mCodec->property("checksumValue").toUInt();
+        if (qFromLittleEndian<quint32>(t) != job->crc ||
+            qFromLittleEndian<quint32>(t + 4) != quint32(job->output.size())) {
+            job->output.clear();
+            return;
+        }
+
+        job->next = job->pos + trailer + 8;
+        job->valid = true;
+    } catch (Error) {
+        job->output.clear();
+    }
+}
+
+/*
+ * GzipMemberDecoder
+ */
+
+GzipMemberDecoder::GzipMemberDecoder(SeekableReadStream *stream, Codec *codec, QObject *parent)
+    : QObject(parent)
+    , mStream(stream)
+    , mCodec(codec)
+    , mPrefetch(worthPrefetching(stream))
+    , mScannedPos(0)
+    , mIndex(0)
+    , mIndexBase(0)
+    , mIndexInterval(0)
+    , mBytesOut(0)
+    , mMembers(0)
+    , mCrc(0)
+    , mThreadCount(1)
+    , mInterrupted(0)
+{
+}
+
+GzipMemberDecoder::~GzipMemberDecoder()
+{
+    mQueue.stop();
+    for (int i = 0; i < mWorkers.count(); ++i)
+        mWorkers.at(i)->wait();
+}
+
+void GzipMemberDecoder::setIndex(DeflateCheckpointList *index, qint64 base, quint64 interval)
+{
+    mIndex = index;
+    mIndexBase = base;
+    mIndexInterval = interval;
+}
+
+bool GzipMemberDecoder::isMemberStart(qint64 pos)
+{
+    if (pos + MinMemberSize > mStream->size())
+        return false;
+
+    quint8 magic[2];
+    if (!mStream->setPos(pos) || !mStream->read(magic, 2))
+        throw ReadError(mStream);
+    return magic[0] == 0x1f && magic[1] == 0x8b;
+}
+
+bool GzipMemberDecoder::decodeMember(qint64 pos, WriteStream *target, quint64 limit, qint64 *next, bool readAhead)
+{
+    if (!mStream->setPos(pos))
+        throw ReadError(mStream);
+
+    ByteIoReader in(mStream);
+    ArchiveItem item(true);
+    if (!GzipArchive::readHeader(in, &item))
+        throw CorruptedError();
+    const qint64 dataPos = mStream->pos();
+
+    if (mIndex) {
+        // a member's start needs no window to resume from
+        if (mIndex->isEmpty() ? mBytesOut >= mIndexInterval :
+                mBytesOut - mIndex->last().uncompressedOffset >= mIndexInterval) {
+            DeflateCheckpoint checkpoint;
+            checkpoint.uncompressedOffset = mBytesOut;
+            checkpoint.compressedBitOffset = quint64(dataPos - mIndexBase) * 8;
+            mIndex->append(checkpoint);
+        }
+        mCodec->setProperty("checkpointInterval", mIndexInterval);
+    }
+
+    LimitedReadStream ls(mStream, mStream->size() - dataPos);
+    const qint64 start = target->bytesWritten();
+
+    // the codec checks the CRC as it goes; a member too large for the
+    // workers (or the only one) may still be decoded on several threads
+    mCodec->setProperty("threadCount", mThreadCount);
+    mCodec->setProperty("checksum", QString("crc32"));
+    mCodec->setProperty("bytesExpected", limit);
+
+    // the prefetcher may read past the member, but it's done with the
+    // stream by the time the trailer is looked for
+    PrefetchReadStream *prefetch = (readAhead && mPrefetch) ? new PrefetchReadStream(&ls) : 0;
+    const bool ok = mCodec->stream(prefetch ? static_cast<ReadStream *>(prefetch) : &ls, target);
+    delete prefetch;
+    mCodec->setProperty("bytesExpected", quint64(0));
+
+    if (mIndex) {
+        mCodec->setProperty("checkpointInterval", quint64(0));
+        DeflateCheckpointList checkpoints = mCodec->property("checkpoints").value<DeflateCheckpointList>();
+        for (int i = 0; i < checkpoints.count(); ++i) {
+            checkpoints[i].uncompressedOffset += mBytesOut;
+            checkpoints[i].compressedBitOffset += quint64(dataPos - mIndexBase) * 8;
+            mIndex->append(checkpoints.at(i));
+        }
+    }
+
+    if (!ok) {
+        mErrorString = mCodec->errorString();
+        return false;
+    }
+
+    const quint64 written = target->bytesWritten() - start;
+    mBytesOut += written;
+    if (limit != 0 && written >= limit) {
+        *next = -1;
+        return true;
+    }
+
+    const qint64 trailer = dataPos + mCodec->property("bytesConsumed").toLongLong();
+    if (!mStream->setPos(trailer))
+        throw ReadError(mStream);
+    const quint32 crc = in.read32LE();
+    const quint32 size = in.read32LE();
+    const quint32 value = mCodec->property("checksumValue").toUInt();
+    if (crc != value) {
+        mErrorString = CrcError().message() + " (expected " + QString::number(crc, 16) + ", got " + QString::number(value, 16) + ')';
+        return false;
+    }
+    if (size != quint32(written))
+        throw CorruptedError();
+
+    mCrc = CrcCombine(mCrc, value, written);
+    ++mMembers;
+    *next = trailer + 8;
+    return true;
+}
+
+bool GzipMemberDecoder::decode(qint64 pos, WriteStream *target, quint64 limit)
+{
+    mInterrupted = 0;
+    mErrorString = QString();
+    mBytesOut = 0;
+    mMembers = 0;
+    mCrc = 0;
+
+    // whatever follows the last member (such as padding) is ignored, as
+    // gzip does
+    while (isMemberStart(pos)) {
+        if (mInterrupted)
+            return false;
+
+        // the workers are only worth starting once there turns out to be
+        // more than one member; until then, the input is read ahead
+        const bool parallel = (mThreadCount > 1 && !mIndex && limit == 0);
+        if (parallel && mMembers > 0)
+            return decodeParallel(pos, target);
+
+        qint64 next;
+        if (!decodeMember(pos, target, limit ? limit - mBytesOut : 0, &next, parallel))
+            return false;
+        if (next < 0)
+            break;
+        pos = next;
+    }
+    return true;
+}
+
+void GzipMemberDecoder::scan(qint64 pos)
+{
+    if (mScannedPos <= pos) {
+        mScanned.clear();
+        mScannedPos = pos;
+    }
+
+    const int old = mScanned.size();
+    const int bytes = int(qMin<qint64>(ScanBlockSize, mStream->size() - mScannedPos));
+    mScanned.resize(old + bytes);
+    if (!mStream->setPos(mScannedPos) || !mStream->read(reinterpret_cast<quint8 *>(mScanned.data()) + old, bytes))
+        throw ReadError(mStream);
+    const qint64 base = mScannedPos - old;
+    mScannedPos += bytes;
+
+    // ID1, ID2, deflate and no reserved flags; the three bytes not looked at
+    // last time (they didn't fit) are looked at now
+    const uchar *data = reinterpret_cast<const uchar *>(mScanned.constData());
+    const int end = mScanned.size() - 3;
+    for (int i = qMax(old - 3, 0); i < end; ++i) {
+        const void *p = ::memchr(data + i, 0x1f, end - i);
+        if (!p)
+            break;
+        i = static_cast<const uchar *>(p) - data;
+        if (data[i + 1] == 0x8b && data[i + 2] == 8 && (data[i + 3] & 0xe0) == 0)
+            mCandidates.append(base + i);
+    }
+}
+
+void GzipMemberDecoder::scheduleJobs(qint64 pos)
+{
+    // whatever lies before pos turned out to be inside a member
+    while (!mJobs.isEmpty() && mJobs.begin().key() < pos) {
+        MemberJob *job = mJobs.begin().value();
+        mJobs.erase(mJobs.begin());
+        mQueue.discard(job);
+        delete job;
+    }
+    while (!mCandidates.isEmpty() && mCandidates.first() < pos)
+        mCandidates.removeFirst();
+
+    const qint64 size = mStream->size();
+    const qint64 scanAhead = qint64(2 * mThreadCount) * MaxJobInput;
+    while (mJobs.count() < 2 * mThreadCount && mScannedPos < size && mScannedPos - pos < scanAhead) {
+        scan(pos);
+
+        // a candidate becomes a job once we know where the next one is;
+        // one too far from the next is left to be decoded directly
+        const qint64 base = mScannedPos - mScanned.size();
+        while (!mCandidates.isEmpty()) {
+            const qint64 start = mCandidates.first();
+            qint64 end;
+            if (mCandidates.count() > 1)
+                end = mCandidates.at(1);
+            else if (mScannedPos == size || mScannedPos - start > MaxJobInput)
+                end = mScannedPos;
+            else
+                break;
+
+            mCandidates.removeFirst();
+            if (end - start > MaxJobInput)
+                continue;
+
+            MemberJob *job = new MemberJob;
+            job->pos = start;
+            job->input = mScanned.mid(int(start - base), int(end - start));
+            mJobs.insert(start, job);
+            mQueue.enqueue(job);
+        }
+
+        // keep what is still to be handed out, and enough to find a header
+        // that straddles the next read
+        const qint64 keep = mCandidates.isEmpty() ? qMax(base, mScannedPos - 3) : mCandidates.first();
+        mScanned = mScanned.mid(int(keep - base));
+    }
+}
+
+void GzipMemberDecoder::cleanup()
+{
+    for (QMap<qint64, MemberJob *>::const_iterator it = mJobs.constBegin(); it != mJobs.constEnd(); ++it) {
+        mQueue.discard(it.value());
+        delete it.value();
+    }
+    mJobs.clear();
+    mCandidates.clear();
+    mScanned.clear();
+    mScannedPos = 0;
+}
+
+void GzipMemberDecoder::startWorkers()
+{
+    while (mWorkers.count() < mThreadCount) {
+        MemberWorkerThread *worker = new MemberWorkerThread(&mQueue, this);
+        worker->start();
+        mWorkers.append(worker);
+    }
+}
+
+// writes what the worker decoded (as far as limit goes) and disposes of the
+// job, telling where the next member starts; false if the worker couldn't
+// decode the member
+bool GzipMemberDecoder::writeJob(MemberJob *job, WriteStream *target, quint64 limit, qint64 *next)
+{
+    mQueue.waitFor(job);
+    const bool valid = job->valid;
+    const QByteArray output = job->output;
+    const quint32 crc = job->crc;
+    *next = job->next;
+    delete job;
+    if (!valid)
+        return false;
+
+    mCrc = CrcCombine(mCrc, crc, output.size());
+    ++mMembers;
+
+    int bytes = output.size();
+    if (limit != 0 && mBytesOut + bytes > limit)
+        bytes = int(limit - mBytesOut);
+    if (!target->write(reinterpret_cast<const quint8 *>(output.constData()), bytes))
+        throw WriteError(target);
+    mBytesOut += bytes;
+    return true;
+}
+
+bool GzipMemberDecoder::decodeParallel(qint64 pos, WriteStream *target)
+{
+    startWorkers();
+
+    try {
+        while (isMemberStart(pos)) {
+            if (mInterrupted) {
+                cleanup();
+                return false;
+            }
+
+            scheduleJobs(pos);
+
+            // a worker's result is only good if it could decode the whole
+            // member; otherwise the member is decoded here
+            qint64 next = -1;
+            MemberJob *job = mJobs.take(pos);
+            if (job && !writeJob(job, target, 0, &next))
+                next = -1;
+            if (next < 0 && !decodeMember(pos, target, 0, &next, !job)) {
+                cleanup();
+                return false;
+            }
+            pos = next;
+        }
+    } catch (Error) {
+        cleanup();
+        throw;
+    }
+
+    cleanup();
+    return true;
+}
+
+bool GzipMemberDecoder::decodeBlocks(const QList<qint64>& blocks, int first, WriteStream *target, quint64 limit)
+{
+    if (first >= blocks.count())
+        return true;
+    if (mThreadCount <= 1 || mIndex)
+        return decode(blocks.at(first), target, limit);
+
+    mInterrupted = 0;
+    mErrorString = QString();
+    mBytesOut = 0;
+    mMembers = 0;
+    mCrc = 0;
+    startWorkers();
+
+    const qint64 size = mStream->size();
+    int scheduled = first;
+    try {
+        for (int i = first; i < blocks.count(); ++i) {
+            if (mInterrupted) {
+                cleanup();
+                return false;
+            }
+
+            for (; scheduled < blocks.count() && scheduled - i < 2 * mThreadCount; ++scheduled) {
+                const qint64 start = blocks.at(scheduled);
+                const qint64 end = (scheduled + 1 < blocks.count()) ? blocks.at(scheduled + 1) : size;
+
+                MemberJob *job = new MemberJob;
+                job->pos = start;
+                job->input.resize(int(end - start));
+                mJobs.insert(start, job);
+                if (!mStream->setPos(start) || !mStream->read(reinterpret_cast<quint8 *>(job->input.data()), job->input.size()))
+                    throw ReadError(mStream);
+                mQueue.enqueue(job);
+            }
+
+            // a block the worker failed on is decoded here to find out why
+            qint64 next;
+            if (!writeJob(mJobs.take(blocks.at(i)), target, limit, &next) &&
+                !decodeMember(blocks.at(i), target, limit ? limit - mBytesOut : 0, &next)) {
+                cleanup();
+                return false;
+            }
+            if (limit != 0 && mBytesOut >= limit)
+                break;
+        }
+    } catch (Error) {
+        cleanup();
+        throw;
+    }
+
+    cleanup();
+    return true;
+}
+
+void GzipMemberDecoder::interrupt()
+{
+    mInterrupted = 1;
+}
+
+}
+}
@@ -0,0 +1,132 @@
+#ifndef QZ7_GZIP_MEMBERS_P_H
+#define QZ7_GZIP_MEMBERS_P_H
+
+#include "qz7/JobQueue.h"
+#include "qz7/codec/DeflateCheckpoint.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QList>
+#include <QtCore/QMap>
+#include <QtCore/QObject>
+#include <QtCore/QThread>
+
+namespace qz7 {
+
+class Codec;
+class SeekableReadStream;
+class WriteStream;
+
+namespace gzip {
+
+// A place in the file that looks like the start of a member, for a worker
+// to decode in memory. Its input runs up to the next such place (or the end
+// of the file), which is where the member ends unless the next one was a
+// false alarm inside its compressed data.
+class MemberJob {
+public:
+    MemberJob() : pos(0), done(false), valid(false), crc(0), next(0) { }
+
+    qint64 pos;
+    QByteArray input;
+    bool done;
+
+    bool valid;             // decoded, with the CRC and size in its trailer
+    QByteArray output;
+    quint32 crc;
+    qint64 next;            // where the member after it starts
+};
+
+typedef JobQueue<MemberJob> MemberJobQueue;
+
+class MemberWorkerThread : public QThread {
+    Q_OBJECT
+
+public:
+    MemberWorkerThread(MemberJobQueue *jobQueue, QObject *parent);
+    virtual void run();
+
+private:
+    void decodeMember(MemberJob *job);
+
+    MemberJobQueue *mQueue;
+    Codec *mCodec;          // while run() is running
+};
+
+// GzipMemberDecoder decodes the members of a gzip file one after the other,
+// checking each one's CRC and size against its trailer, as if they were a
+// single stream. The first member is decoded here, with the codec's own
+// threads; with more than one thread and more members after it, those of up
+// to MaxJobInput bytes are found by looking for their headers and decoded by
+// workers ahead of time, larger ones again here.
+// Where the members' positions are already known, decodeBlocks() skips
+// looking for them.
+class GzipMemberDecoder : public QObject {
+    Q_OBJECT
+
+public:
+    GzipMemberDecoder(SeekableReadStream *stream, Codec *codec, QObject *parent);
+    ~GzipMemberDecoder();
+
+    void setThreadCount(int threadCount) { mThreadCount = threadCount; }
+
+    // take checkpoints every interval bytes of output while decoding, with
+    // their offsets relative to the data of the member at base
+    void setIndex(DeflateCheckpointList *index, qint64 base, quint64 interval);
+
+    // decodes the members from the header at pos on, stopping early once
+    // limit bytes (if not 0) have been written; throws Error on corrupted
+    // data, returns false if the codec failed or was interrupted
+    bool decode(qint64 pos, WriteStream *target, quint64 limit = 0);
+    // the same for members whose positions are known (as in BGZF), from
+    // blocks[first] on; each of them can go to a worker
+    bool decodeBlocks(const QList<qint64>& blocks, int first, WriteStream *target, quint64 limit = 0);
+    QString errorString() const { return mErrorString; }
+    void interrupt();
+
+    // how many members the last decode went through in full, and the size
+    // and CRC of their output as a whole
+    int memberCount() const { return mMembers; }
+    quint64 bytesDecoded() const { return mBytesOut; }
+    quint32 crc() const { return mCrc; }
+
+    enum { MaxJobInput = 4 << 20, MaxJobOutput = 64 << 20 };
+
+private:
+    bool isMemberStart(qint64 pos);
+    bool decodeMember(qint64 pos, WriteStream *target, quint64 limit, qint64 *next, bool readAhead = false);
+    bool decodeParallel(qint64 pos, WriteStream *target);
+    void startWorkers();
+    bool writeJob(MemberJob *job, WriteStream *target, quint64 limit, qint64 *next);
+    void scan(qint64 pos);
+    void scheduleJobs(qint64 pos);
+    void cleanup();
+
+    QList<MemberWorkerThread *> mWorkers;
+    MemberJobQueue mQueue;
+
+    SeekableReadStream *mStream;
+    Codec *mCodec;
+    bool mPrefetch;
+
+    // the part of the file scanned for member headers but not handed out yet
+    QByteArray mScanned;
+    qint64 mScannedPos;
+    QList<qint64> mCandidates;
+    QMap<qint64, MemberJob *> mJobs;
+
+    DeflateCheckpointList *mIndex;
+    qint64 mIndexBase;
+    quint64 mIndexInterval;
+    quint64 mBytesOut;
+    int mMembers;
+    quint32 mCrc;
+
+    int mThreadCount;
+    QString mErrorString;
+    int mInterrupted;
+};
+
+}
+}
+
+#endif
@@ -5,8 +5,19 @@ namespace qz7 {
 namespace deflate {
 
 enum { NumHuffmanBits = 15 };
+enum { NumLevelBits = 7 };
+
+// the number of bits resolved by the first-level decode tables; longer
+// codes take a second lookup
+enum {
+    MainDecodeTableBits = 9,
+    DistDecodeTableBits = 8,
+    LevelDecodeTableBits = NumLevelBits
+};
 
 enum { HistorySize32 = (1 << 15), HistorySize64 = (1 << 16) };
+// decoded data is collected in chunks of this size before being written out
+enum { OutputBufferSize = (1 << 22) };
 enum { DistTableSize32 = 30, DistTableSize64 = 32 };
 
 enum {
@@ -62,7 +73,7 @@ const quint16 LenStart64[FixedLenTableSize] = {
     3+0, 3+1, 3+2, 3+3, 3+4, 3+5, 3+6, 3+7, 3+8,
     3+10, 3+12, 3+14, 3+16, 3+20, 3+24, 3+28, 3+32,
     3+40, 3+48, 3+56, 3+64, 3+80, 3+96, 3+112, 3+128,
-    3+160, 3+192, 3+224, 0, 0, 0
+    3+160, 3+192, 3+224, 3+0, 0, 0
 };
 
 const quint8 LenDirectBits32[FixedLenTableSize] = {
@@ -1,6 +1,7 @@
 #include "DeflateDecoder.h"
 #include "DeflateDecoderST_p.h"
 #include "DeflateDecoderMT_p.h"
+#include "DeflateDecoderPar_p.h"
 
 #include <QtCore/QByteArray>
 #include <QtCore/QDataStream>
@@ -11,22 +12,89 @@ namespace qz7 {
 namespace deflate {
 
 BaseDeflateDecoder::BaseDeflateDecoder(DeflateType type, QObject *parent)
-    : mBytesExpected(0)
-    , mType(type)
-    , mKeepHistory(false)
-    , mMultiThreaded(QThread::idealThreadCount() > 1)
+    : mType(type)
     , mDecoderST(0)
     , mDecoderMT(0)
+    , mDecoderPar(0)
 {
+    reset();
+}
+
+// not left to QObject: they may have been created without us as their
+// parent, by a stream() in a thread other than ours
+BaseDeflateDecoder::~BaseDeflateDecoder()
+{
+    delete mDecoderPar;
+    delete mDecoderMT;
+    delete mDecoderST;
+}
+
+// the decoders set up so far stay, with their buffers
+bool BaseDeflateDecoder::reset()
+{
+    mBytesExpected = 0;
+    mKeepHistory = false;
+    mMultiThreaded = QThread::idealThreadCount() > 1;
     if (qgetenv("QZ7_NO_MULTITHREADED") == "true")
         mMultiThreaded = false;
+    mThreadCount = mMultiThreaded ? 2 : 1;
+    mQueueBlockCount = DecodeInstQueue::DefaultBlockCount;
+    mQueueBlockSize = DecodeInstQueue::DefaultBlockSize;
+    mCheckpointInterval = 0;
+    mResumePoint = DeflateCheckpoint();
+    mResume = false;
+    mBytesConsumed = 0;
+    mChecksum = NoChecksum;
+    mErrorString = QString();
+    return true;
+}
+
+Analyzer *BaseDeflateDecoder::startChecksum()
+{
+    switch (mChecksum) {
+    case ChecksumCrc32:
+        mCrc32 = Crc32Analyzer();
+        return &mCrc32;
+    case ChecksumAdler32:
+        mAdler32 = Adler32Analyzer();
+        return &mAdler32;
+    default:
+        return 0;
+    }
 }
 
 bool BaseDeflateDecoder::stream(ReadStream *from, WriteStream *to)
 {
     mErrorString = QString();
+    mBytesConsumed = 0;
+    Analyzer *checksum = startChecksum();
+
+    // checkpoints are taken and resumed from by the single-threaded decoder
+    const bool checkpointing = (mCheckpointInterval != 0 || mResume);
+
+    // more than two threads: decode chunks of the stream in parallel; this
+    // needs a stream starting afresh with 32 KB windows
+    if (mThreadCount > 2 && mType == BasicDeflate && !mKeepHistory && !checkpointing) {
+        if (!mDecoderPar) {
+            mDecoderPar = new DeflateDecoderPar(this);
+            connect(mDecoderPar, SIGNAL(progress(quint64, quint64)),
+                this, SIGNAL(progress(quint64, quint64)));
+        }
+        mDecoderPar->setThreadCount(mThreadCount);
+        mDecoderPar->setBytesExpected(mBytesExpected);
+        mDecoderPar->setAnalyzer(checksum);
 
-    if (mMultiThreaded) {
+        try {
+            const bool ok = mDecoderPar->stream(from, to);
+            mBytesConsumed = (mDecoderPar->bitsConsumed() + 7) / 8;
+            return ok;
+        } catch (Error e) {
+            mErrorString = e.message();
+            return false;
+        }
+    }
+
+    if (mMultiThreaded && !checkpointing) {
         if (!mDecoderMT) {
             mDecoderMT = new DeflateDecoderMT(mType, this);
             connect(mDecoderMT, SIGNAL(progress(quint64, quint64)),
@@ -34,9 +102,13 @@ bool BaseDeflateDecoder::stream(ReadStream *from, WriteStream *to)
         }
         mDecoderMT->setKeepHistory(mKeepHistory);
         mDecoderMT->setBytesExpected(mBytesExpected);
+        mDecoderMT->setQueueSize(mQueueBlockCount, mQueueBlockSize);
+        mDecoderMT->setAnalyzer(checksum);
 
         try {
-            return mDecoderMT->stream(from, to);
+            const bool ok = mDecoderMT->stream(from, to);
+            mBytesConsumed = (mDecoderMT->bitsConsumed() + 7) / 8;
+            return ok;
         } catch (Error e) {
             mErrorString = e.message();
             return false;
@@ -50,13 +122,22 @@ bool BaseDeflateDecoder::stream(ReadStream *from, WriteStream *to)
     }
     mDecoderST->setKeepHistory(mKeepHistory);
     mDecoderST->setBytesExpected(mBytesExpected);
+    mDecoderST->setAnalyzer(checksum);
+    mDecoderST->setCheckpointInterval(mCheckpointInterval);
+    if (mResume)
+        mDecoderST->setResumePoint(mResumePoint);
 
+    bool ok;
     try {
-        return mDecoderST->stream(from, to);
+        ok = mDecoderST->stream(from, to);
+        mBytesConsumed = (mDecoderST->bitsConsumed() + 7) / 8;
     } catch (Error e) {
         mErrorString = e.message();
-        return false;
+        ok = false;
     }
+    mResumePoint = DeflateCheckpoint();
+    mResume = false;
+    return ok;
 }
 
 QString BaseDeflateDecoder::errorString() const
@@ -66,7 +147,12 @@ QString BaseDeflateDecoder::errorString() const
 
 void BaseDeflateDecoder::interrupt()
 {
-    if (mMultiThreaded && mDecoderMT)
+    if (mCheckpointInterval != 0 || mResume) {
+        if (mDecoderST)
+            mDecoderST->interrupt();
+    } else if (mThreadCount > 2 && mDecoderPar)
+        mDecoderPar->interrupt();
+    else if (mMultiThreaded && mDecoderMT)
         mDecoderMT->interrupt();
     else if (mDecoderST)
         mDecoderST->interrupt();
@@ -76,6 +162,7 @@ bool BaseDeflateDecoder::setProperty(const QString& property, const QVariant& va
 {
     if (property == "multithreaded") {
         mMultiThreaded = value.toBool();
+        mThreadCount = mMultiThreaded ? qMax(mThreadCount, 2) : 1;
         return true;
     } else if (property == "keepHistory") {
         mKeepHistory = value.toBool();
@@ -84,10 +171,37 @@ bool BaseDeflateDecoder::setProperty(const QString& property, const QVariant& va
         mBytesExpected = value.toULongLong();
         return true;
     } else if (property == "threadCount") {
-        if (value.toInt() > 1)
-            mMultiThreaded = true;
+        // 2 threads split decoding and writing, more decode in parallel
+        mThreadCount = qMax(value.toInt(), 1);
+        mMultiThreaded = (mThreadCount > 1);
+        return true;
+    } else if (property == "queueBlockCount") {
+        // blocks of instructions the decoding thread may be ahead of the
+        // writing one by
+        mQueueBlockCount = qMax(value.toInt(), 2);
+        return true;
+    } else if (property == "queueBlockSize") {
+        mQueueBlockSize = qMax(value.toInt(), 16);
+        return true;
+    } else if (property == "checkpointInterval") {
+        mCheckpointInterval = value.toULongLong();
+        return true;
+    } else if (property == "resumeFrom") {
+        // applies to the next stream() only
+        mResumePoint = value.value<DeflateCheckpoint>();
+        mResume = true;
+        return true;
+    } else if (property == "checksum") {
+        // "crc32", "adler32" or nothing
+        const QString checksum = value.toString();
+        if (checksum == "crc32")
+            mChecksum = ChecksumCrc32;
+        else if (checksum == "adler32")
+            mChecksum = ChecksumAdler32;
+        else if (checksum.isEmpty())
+            mChecksum = NoChecksum;
         else
-            mMultiThreaded = false;
+            return false;
         return true;
     }
     return false;
@@ -101,12 +215,28 @@ QVariant BaseDeflateDecoder::property(const QString& property) const
         return QVariant(mKeepHistory);
     if (property == "bytesExpected")
         return QVariant(mBytesExpected);
-    if (property == "threadCount") {
-        if (mMultiThreaded)
-            return QVariant(2U);
-        else
-            return QVariant(1U);
+    if (property == "threadCount")
+        return QVariant(uint(mThreadCount));
+    if (property == "queueBlockCount")
+        return QVariant(mQueueBlockCount);
+    if (property == "queueBlockSize")
+        return QVariant(mQueueBlockSize);
+    if (property == "checkpointInterval")
+        return QVariant(mCheckpointInterval);
+    if (property == "bytesConsumed")
+        return QVariant(mBytesConsumed);
+    if (property == "checksum")
+        return QVariant(mChecksum == ChecksumCrc32 ? QString("crc32") :
+                        mChecksum == ChecksumAdler32 ? QString("adler32") : QString());
+    if (property == "checksumValue") {
+        if (mChecksum == ChecksumCrc32)
+            return QVariant(mCrc32.value());
+        if (mChecksum == ChecksumAdler32)
+            return QVariant(mAdler32.value());
+        return QVariant();
     }
+    if (property == "checkpoints")
+        return QVariant::fromValue(mDecoderST ? mDecoderST->checkpoints() : DeflateCheckpointList());
     return QVariant();
 }
 
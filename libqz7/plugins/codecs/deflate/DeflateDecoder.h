@@ -1,13 +1,17 @@
 #ifndef QZ7_DEFLATEDECODER_H
 #define QZ7_DEFLATEDECODER_H
 
+#include "qz7/AdlerAnalyzer.h"
 #include "qz7/Codec.h"
+#include "qz7/CrcAnalyzer.h"
+#include "qz7/codec/DeflateCheckpoint.h"
 
 namespace qz7 {
 namespace deflate {
 
 class DeflateDecoderST;
 class DeflateDecoderMT;
+class DeflateDecoderPar;
 
 enum DeflateType {
     BasicDeflate,
@@ -20,6 +24,7 @@ class BaseDeflateDecoder : public Codec {
 
 public:
     BaseDeflateDecoder(DeflateType type, QObject *parent);
+    virtual ~BaseDeflateDecoder();
 
     virtual bool stream(ReadStream *from, WriteStream *to);
     virtual QString errorString() const;
@@ -28,16 +33,34 @@ public:
     virtual QVariant property(const QString& property) const;
     virtual QByteArray serializeProperties() const;
     virtual bool applySerializedProperties(const QByteArray& serializedProperties);
+    virtual bool reset();
 
 private:
+    enum Checksum { NoChecksum, ChecksumCrc32, ChecksumAdler32 };
+
+    Analyzer *startChecksum();
+
     quint64 mBytesExpected;
     DeflateType mType;
     bool mKeepHistory;
     bool mMultiThreaded;
+    int mThreadCount;
+    int mQueueBlockCount;       // of the two-thread decoder's instruction queue
+    int mQueueBlockSize;
+    quint64 mCheckpointInterval;
+    DeflateCheckpoint mResumePoint;
+    bool mResume;
+    quint64 mBytesConsumed;     // of the input, by the last stream()
+
+    // of the output of the last stream(), taken as it leaves the window
+    Checksum mChecksum;
+    Crc32Analyzer mCrc32;
+    Adler32Analyzer mAdler32;
 
     QString mErrorString;
     DeflateDecoderST *mDecoderST;
     DeflateDecoderMT *mDecoderMT;
+    DeflateDecoderPar *mDecoderPar;
 };
 
 class DeflateDecoder : public BaseDeflateDecoder
@@ -13,133 +13,164 @@ namespace deflate {
  * DecodeInstQueue ties the decoder thread to the writer thread
  */
 
-DecodeInstQueue::DecodeInstQueue()
+DecodeInstQueue::DecodeInstQueue(int blockCount, int blockSize)
+    : mBlockCount(qMax(blockCount, 2))
+    , mBlockSize(qMax(blockSize, 16))
+    , mSpinCount(QThread::idealThreadCount() > 1 ? SpinCount : 0)
 {
-    for (int i = 0; i < NR_BLOCKS; i++) {
-        mBlocks[i] = new DecodeInst[QueueBlockSize];
+    mInsts = new DecodeInst[mBlockCount * mBlockSize];
+    mLiterals = new quint8[mBlockCount * literalSize()];
+    mSlots = new Slot[mBlockCount];
+    for (int i = 0; i < mBlockCount; i++) {
+        mSlots[i].block.insts = mInsts + i * mBlockSize;
+        mSlots[i].block.literals = mLiterals + i * literalSize();
     }
     reset();
 }
 
 DecodeInstQueue::~DecodeInstQueue()
 {
-    for (int i = 0; i < NR_BLOCKS; i++) {
-        delete[] mBlocks[i];
-    }
+    delete[] mSlots;
+    delete[] mLiterals;
+    delete[] mInsts;
 }
 
+// only while neither thread uses the queue
 void DecodeInstQueue::reset()
 {
+    mEnqueued = 0;
+    mWrittenBlocks = 0;
+    mStopped = Running;
+    mSleepers = 0;
     mWritten = 0;
-    for (int i = 0; i < NR_BLOCKS; i++) {
-        mStatuses[i] = Free;
-        mLengths[i] = 0;
-        mBlocks[i]->clear();
+    mWrittenSeen = 0;
+    for (int i = 0; i < mBlockCount; i++) {
+        mSlots[i].avail = 0;
+        mSlots[i].written = 0;
+        mSlots[i].stop = false;
     }
-    mNextAlloc = 0;
-    mNextDequeue = 0;
 }
 
-DecodeInst *DecodeInstQueue::allocBlock(quint64 *written)
+// waits for the other side to bring counter up to target (the counters
+// only grow, so this holds across wrapping); false if the queue was stopped
+bool DecodeInstQueue::waitFor(QAtomicInt *counter, int target)
 {
-    QMutexLocker locker(&mLock);
+    for (int spin = 0; spin < mSpinCount; spin++) {
+        if (reached(*counter, target) || !running())
+            break;
+    }
+    if (!reached(*counter, target) && running()) {
+        QMutexLocker locker(&mLock);
+        mSleepers.ref();
+        while (!reached(*counter, target) && running())
+            mWaiter.wait(&mLock);
+        mSleepers.deref();
+    }
 
-    while (mStatuses[mNextAlloc] != Free)
-        mWaiter.wait(&mLock);
+    // what the other side did before it moved the counter is visible now
+    counter->fetchAndAddAcquire(0);
+    return running();
+}
 
-    *written = mWritten;
+void DecodeInstQueue::publish(QAtomicInt *counter)
+{
+    counter->fetchAndAddOrdered(1);
+    if (int(mSleepers)) {
+        QMutexLocker locker(&mLock);
+        mWaiter.wakeAll();
+    }
+}
 
-    // check if something went wrong on the write side
-    if (mBlocks[mNextAlloc]->isStop())
+void DecodeInstQueue::stop(StopReason reason)
+{
+    mStopped.testAndSetOrdered(Running, reason);
+    QMutexLocker locker(&mLock);
+    mWaiter.wakeAll();
+}
+
+DecodeBlock *DecodeInstQueue::allocBlock(quint64 *written)
+{
+    const int enqueued = mEnqueued;
+    if (!waitFor(&mWrittenBlocks, enqueued - mBlockCount + 1))
         return 0;
 
-    DecodeInst *ptr = mBlocks[mNextAlloc];
-    mStatuses[mNextAlloc] = Allocated;
-    mNextAlloc = (mNextAlloc + 1) % NR_BLOCKS;
-    return ptr;
+    // add up what the blocks given back since the last time wrote
+    const int writtenBlocks = mWrittenBlocks;
+    for (; mWrittenSeen != writtenBlocks; mWrittenSeen++)
+        mWritten += mSlots[uint(mWrittenSeen) % mBlockCount].written;
+    *written = mWritten;
+
+    Slot& slot = mSlots[uint(enqueued) % mBlockCount];
+    slot.stop = false;
+    return &slot.block;
 }
-        
-void DecodeInstQueue::enqueueBlock(DecodeInst *block, int avail)
-{
-    QMutexLocker locker(&mLock);
 
-    for (int i = mNextAlloc - 1; ; i = (i + 1) % NR_BLOCKS) {
-        if (mBlocks[i] == block) {
-            mLengths[i] = avail;
-            mStatuses[i] = Enqueued;
-            mWaiter.wakeAll();
-            return;
-        }
-    }
+void DecodeInstQueue::enqueueBlock(DecodeBlock *block, int avail)
+{
+    Slot& slot = mSlots[uint(int(mEnqueued)) % mBlockCount];
+    Q_ASSERT(&slot.block == block);
+    Q_UNUSED(block);
+    slot.avail = avail;
+    publish(&mEnqueued);
 }
 
+// tells the writer thread that there is nothing more, unless it has already
+// stopped
 void DecodeInstQueue::lastBlock()
 {
     quint64 dummy;
-    DecodeInst *block = allocBlock(&dummy);
-    block->setStop();
+    DecodeBlock *block = allocBlock(&dummy);
+    if (!block)
+        return;
+    mSlots[uint(int(mEnqueued)) % mBlockCount].stop = true;
     enqueueBlock(block, 0);
 }
 
-DecodeInst *DecodeInstQueue::dequeueBlock(int *avail)
+DecodeBlock *DecodeInstQueue::dequeueBlock(int *avail)
 {
-    QMutexLocker locker(&mLock);
-
-    while (mStatuses[mNextDequeue] != Enqueued)
-        mWaiter.wait(&mLock);
+    const int writtenBlocks = mWrittenBlocks;
+    if (!waitFor(&mEnqueued, writtenBlocks + 1))
+        return 0;
 
-    if (mBlocks[mNextDequeue]->isStop())
+    Slot& slot = mSlots[uint(writtenBlocks) % mBlockCount];
+    if (slot.stop) {
+        // given back, so that the queue is empty for the next stream
+        slot.written = 0;
+        publish(&mWrittenBlocks);
         return 0;
+    }
 
-    mStatuses[mNextDequeue] = Dequeued;
-    *avail = mLengths[mNextDequeue];
-    DecodeInst *block = mBlocks[mNextDequeue];
-    mNextDequeue = (mNextDequeue + 1) % NR_BLOCKS;
-    return block;
+    *avail = slot.avail;
+    return &slot.block;
 }
-    
-void DecodeInstQueue::wroteBlock(DecodeInst *block, uint written)
-{
-    QMutexLocker locker(&mLock);
 
-    mWritten += written;
-    for (int i = mNextDequeue - 1; ; i = (i + 1) % NR_BLOCKS) {
-        if (mBlocks[i] == block) {
-            block->clear();    // write completed OK
-            mStatuses[i] = Free;
-            mWaiter.wakeAll();
-            return;
-        }
-    }
+void DecodeInstQueue::wroteBlock(DecodeBlock *block, uint written)
+{
+    Slot& slot = mSlots[uint(int(mWrittenBlocks)) % mBlockCount];
+    Q_ASSERT(&slot.block == block);
+    Q_UNUSED(block);
+    slot.written = written;
+    publish(&mWrittenBlocks);
 }
 
-void DecodeInstQueue::writeError(DecodeInst *block)
+void DecodeInstQueue::writeError(DecodeBlock *block)
 {
-    QMutexLocker locker(&mLock);
+    Q_UNUSED(block);
 
-    // the next block we try to allocate will report the write error
-    mStatuses[mNextAlloc] = Free;
-    mBlocks[mNextAlloc]->setStop();
-    mWaiter.wakeAll();
+    // the next block the decoder tries to allocate will report the write error
+    stop(WriteFailed);
 }
 
-bool DecodeInstQueue::hasWriteError()
+bool DecodeInstQueue::hasWriteError() const
 {
-    QMutexLocker locker(&mLock);
-    return (mStatuses[mNextAlloc] == Free) && 
-        (mBlocks[mNextAlloc]->isStop());
+    return int(mStopped) == WriteFailed;
 }
 
+// the writer thread stops at the next block it would take, and the decoder
+// thread at the next one it would allocate
 void DecodeInstQueue::interrupt()
 {
-    QMutexLocker locker(&mLock);
-
-    while (mStatuses[mNextDequeue] == Allocated || mStatuses[mNextDequeue] == Dequeued)
-        mNextDequeue = (mNextDequeue + 1) % NR_BLOCKS;
-
-    mStatuses[mNextDequeue] = Enqueued;
-    mBlocks[mNextDequeue]->setStop();
-    mWaiter.wakeAll();
+    stop(Interrupted);
 }
 
 /*
@@ -159,23 +190,27 @@ void DecodeWriterThread::run()
     while (true) {
         int avail;
         int written = 0;
-        DecodeInst *block = mQueue->dequeueBlock(&avail);
+        DecodeBlock *block = mQueue->dequeueBlock(&avail);
 
         if (!block)
             return;
         try {
+            const DecodeInst *insts = block->insts;
+            const quint8 *literals = block->literals;
             for (int i = 0; i < avail; i++) {
-                if (block[i].isLiteral()) {
-                    int cnt = block[i].literalCount();
-                    if (cnt < 0  || cnt > 3)
-                        qWarning("bizarre literal count %d at %d of %d", cnt, i, avail);
-                    for (int j = 0; j < cnt; j++) {
-                        mBuffer->putByte(quint8(block[i].literal(j)));
+                if (insts[i].isLiteral()) {
+                    const int cnt = insts[i].literalCount();
+                    if (cnt < ShortLiteralRun && uint(cnt) < mBuffer->available()) {
+                        for (int j = 0; j < cnt; j++)
+                            mBuffer->putByteNoFlush(literals[j]);
+                    } else {
+                        mBuffer->putBytes(literals, cnt);
                     }
+                    literals += cnt;
                     written += cnt;
                 } else {
-                    mBuffer->repeatBytes(block[i].distance(), block[i].length());
-                    written += block[i].length();
+                    mBuffer->repeatBytes(insts[i].distance(), insts[i].length());
+                    written += insts[i].length();
                 }
             }
             mQueue->wroteBlock(block, written);
@@ -198,7 +233,10 @@ DeflateDecoderMT::DeflateDecoderMT(DeflateType type, QObject *parent)
     , mQueue(0)
     , mType(type)
     , mBytesExpected(0)
+    , mQueueBlockCount(DecodeInstQueue::DefaultBlockCount)
+    , mQueueBlockSize(DecodeInstQueue::DefaultBlockSize)
     , mKeepHistory(false)
+    , mFixedTables(false)
 {
 }
 
@@ -207,6 +245,13 @@ DeflateDecoderMT::~DeflateDecoderMT()
     delete mQueue;
 }
 
+// takes effect at the next stream()
+void DeflateDecoderMT::setQueueSize(int blockCount, int blockSize)
+{
+    mQueueBlockCount = blockCount;
+    mQueueBlockSize = blockSize;
+}
+
 inline quint32 DeflateDecoderMT::readBits(int numBits)
 {
     quint32 b = mBitStream.readBits(numBits);
@@ -259,7 +304,8 @@ void DeflateDecoderMT::decodeLevelTable(quint8 *values, int numSymbols)
     } while (i < numSymbols);
 }
 
-void DeflateDecoderMT::readTables(void)
+template <class Traits>
+void DeflateDecoderMT::readTables()
 {
     quint32 finalBlock = readBits(FinalBlockFieldSize);
     mIsFinalBlock = (finalBlock == FinalBlock);
@@ -273,7 +319,7 @@ void DeflateDecoderMT::readTables(void)
         mBitStream.alignToByte();
         mStoredBlockSize = readBits(StoredBlockLengthFieldSize);
 
-        if (mType == DeflateNSIS)
+        if (!Traits::StoredLengthCheck)
             return;
 
         quint32 invBlockSize;
@@ -286,105 +332,91 @@ void DeflateDecoderMT::readTables(void)
 
     mStoredMode = false;
 
-    Levels levels;
     if (blockType == BlockTypeFixedHuffman) {
-        levels.setFixedLevels();
-        mNumDistLevels = (mType == Deflate64) ? DistTableSize64 : DistTableSize32;
-    } else {
-        quint32 numLitLenLevels = readBits(NumLenCodesFieldSize) + NumLitLenCodesMin;
-        mNumDistLevels = readBits(NumDistCodesFieldSize) + NumDistCodesMin;
-        quint32 numLevelCodes = readBits(NumLevelCodesFieldSize) + NumLevelCodesMin;
-
-        if (mType != Deflate64)
-            if (mNumDistLevels > DistTableSize32)
-                corrupted();
-        else
-            if (mNumDistLevels > DistTableSize64)
-                corrupted();
-
-        quint8 levelLevels[LevelTableSize];
-        for (unsigned int i = 0; i < LevelTableSize; i++) {
-            int position = CodeLengthAlphabetOrder[i];
-            if (i < numLevelCodes) {
-                quint32 temp = readBits(LevelFieldSize);
-                levelLevels[position] = temp;
-            } else {
-                levelLevels[position] = 0;
-            }
+        mNumDistLevels = Traits::DistTableSize;
+        // the tables are left alone until the next dynamic block, so runs
+        // of fixed blocks (as sync flushes produce) only copy them in once
+        if (!mFixedTables) {
+            const FixedHuffmanTables& fixed = FixedHuffmanTables::instance();
+            mMainDecoder = fixed.mainDecoder;
+            mDistDecoder = fixed.distDecoder;
+            mFixedTables = true;
         }
+        return;
+    }
 
-        mLevelDecoder.setCodeLengths(levelLevels);
+    mFixedTables = false;
 
-        quint8 tmpLevels[FixedMainTableSize + FixedDistTableSize];
+    quint32 numLitLenLevels = readBits(NumLenCodesFieldSize) + NumLitLenCodesMin;
+    mNumDistLevels = readBits(NumDistCodesFieldSize) + NumDistCodesMin;
+    quint32 numLevelCodes = readBits(NumLevelCodesFieldSize) + NumLevelCodesMin;
 
-        decodeLevelTable(tmpLevels, numLitLenLevels + mNumDistLevels);
-        levels.clear();
+    if (mNumDistLevels > Traits::DistTableSize)
+        corrupted();
 
-        memcpy(levels.litLenLevels, tmpLevels, numLitLenLevels);
-        memcpy(levels.distLevels, tmpLevels + numLitLenLevels, mNumDistLevels);
+    quint8 levelLevels[LevelTableSize];
+    for (unsigned int i = 0; i < LevelTableSize; i++) {
+        int position = CodeLengthAlphabetOrder[i];
+        if (i < numLevelCodes) {
+            quint32 temp = readBits(LevelFieldSize);
+            levelLevels[position] = temp;
+        } else {
+            levelLevels[position] = 0;
+        }
     }
 
+    mLevelDecoder.setCodeLengths(levelLevels);
+
+    quint8 tmpLevels[FixedMainTableSize + FixedDistTableSize];
+
+    decodeLevelTable(tmpLevels, numLitLenLevels + mNumDistLevels);
+    Levels levels;
+    levels.clear();
+
+    memcpy(levels.litLenLevels, tmpLevels, numLitLenLevels);
+    memcpy(levels.distLevels, tmpLevels + numLitLenLevels, mNumDistLevels);
+
     mMainDecoder.setCodeLengths(levels.litLenLevels);
     mDistDecoder.setCodeLengths(levels.distLevels);
 }
 
-inline void addLiteral(DecodeInst *block, int& ix, quint8 literal)
+// how much of a stored block can go into the block being filled at once
+static inline int storedChunk(const DecodeBlockWriter& out, int literalEnd)
 {
-    if (block[ix].isLiteral()) {
-        block[ix].setLiteral(block[ix].literalCount(), literal);
-        if (block[ix].literalCount() == 3) {
-            ix++;
-            block[ix].clear();
-        }
-        return;
-    }
-    block[ix].setLiteral(0, literal);
-}
-
-inline void addLenDist(DecodeInst *block, int& ix, int length, int distance)
-{
-    if (block[ix].isLiteral())
-        ix++;
-    block[ix].setLength(length);
-    block[ix].setDistance(distance);
-    ix++;
-    block[ix].clear();
+    return qMin(literalEnd - out.literals(), int(DecodeInst::MaxLiteralCount));
 }
 
+template <class Traits>
 inline int DeflateDecoderMT::readLength(quint32 symbol)
 {
     quint32 number = symbol - SymbolMatch;
-    int len, numBits;
-    if (mType == Deflate64) {
-        len = LenStart64[number];
-        numBits = LenDirectBits64[number];
-    } else {
-        len = LenStart32[number];
-        numBits = LenDirectBits32[number];
-    }
-    quint32 addend = readBits(numBits);
-    len += addend;
-
-    return len;
+    return Traits::lenStart(number) + readBits(Traits::lenDirectBits(number));
 }
 
+template <class Traits>
 void DeflateDecoderMT::streamingDecode()
 {
     bool keepGoing = true;
     while (keepGoing && !mInterrupted) {
         quint64 written;
-        DecodeInst *block = mQueue->allocBlock(&written);
+        DecodeBlock *block = mQueue->allocBlock(&written);
 
-        if (!block)
+        if (!block) {
+            if (mInterrupted)
+                return;
             throw WriteError(mOutBuffer.backingStream());
+        }
 
         emit progress(mBitStream.backingStream()->bytesRead(), written);
 
-        int ix = 0;
-        block->clear();
-        for (; ix < DecodeInstQueue::QueueBlockSize - 1; ) {
+        // room for a literal run to be closed and a match split in two, and
+        // for a literal
+        const int instEnd = mQueue->blockSize() - 2;
+        const int literalEnd = mQueue->literalSize();
+        DecodeBlockWriter out(block);
+        while (out.instructions() < instEnd && out.literals() < literalEnd) {
             if (mNeedReadTable) {
-                readTables();
+                readTables<Traits>();
                 mNeedReadTable = false;
             }
             if (mStoredMode) {
@@ -396,12 +428,16 @@ void DeflateDecoderMT::streamingDecode()
                     mNeedReadTable = true;
                     continue;
                 }
-                addLiteral(block, ix, readBits(8));
-                mStoredBlockSize--;
+                uint n;
+                const quint8 *data = mBitStream.readAlignedBytes(qMin(storedChunk(out, literalEnd), mStoredBlockSize), &n);
+                if (!n)
+                    throw TruncatedArchiveError();
+                out.addLiterals(data, n);
+                mStoredBlockSize -= n;
             } else {
                 quint32 symbol = mMainDecoder.decodeSymbol(mBitStream);
                 if (symbol < SymbolEndOfBlock) {
-                    addLiteral(block, ix, symbol);
+                    out.addLiteral(symbol);
                 } else if (symbol == SymbolEndOfBlock) {
                     if (mIsFinalBlock) {
                         keepGoing = false;
@@ -410,7 +446,7 @@ void DeflateDecoderMT::streamingDecode()
                     mNeedReadTable = true;
                     continue;
                 } else if (symbol < MainTableSize) {
-                    quint32 length = readLength(symbol);
+                    quint32 length = readLength<Traits>(symbol);
                     quint32 distSym = mDistDecoder.decodeSymbol(mBitStream);
 
                     if (distSym >= mNumDistLevels)
@@ -418,46 +454,50 @@ void DeflateDecoderMT::streamingDecode()
 
                     quint32 distance = readBits(DistDirectBits[distSym]);
                     distance += DistStart[distSym];
-                    addLenDist(block, ix, length, distance);
+                    out.addMatch(length, distance);
                 } else {
                     corrupted();
                 }
             }
         }
-        // if we were accumulating a literal, we're now done with it
-        if (block[ix].isLiteral())
-            ix++;
-        mQueue->enqueueBlock(block, ix);
+        mQueue->enqueueBlock(block, out.finish());
     }
 }
 
 
+template <class Traits>
 bool DeflateDecoderMT::decodeBlock(int blockSize)
 {
     bool keepGoing = true;
     while (keepGoing) {
         quint64 written;
-        DecodeInst *block = mQueue->allocBlock(&written);
+        DecodeBlock *block = mQueue->allocBlock(&written);
 
-        if (!block)
+        if (!block) {
+            if (mInterrupted)
+                return false;
             throw WriteError(mOutBuffer.backingStream());
+        }
 
         emit progress(mBitStream.backingStream()->bytesRead(), written);
 
-        int ix = 0;
-        block->clear();
+        // room for a literal run to be closed and a match split in two, and
+        // for a literal
+        const int instEnd = mQueue->blockSize() - 2;
+        const int literalEnd = mQueue->literalSize();
+        DecodeBlockWriter out(block);
         if (mPendingLen) {
             int l = qMin(mPendingLen, blockSize);
-            addLenDist(block, ix, l, mPendingDist);
+            out.addMatch(l, mPendingDist);
             mBytesDecoded += l;
             blockSize -= l;
             mPendingLen -= l;
         }
         while (blockSize) {
-            if (ix == DecodeInstQueue::QueueBlockSize - 1 || ix == DecodeInstQueue::QueueBlockSize)
+            if (out.instructions() >= instEnd || out.literals() >= literalEnd)
                 break;
             if (mNeedReadTable) {
-                readTables();
+                readTables<Traits>();
                 mNeedReadTable = false;
             }
             if (mStoredMode) {
@@ -469,13 +509,18 @@ bool DeflateDecoderMT::decodeBlock(int blockSize)
                     mNeedReadTable = true;
                     continue;
                 }
-                addLiteral(block, ix, readBits(8));
-                mBytesDecoded++;
-                blockSize--;
+                uint n;
+                const quint8 *data = mBitStream.readAlignedBytes(qMin(storedChunk(out, literalEnd), qMin(mStoredBlockSize, blockSize)), &n);
+                if (!n)
+                    throw TruncatedArchiveError();
+                out.addLiterals(data, n);
+                mStoredBlockSize -= n;
+                mBytesDecoded += n;
+                blockSize -= n;
             } else {
                 quint32 symbol = mMainDecoder.decodeSymbol(mBitStream);
                 if (symbol < SymbolEndOfBlock) {
-                    addLiteral(block, ix, symbol);
+                    out.addLiteral(symbol);
                     mBytesDecoded++;
                     blockSize--;
                 } else if (symbol == SymbolEndOfBlock) {
@@ -486,7 +531,7 @@ bool DeflateDecoderMT::decodeBlock(int blockSize)
                     mNeedReadTable = true;
                     continue;
                 } else if (symbol < MainTableSize) {
-                    quint32 len = readLength(symbol);
+                    quint32 len = readLength<Traits>(symbol);
                     quint32 distSym = mDistDecoder.decodeSymbol(mBitStream);
                     if (distSym >= mNumDistLevels)
                         corrupted();
@@ -495,39 +540,44 @@ bool DeflateDecoderMT::decodeBlock(int blockSize)
 
                     quint32 locLen = len;
                     if (mBytesDecoded + len > mBytesExpected || len > blockSize) {
-                        locLen = qMin(mBytesExpected - len, quint64(blockSize));
+                        locLen = qMin(mBytesExpected - mBytesDecoded, quint64(blockSize));
                         mPendingLen = len - locLen;
                         mPendingDist = distance;
                     }
                     mBytesDecoded += locLen;
                     blockSize -= locLen;
 
-                    addLenDist(block, ix, locLen, distance);
+                    out.addMatch(locLen, distance);
                 } else {
                     corrupted();
                 }
             }
         }
 
-        // if we were accumulating a literal, we're now done with it
-        if (block[ix].isLiteral())
-            ix++;
-        mQueue->enqueueBlock(block, ix);
+        mQueue->enqueueBlock(block, out.finish());
         if (!blockSize)
             return false;
     }
     return true;
 }
 
+template <class Traits>
 void DeflateDecoderMT::setup()
 {
+    // the writer thread has finished with the queue by now
+    if (mQueue && (mQueue->blockCount() != mQueueBlockCount || mQueue->blockSize() != mQueueBlockSize)) {
+        delete mWriterThread;
+        mWriterThread = 0;
+        delete mQueue;
+        mQueue = 0;
+    }
     if (!mQueue)
-        mQueue = new DecodeInstQueue();
+        mQueue = new DecodeInstQueue(mQueueBlockCount, mQueueBlockSize);
+    mQueue->reset();
 
     if (!mKeepHistory) {
-        mOutBuffer.setBufferSize(mType == Deflate64 ? HistorySize64 : HistorySize32);
+        mOutBuffer.setBufferSize(Traits::HistorySize, OutputBufferSize);
         mOutBuffer.clear();
-        mQueue->reset();
         mIsFinalBlock = false;
         mPendingLen = 0;
         mNeedReadTable = true;
@@ -542,13 +592,14 @@ void DeflateDecoderMT::createWriter()
     mWriterThread->start();
 }
 
-bool DeflateDecoderMT::stream(ReadStream *sourceStream, WriteStream *destinationStream)
+template <class Traits>
+bool DeflateDecoderMT::decodeStream(ReadStream *sourceStream, WriteStream *destinationStream)
 {
     mInterrupted = 0;
     mBitStream.setBackingStream(sourceStream);
     mOutBuffer.setBackingStream(destinationStream);
 
-    setup();
+    setup<Traits>();
     createWriter();
 
     if (!qgetenv("QZ7_BYTES_EXPECTED").isEmpty())
@@ -563,13 +614,13 @@ bool DeflateDecoderMT::stream(ReadStream *sourceStream, WriteStream *destination
                     return false;
                 }
                 int blockSize = qMin(Q_UINT64_C(1) << 18, mBytesExpected - mBytesDecoded);
-                bool finished = decodeBlock(blockSize);
+                bool finished = decodeBlock<Traits>(blockSize);
 
                 if (finished)
                     break;
             }
         } else {
-            streamingDecode();
+            streamingDecode<Traits>();
         }
     } catch (Error err) {
         mQueue->lastBlock();
@@ -579,10 +630,24 @@ bool DeflateDecoderMT::stream(ReadStream *sourceStream, WriteStream *destination
 
     mQueue->lastBlock();
     mWriterThread->wait();
+    if (mQueue->hasWriteError())
+        throw WriteError(mOutBuffer.backingStream());
     mOutBuffer.flush();
     return true;
 }
 
+bool DeflateDecoderMT::stream(ReadStream *sourceStream, WriteStream *destinationStream)
+{
+    switch (mType) {
+    case Deflate64:
+        return decodeStream<DeflateTraits<Deflate64> >(sourceStream, destinationStream);
+    case DeflateNSIS:
+        return decodeStream<DeflateTraits<DeflateNSIS> >(sourceStream, destinationStream);
+    default:
+        return decodeStream<DeflateTraits<BasicDeflate> >(sourceStream, destinationStream);
+    }
+}
+
 void DeflateDecoderMT::interrupt()
 {
     mInterrupted = 1;
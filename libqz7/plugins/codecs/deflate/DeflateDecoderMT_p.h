@@ -4,10 +4,11 @@
 #include "qz7/BitIoLE.h"
 #include "qz7/RingBuffer.h"
 
-#include "qz7/codec/HuffmanDecoder.h"
-
 #include "DeflateConst.h"
+#include "DeflateFixedTables_p.h"
+#include "DeflateTraits_p.h"
 
+#include <QtCore/QAtomicInt>
 #include <QtCore/QMutex>
 #include <QtCore/QThread>
 #include <QtCore/QWaitCondition>
@@ -15,70 +16,160 @@
 namespace qz7 {
 namespace deflate {
 
+// An instruction for the writer thread: a match of length bytes at
+// distance, or (with a length of 0) a run of literals whose bytes are the
+// next ones in the block's literal buffer.
 class DecodeInst {
 public:
-    void clear() { mCode = 0; }
-    bool isStop() const { return (mCode == STOP); }
-    void setStop() { mCode = STOP; }
-    int length() const { return mCode; }
-    void setLength(int l) { mCode = l; }
+    enum { MaxLength = 0xffff, MaxLiteralCount = 0xffff };
+
+    int length() const { return mLength; }
     int distance() const { return mDistance; }
-    void setDistance(int d) { mDistance = d; } 
-    bool isLiteral() const { return (mCode & LITERAL) != 0; }
-    int literalCount() const { return (mCode & 0x0f00) >> 8; }
-    quint8 literal(int n) const {
-        switch (n) {
-        case 0: return (mCode & 0xff);
-        case 1: return (mDistance & 0xff);
-        case 2: return (mDistance & 0xff00) >> 8;
-        default: Q_ASSERT_X(false, "DecodeInst::literal", "n is invalid");
+    void setMatch(int length, int distance) { mLength = length; mDistance = distance; }
+    bool isLiteral() const { return mLength == 0; }
+    int literalCount() const { return mDistance; }
+    void setLiterals(int count) { mLength = 0; mDistance = count; }
+
+private:
+    quint16 mLength;
+    quint16 mDistance;
+};
+
+// a block of instructions and, in their order, the bytes of their literal
+// runs
+class DecodeBlock {
+public:
+    DecodeBlock() : insts(0), literals(0) { }
+    DecodeInst *insts;
+    quint8 *literals;
+};
+
+// DecodeBlockWriter fills a block: literals are collected into runs, which
+// the writer thread copies out in one piece
+class DecodeBlockWriter {
+public:
+    DecodeBlockWriter(DecodeBlock *block) : mInsts(block->insts), mLiterals(block->literals), mInst(0), mLiteral(0),
+        mRun(0) { }
+
+    // how many instructions and literal bytes the block holds
+    int instructions() const { return mRun ? mInst + 1 : mInst; }
+    int literals() const { return mLiteral; }
+
+    void addLiteral(quint8 literal)
+    {
+        if (mRun == DecodeInst::MaxLiteralCount)
+            closeRun();
+        mLiterals[mLiteral++] = literal;
+        mRun++;
+    }
+
+    // no more than MaxLiteralCount at a time
+    void addLiterals(const quint8 *literals, int count)
+    {
+        ::memcpy(mLiterals + mLiteral, literals, count);
+        mLiteral += count;
+        mRun += count;
+        if (mRun > DecodeInst::MaxLiteralCount) {
+            mRun -= DecodeInst::MaxLiteralCount;
+            mInsts[mInst++].setLiterals(DecodeInst::MaxLiteralCount);
         }
     }
-    void setLiteral(int n, quint8 l) {
-        switch (n) {
-        case 0: mCode = (LITERAL | 0x0100 | l); return;
-        case 1: mCode = (mCode & ~0x0f00) | 0x0200; mDistance = l; return;
-        case 2: mCode = (mCode & ~0x0f00) | 0x0300; mDistance |= quint16(l) << 8; return;
-        default: Q_ASSERT_X(false, "DecodeInst::setLiteral", "n is invalid");
+
+    // deflate64 matches can be a little longer than an instruction holds;
+    // the rest is a match at the same distance
+    void addMatch(int length, int distance)
+    {
+        if (mRun)
+            closeRun();
+        if (length > DecodeInst::MaxLength) {
+            mInsts[mInst++].setMatch(DecodeInst::MaxLength, distance);
+            length -= DecodeInst::MaxLength;
         }
+        mInsts[mInst++].setMatch(length, distance);
     }
 
+    // the number of instructions
+    int finish()
+    {
+        if (mRun)
+            closeRun();
+        return mInst;
+    }
 
 private:
-    enum { LITERAL = 0x8000, STOP = 0xffff };
+    void closeRun() { mInsts[mInst++].setLiterals(mRun); mRun = 0; }
 
-    quint16 mCode;
-    quint16 mDistance;
+    DecodeInst *mInsts;
+    quint8 *mLiterals;
+    int mInst;
+    int mLiteral;
+    int mRun;           // literals not in an instruction yet
 };
 
+// DecodeInstQueue hands blocks of instructions from the decoder thread (the
+// only one to allocate and enqueue) to the writer thread (the only one to
+// dequeue and give them back) through a ring of blockCount blocks of
+// blockSize instructions, with room for LiteralsPerInst literal bytes per
+// instruction. Each side publishes its progress with a counter
+// of the blocks it is done with; a side that finds the ring full or empty
+// spins for a while before it sleeps, and the other side only takes the
+// lock to wake it if it is asleep.
 class DecodeInstQueue {
 public:
-    DecodeInstQueue();
+    enum { DefaultBlockCount = 8, DefaultBlockSize = 8192, LiteralsPerInst = 4 };
+
+    DecodeInstQueue(int blockCount = DefaultBlockCount, int blockSize = DefaultBlockSize);
     ~DecodeInstQueue();
     void reset();
 
-    enum { QueueBlockSize = 8192 };
+    int blockCount() const { return mBlockCount; }
+    int blockSize() const { return mBlockSize; }
+    int literalSize() const { return mBlockSize * LiteralsPerInst; }
 
-    DecodeInst *allocBlock(quint64 *written);
-    void enqueueBlock(DecodeInst *block, int avail);
+    DecodeBlock *allocBlock(quint64 *written);
+    void enqueueBlock(DecodeBlock *block, int avail);
     void lastBlock();
-    DecodeInst *dequeueBlock(int *avail);
-    void wroteBlock(DecodeInst *block, uint written);
-    void writeError(DecodeInst *block);
-    bool hasWriteError();
+    DecodeBlock *dequeueBlock(int *avail);
+    void wroteBlock(DecodeBlock *block, uint written);
+    void writeError(DecodeBlock *block);
+    bool hasWriteError() const;
     void interrupt();
 
 private:
-    enum { NR_BLOCKS = 4 };
-    enum Status { Free, Allocated, Enqueued, Dequeued };
-
+    enum { SpinCount = 4000 };
+    enum StopReason { Running, Interrupted, WriteFailed };
+
+    class Slot {
+    public:
+        Slot() : avail(0), written(0), stop(false) { }
+        DecodeBlock block;
+        int avail;
+        uint written;
+        bool stop;
+    };
+
+    static bool reached(const QAtomicInt& counter, int target) { return int(uint(int(counter)) - uint(target)) >= 0; }
+    bool running() const { return int(mStopped) == Running; }
+    bool waitFor(QAtomicInt *counter, int target);
+    void publish(QAtomicInt *counter);
+    void stop(StopReason reason);
+
+    DecodeInst *mInsts;
+    quint8 *mLiterals;
+    Slot *mSlots;
+    int mBlockCount;
+    int mBlockSize;
+    int mSpinCount;         // none on a single processor
+
+    // blocks enqueued by the decoder and given back by the writer so far
+    QAtomicInt mEnqueued;
+    QAtomicInt mWrittenBlocks;
+    QAtomicInt mStopped;
+    QAtomicInt mSleepers;
+
+    // the decoder's own: the bytes written by the blocks given back so far
     quint64 mWritten;
-    DecodeInst *mBlocks[NR_BLOCKS];
-    Status mStatuses[NR_BLOCKS];
-    int mLengths[NR_BLOCKS];
-
-    int mNextAlloc;
-    int mNextDequeue;
+    int mWrittenSeen;
 
     QMutex mLock;
     QWaitCondition mWaiter;
@@ -92,6 +183,8 @@ public:
     virtual void run();
 
 private:
+    enum { ShortLiteralRun = 8 };   // put byte by byte rather than copied
+
     RingBuffer *mBuffer;
     DecodeInstQueue *mQueue;
 };
@@ -105,24 +198,31 @@ public:
 
     void setKeepHistory(bool keepHistory) { mKeepHistory = keepHistory; }
     void setBytesExpected(quint64 size) { mBytesExpected = size; }
+    void setAnalyzer(Analyzer *analyzer) { mOutBuffer.setAnalyzer(analyzer); }
+    void setQueueSize(int blockCount, int blockSize);
 
     bool stream(ReadStream *from, WriteStream *to);
     void interrupt();
+    // how far into the input the last stream() got
+    quint64 bitsConsumed() const { return mBitStream.position(); }
 
 signals:
     void progress(quint64 bytesIn, quint64 bytesOut);
 
 private:
     quint32 readBits(int numBits);
-    void setup();
     void createWriter();
     void decodeLevelTable(quint8 *values, int numSymbols);
-    void readTables();
-    int readLength(quint32 symbol);
-    void streamingDecode();
-    bool decodeBlock(int blockSize);
     void corrupted();
 
+    // instantiated for each DeflateType's traits; stream() picks one
+    template <class Traits> bool decodeStream(ReadStream *from, WriteStream *to);
+    template <class Traits> void setup();
+    template <class Traits> void readTables();
+    template <class Traits> int readLength(quint32 symbol);
+    template <class Traits> void streamingDecode();
+    template <class Traits> bool decodeBlock(int blockSize);
+
     DecodeWriterThread *mWriterThread;
     DecodeInstQueue *mQueue;
 
@@ -130,9 +230,9 @@ private:
     BitReaderLE mBitStream;
     DeflateType mType;
 
-    HuffmanDecoder<NumHuffmanBits, FixedMainTableSize> mMainDecoder;
-    HuffmanDecoder<NumHuffmanBits, FixedDistTableSize> mDistDecoder;
-    HuffmanDecoder<NumHuffmanBits, LevelTableSize> mLevelDecoder;
+    MainHuffmanDecoder mMainDecoder;
+    DistHuffmanDecoder mDistDecoder;
+    LevelHuffmanDecoder mLevelDecoder;
 
     quint64 mBytesExpected;
     quint64 mBytesDecoded;
@@ -142,11 +242,14 @@ private:
 
     int mStoredBlockSize;
     int mNumDistLevels;
+    int mQueueBlockCount;
+    int mQueueBlockSize;
 
     uint mKeepHistory : 1;
     uint mNeedReadTable : 1;
     uint mIsFinalBlock : 1;
     uint mStoredMode : 1;
+    uint mFixedTables : 1;
 };
 
 
@@ -0,0 +1,843 @@
+#include "DeflateDecoder.h"
+#include "DeflateDecoderPar_p.h"
+#include "qz7/Error.h"
+#include "qz7/Stream.h"
+
+#include <string.h>
+
+namespace qz7 {
+namespace deflate {
+
+// the compressed stream is split into chunks of this size for the workers
+static const int ChunkSize = 1 << 20;
+static const quint64 ChunkBits = quint64(ChunkSize) * 8;
+
+// decoding a chunk stops at the next block end once its output (with marked
+// symbols counting double) has grown this large
+static const int MaxChunkOutput = 64 << 20;
+
+// the symbols are decoded without checks while this much input is buffered
+static const uint FastMinInput = 16;
+
+// a decode that fails this close to the end of its input may just have run
+// out of it
+static const quint64 ExhaustedBits = 64;
+
+/*
+ * ByteArrayReadStream feeds part of a QByteArray to the bit reader
+ */
+
+namespace {
+
+class ByteArrayReadStream : public ReadStream {
+public:
+    ByteArrayReadStream(const QByteArray& data, int start) : mData(data), mStart(start), mPos(start) { }
+
+    using ReadStream::read;
+    using ReadStream::readSome;
+    using ReadStream::peekBuffer;
+    using ReadStream::consume;
+
+    virtual bool read(quint8 *buffer, int bytes) {
+        if (bytes > mData.size() - mPos)
+            return false;
+        ::memcpy(buffer, mData.constData() + mPos, bytes);
+        mPos += bytes;
+        return true;
+    }
+
+    virtual int readSome(quint8 *buffer, int minBytes, int maxBytes) {
+        Q_UNUSED(minBytes);
+        int bytes = qMin(maxBytes, mData.size() - mPos);
+        ::memcpy(buffer, mData.constData() + mPos, bytes);
+        mPos += bytes;
+        return bytes;
+    }
+
+    virtual bool skipForward(qint64 bytes) {
+        if (bytes > mData.size() - mPos)
+            return false;
+        mPos += int(bytes);
+        return true;
+    }
+
+    virtual bool atEnd() const { return mPos >= mData.size(); }
+    virtual qint64 bytesRead() const { return mPos - mStart; }
+    virtual QString errorString() const { return QString(); }
+
+    virtual const quint8 *peekBuffer(int minBytes, int *bytes) {
+        Q_UNUSED(minBytes);
+        *bytes = mData.size() - mPos;
+        return reinterpret_cast<const quint8 *>(mData.constData()) + mPos;
+    }
+
+    virtual void consume(int bytes) { mPos += bytes; }
+
+private:
+    const QByteArray& mData;
+    int mStart;
+    int mPos;
+};
+
+}
+
+// up to 57 bits of data starting at bit pos, with zeroes past the end
+static inline quint64 peekBitsAt(const quint8 *data, int size, quint64 pos)
+{
+    const quint64 byte = pos >> 3;
+    quint64 word = 0;
+
+    if (byte + 8 <= quint64(size)) {
+        ::memcpy(&word, data + byte, sizeof(word));
+        if (QSysInfo::ByteOrder == QSysInfo::BigEndian)
+            word = bswap_64(word);
+    } else {
+        for (int i = 0; byte + i < quint64(size); ++i)
+            word |= quint64(data[byte + i]) << (8 * i);
+    }
+    return word >> (pos & 7);
+}
+
+static inline uint reverseBits(uint code, uint bits)
+{
+    uint ret = 0;
+    for (uint i = 0; i < bits; ++i) {
+        ret = (ret << 1) | (code & 1);
+        code >>= 1;
+    }
+    return ret;
+}
+
+// whether the code lengths make up a complete prefix code; like zlib, an
+// incomplete one is accepted only when it consists of a single 1 bit code
+// (or of no codes at all), and only if allowIncomplete
+static bool isCompleteCode(const quint8 *lengths, int count, bool allowIncomplete)
+{
+    int counts[NumHuffmanBits + 1];
+    ::memset(counts, 0, sizeof(counts));
+
+    for (int i = 0; i < count; ++i)
+        counts[lengths[i]]++;
+
+    const int used = count - counts[0];
+    int left = 1;
+    for (int len = 1; len <= NumHuffmanBits; ++len) {
+        left = (left << 1) - counts[len];
+        if (left < 0)
+            return false;
+    }
+    if (left == 0)
+        return true;
+    return allowIncomplete && (used == 0 || (used == 1 && counts[1] == 1));
+}
+
+/*
+ * ChunkDecoder decodes blocks from memory, keeping back-references into an
+ * unknown window as markers
+ */
+
+ChunkDecoder::ChunkDecoder()
+    : mResult(0)
+    , mBase(0)
+    , mInputBits(0)
+    , mFixedTables(false)
+{
+}
+
+bool ChunkDecoder::isDynamicBlockStart(const QByteArray& input, quint64 pos)
+{
+    const quint8 *data = reinterpret_cast<const quint8 *>(input.constData());
+    const int size = input.size();
+    const quint64 sizeBits = quint64(size) * 8;
+
+    quint64 bits = peekBitsAt(data, size, pos);
+    if (((bits >> FinalBlockFieldSize) & 3) != BlockTypeDynamicHuffman)
+        return false;
+
+    const uint numLitLenLevels = ((bits >> 3) & 31) + NumLitLenCodesMin;
+    const uint numDistLevels = ((bits >> 8) & 31) + NumDistCodesMin;
+    const uint numLevelCodes = ((bits >> 13) & 15) + NumLevelCodesMin;
+    if (numLitLenLevels > MainTableSize || numDistLevels > DistTableSize32)
+        return false;
+    pos += 17;
+
+    quint8 levelLevels[LevelTableSize];
+    ::memset(levelLevels, 0, sizeof(levelLevels));
+    bits = peekBitsAt(data, size, pos);
+    for (uint i = 0; i < numLevelCodes; ++i)
+        levelLevels[CodeLengthAlphabetOrder[i]] = (bits >> (LevelFieldSize * i)) & 7;
+    pos += LevelFieldSize * numLevelCodes;
+
+    if (!isCompleteCode(levelLevels, LevelTableSize, false))
+        return false;
+
+    // a complete code: every entry of the lookup table gets filled
+    quint8 levelSymbols[1 << NumLevelBits];
+    quint8 levelLengths[1 << NumLevelBits];
+    {
+        uint counts[NumLevelBits + 1];
+        uint nextCode[NumLevelBits + 1];
+        ::memset(counts, 0, sizeof(counts));
+        for (uint i = 0; i < LevelTableSize; ++i)
+            counts[levelLevels[i]]++;
+        counts[0] = 0;
+        uint code = 0;
+        for (uint len = 1; len <= NumLevelBits; ++len) {
+            code = (code + counts[len - 1]) << 1;
+            nextCode[len] = code;
+        }
+        for (uint symbol = 0; symbol < LevelTableSize; ++symbol) {
+            const uint len = levelLevels[symbol];
+            if (!len)
+                continue;
+            for (uint i = reverseBits(nextCode[len]++, len); i < (1 << NumLevelBits); i += 1 << len) {
+                levelSymbols[i] = symbol;
+                levelLengths[i] = len;
+            }
+        }
+    }
+
+    quint8 levels[MainTableSize + DistTableSize32];
+    const uint numLevels = numLitLenLevels + numDistLevels;
+    for (uint i = 0; i < numLevels; ) {
+        if (pos >= sizeBits)
+            return false;
+
+        bits = peekBitsAt(data, size, pos);
+        const uint entry = bits & ((1 << NumLevelBits) - 1);
+        const uint symbol = levelSymbols[entry];
+        pos += levelLengths[entry];
+        bits >>= levelLengths[entry];
+
+        if (symbol < TableDirectLevels) {
+            levels[i++] = symbol;
+            continue;
+        }
+
+        uint value = 0;
+        uint num;
+        if (symbol == TableLevelRepNumber) {
+            if (i == 0)
+                return false;
+            value = levels[i - 1];
+            num = (bits & 3) + 3;
+            pos += 2;
+        } else if (symbol == TableLevel0Number) {
+            num = (bits & 7) + 3;
+            pos += 3;
+        } else {
+            num = (bits & 127) + 11;
+            pos += 7;
+        }
+        if (i + num > numLevels)
+            return false;
+        while (num--)
+            levels[i++] = value;
+    }
+
+    return levels[SymbolEndOfBlock] != 0 &&
+        isCompleteCode(levels, numLitLenLevels, true) &&
+        isCompleteCode(levels + numLitLenLevels, numDistLevels, true);
+}
+
+void ChunkDecoder::decode(const QByteArray& input, quint64 startBit, quint64 stopBit,
+                          const quint8 *window, ChunkResult *result)
+{
+    ByteArrayReadStream stream(input, int(startBit / 8));
+
+    mBase = startBit & ~Q_UINT64_C(7);
+    mInputBits = quint64(input.size()) * 8;
+    mBitStream.setBackingStream(&stream);
+    mBitStream.consumeBits(uint(startBit & 7));
+
+    mResult = result;
+    result->valid = false;
+    result->startBit = startBit;
+    result->marked.clear();
+    result->plain.clear();
+    result->plainStart = 0;
+    mMarkedPos = 0;
+    mLastMarker = -1;
+    mPlainPos = 0;
+    mPlainMode = false;
+
+    if (window) {
+        reservePlain(HistorySize32);
+        ::memcpy(result->plain.data(), window, HistorySize32);
+        mPlainPos = result->plainStart = HistorySize32;
+        mPlainMode = true;
+    }
+
+    quint64 pos;
+    do {
+        readTables();
+        if (mStoredMode)
+            decodeStored();
+        else if (mPlainMode || !decodeMarked())
+            decodePlain();
+        pos = mBase + mBitStream.position();
+    } while (!mIsFinalBlock && pos < stopBit && 2 * mMarkedPos + mPlainPos < MaxChunkOutput);
+
+    result->marked.resize(mMarkedPos);
+    result->plain.resize(mPlainPos);
+    result->endBit = pos;
+    result->isFinal = mIsFinalBlock;
+    result->valid = true;
+}
+
+bool ChunkDecoder::exhausted() const
+{
+    return mBase + mBitStream.position() + ExhaustedBits >= mInputBits;
+}
+
+inline quint32 ChunkDecoder::readBits(int numBits)
+{
+    return mBitStream.readBits(numBits);
+}
+
+void ChunkDecoder::decodeLevelTable(quint8 *values, int numSymbols)
+{
+    int i = 0;
+    do {
+        quint32 number = mLevelDecoder.decodeSymbol(mBitStream);
+
+        if (number < TableDirectLevels) {
+            values[i++] = (quint8)number;
+        } else if (number < LevelTableSize) {
+            if (number == TableLevelRepNumber) {
+                if (i == 0)
+                    throw CorruptedError();
+
+                quint32 num = readBits(2) + 3;
+                for (; num > 0 && i < numSymbols; num--, i++)
+                    values[i] = values[i - 1];
+            } else {
+                quint32 num;
+                if (number == TableLevel0Number)
+                    num = readBits(3) + 3;
+                else
+                    num = readBits(7) + 11;
+
+                for ( ; num > 0 && i < numSymbols; num--)
+                    values[i++] = 0;
+            }
+        } else {
+            throw CorruptedError();
+        }
+    } while (i < numSymbols);
+}
+
+void ChunkDecoder::readTables()
+{
+    mIsFinalBlock = (readBits(FinalBlockFieldSize) == FinalBlock);
+
+    quint32 blockType = readBits(BlockTypeFieldSize);
+    if (blockType > BlockTypeDynamicHuffman)
+        throw CorruptedError();
+
+    if (blockType == BlockTypeStored) {
+        mStoredMode = true;
+        mBitStream.alignToByte();
+        mStoredBlockSize = readBits(StoredBlockLengthFieldSize);
+
+        quint32 invBlockSize = readBits(StoredBlockLengthFieldSize);
+        if (mStoredBlockSize != (quint16)~invBlockSize)
+            throw CorruptedError();
+        return;
+    }
+
+    mStoredMode = false;
+
+    if (blockType == BlockTypeFixedHuffman) {
+        mNumDistLevels = DistTableSize32;
+        // the tables are left alone until the next dynamic block, so runs
+        // of fixed blocks (as sync flushes produce) only copy them in once
+        if (!mFixedTables) {
+            const FixedHuffmanTables& fixed = FixedHuffmanTables::instance();
+            mMainDecoder = fixed.mainDecoder;
+            mDistDecoder = fixed.distDecoder;
+            mFixedTables = true;
+        }
+        return;
+    }
+
+    mFixedTables = false;
+
+    quint32 numLitLenLevels = readBits(NumLenCodesFieldSize) + NumLitLenCodesMin;
+    mNumDistLevels = readBits(NumDistCodesFieldSize) + NumDistCodesMin;
+    quint32 numLevelCodes = readBits(NumLevelCodesFieldSize) + NumLevelCodesMin;
+
+    if (mNumDistLevels > DistTableSize32)
+        throw CorruptedError();
+
+    quint8 levelLevels[LevelTableSize];
+    for (unsigned int i = 0; i < LevelTableSize; i++) {
+        int position = CodeLengthAlphabetOrder[i];
+        if (i < numLevelCodes)
+            levelLevels[position] = readBits(LevelFieldSize);
+        else
+            levelLevels[position] = 0;
+    }
+
+    mLevelDecoder.setCodeLengths(levelLevels);
+
+    quint8 tmpLevels[FixedMainTableSize + FixedDistTableSize];
+
+    decodeLevelTable(tmpLevels, numLitLenLevels + mNumDistLevels);
+    Levels levels;
+    levels.clear();
+
+    memcpy(levels.litLenLevels, tmpLevels, numLitLenLevels);
+    memcpy(levels.distLevels, tmpLevels + numLitLenLevels, mNumDistLevels);
+
+    mMainDecoder.setCodeLengths(levels.litLenLevels);
+    mDistDecoder.setCodeLengths(levels.distLevels);
+}
+
+// decodes a literal/length symbol, and for a match the rest of it; distance
+// is one less than the actual distance, the way RingBuffer wants it
+inline quint32 ChunkDecoder::nextSymbol(quint32 *len, quint32 *distance)
+{
+    quint32 symbol;
+
+    if (likely(mBitStream.bufferedBytes() >= FastMinInput)) {
+        // 56 bits cover a whole match
+        mBitStream.refillFast();
+        symbol = mMainDecoder.decodeSymbolFast(mBitStream);
+        if (symbol <= SymbolEndOfBlock)
+            return symbol;
+        if (symbol >= MainTableSize)
+            throw CorruptedError();
+
+        quint32 number = symbol - SymbolMatch;
+        *len = LenStart32[number] + mBitStream.readBitsFast(LenDirectBits32[number]);
+
+        quint32 distSymbol = mDistDecoder.decodeSymbolFast(mBitStream);
+        if (distSymbol >= mNumDistLevels)
+            throw CorruptedError();
+        *distance = DistStart[distSymbol] + mBitStream.readBitsFast(DistDirectBits[distSymbol]);
+        return symbol;
+    }
+
+    symbol = mMainDecoder.decodeSymbol(mBitStream);
+    if (symbol <= SymbolEndOfBlock)
+        return symbol;
+    if (symbol >= MainTableSize)
+        throw CorruptedError();
+
+    quint32 number = symbol - SymbolMatch;
+    *len = LenStart32[number] + readBits(LenDirectBits32[number]);
+
+    quint32 distSymbol = mDistDecoder.decodeSymbol(mBitStream);
+    if (distSymbol >= mNumDistLevels)
+        throw CorruptedError();
+    *distance = DistStart[distSymbol] + readBits(DistDirectBits[distSymbol]);
+    return symbol;
+}
+
+inline void ChunkDecoder::reserveMarked(int count)
+{
+    if (mMarkedPos + count > mResult->marked.size())
+        mResult->marked.resize(qMax(2 * mResult->marked.size(), mMarkedPos + count + HistorySize32));
+}
+
+inline void ChunkDecoder::reservePlain(int count)
+{
+    // copyMatch() may overrun the end of the match
+    count += MatchCopySlack;
+    if (mPlainPos + count > mResult->plain.size())
+        mResult->plain.resize(qMax(2 * mResult->plain.size(), mPlainPos + count + HistorySize32));
+}
+
+void ChunkDecoder::decodeStored()
+{
+    while (mStoredBlockSize > 0) {
+        uint n;
+        const quint8 *data = mBitStream.readAlignedBytes(mStoredBlockSize, &n);
+        if (!n)
+            throw TruncatedArchiveError();
+        if (mPlainMode) {
+            reservePlain(n);
+            ::memcpy(mResult->plain.data() + mPlainPos, data, n);
+            mPlainPos += n;
+        } else {
+            reserveMarked(n);
+            quint16 *out = mResult->marked.data() + mMarkedPos;
+            for (uint i = 0; i < n; i++)
+                out[i] = data[i];
+            mMarkedPos += n;
+        }
+        mStoredBlockSize -= n;
+    }
+}
+
+// returns true at the end of the block, or false once the last 32 KB of
+// output are free of markers, for decodePlain() to take over
+bool ChunkDecoder::decodeMarked()
+{
+    for (;;) {
+        if (mMarkedPos - mLastMarker > HistorySize32) {
+            switchToPlain();
+            return false;
+        }
+
+        reserveMarked(MatchMaxLen32);
+        quint16 *out = mResult->marked.data();
+
+        quint32 len, distance;
+        quint32 symbol = nextSymbol(&len, &distance);
+
+        if (symbol < SymbolEndOfBlock) {
+            out[mMarkedPos++] = quint16(symbol);
+            continue;
+        } else if (symbol == SymbolEndOfBlock) {
+            return true;
+        }
+
+        int src = mMarkedPos - int(distance) - 1;
+        for (quint32 i = 0; i < len; ++i, ++src) {
+            quint16 value = (src >= 0) ? out[src] : quint16(ChunkResult::MarkerBase + HistorySize32 + src);
+            if (value >= ChunkResult::MarkerBase)
+                mLastMarker = mMarkedPos;
+            out[mMarkedPos++] = value;
+        }
+    }
+}
+
+void ChunkDecoder::switchToPlain()
+{
+    reservePlain(HistorySize32);
+
+    quint8 *dst = reinterpret_cast<quint8 *>(mResult->plain.data());
+    const quint16 *src = mResult->marked.constData() + mMarkedPos - HistorySize32;
+    for (int i = 0; i < HistorySize32; ++i)
+        dst[i] = quint8(src[i]);
+
+    mPlainPos = mResult->plainStart = HistorySize32;
+    mPlainMode = true;
+}
+
+void ChunkDecoder::decodePlain()
+{
+    for (;;) {
+        reservePlain(MatchMaxLen32);
+        quint8 *out = reinterpret_cast<quint8 *>(mResult->plain.data());
+
+        quint32 len, distance;
+        quint32 symbol = nextSymbol(&len, &distance);
+
+        if (symbol < SymbolEndOfBlock) {
+            out[mPlainPos++] = quint8(symbol);
+            continue;
+        } else if (symbol == SymbolEndOfBlock) {
+            return;
+        }
+
+        copyMatch(out + mPlainPos, distance + 1, len);
+        mPlainPos += len;
+    }
+}
+
+/*
+ * ChunkWorkerThread decodes chunks without knowing what precedes them
+ */
+
+ChunkWorkerThread::ChunkWorkerThread(ChunkJobQueue *jobQueue, QObject *parent)
+    : QThread(parent)
+    , mQueue(jobQueue)
+{
+}
+
+void ChunkWorkerThread::run()
+{
+    while (ChunkJob *job = mQueue->dequeue()) {
+        decodeChunk(job);
+        mQueue->finished(job);
+    }
+}
+
+void ChunkWorkerThread::decodeChunk(ChunkJob *job)
+{
+    ChunkResult& result = job->result;
+
+    try {
+        if (job->knownStart) {
+            mDecoder.decode(job->input, 0, job->chunkBits, 0, &result);
+        } else {
+            // stored and fixed Huffman blocks are too hard to tell from
+            // random data; if the chunk starts with one, it gets decoded
+            // sequentially
+            for (quint64 pos = 0; pos < job->chunkBits; ++pos) {
+                if (!ChunkDecoder::isDynamicBlockStart(job->input, pos))
+                    continue;
+
+                try {
+                    mDecoder.decode(job->input, pos, job->chunkBits, 0, &result);
+                    break;
+                } catch (CorruptedError) {
+                    // not a block after all
+                }
+            }
+        }
+    } catch (Error) {
+        // most likely a block running past the end of our input
+        result.valid = false;
+    }
+
+    if (result.valid) {
+        result.startBit += job->inputBit;
+        result.endBit += job->inputBit;
+    }
+}
+
+/*
+ * DeflateDecoderPar reads the input, schedules the chunks and writes out
+ * their results in order
+ */
+
+DeflateDecoderPar::DeflateDecoderPar(QObject *parent)
+    : QObject(parent)
+    , mSource(0)
+    , mNextJob(0)
+    , mLoadedChunks(0)
+    , mSourceAtEnd(false)
+    , mThreadCount(2)
+    , mBytesExpected(0)
+    , mBytesWritten(0)
+    , mBitsConsumed(0)
+    , mInterrupted(0)
+{
+}
+
+DeflateDecoderPar::~DeflateDecoderPar()
+{
+    mQueue.stop();
+    for (int i = 0; i < mWorkers.count(); ++i)
+        mWorkers.at(i)->wait();
+}
+
+bool DeflateDecoderPar::loadChunk(int index)
+{
+    // chunks are read in order
+    while (mLoadedChunks <= index && !mSourceAtEnd) {
+        QByteArray chunk;
+        chunk.resize(ChunkSize);
+
+        int bytes = 0;
+        while (bytes < ChunkSize) {
+            int read = mSource->readSome(reinterpret_cast<quint8 *>(chunk.data()) + bytes, 1, ChunkSize - bytes);
+            if (read < 0)
+                throw ReadError(mSource);
+            if (!read) {
+                mSourceAtEnd = true;
+                break;
+            }
+            bytes += read;
+        }
+        if (!bytes)
+            break;
+
+        chunk.resize(bytes);
+        mChunks.insert(mLoadedChunks++, chunk);
+    }
+    return mChunks.contains(index);
+}
+
+void DeflateDecoderPar::scheduleJobs(int first)
+{
+    // keep enough chunks in flight to keep all workers busy while we're
+    // writing out the results
+    mNextJob = qMax(mNextJob, first);
+    for (; mNextJob < first + 2 * mThreadCount; ++mNextJob) {
+        if (!loadChunk(mNextJob))
+            break;
+        const bool hasNext = loadChunk(mNextJob + 1);
+
+        ChunkJob *job = new ChunkJob;
+        job->index = mNextJob;
+        job->inputBit = quint64(mNextJob) * ChunkBits;
+        job->input = mChunks.value(mNextJob);
+        job->chunkBits = quint64(job->input.size()) * 8;
+        if (hasNext)
+            job->input += mChunks.value(mNextJob + 1);
+        job->knownStart = (mNextJob == 0);
+
+        mJobs.insert(mNextJob, job);
+        mQueue.enqueue(job);
+    }
+}
+
+// the loaded input from bytePos to the end of the chunks'th chunk after it
+QByteArray DeflateDecoderPar::gatherInput(quint64 bytePos, int chunks, bool *atEnd)
+{
+    const int index = int(bytePos / ChunkSize);
+
+    QByteArray input;
+    for (int i = index; i < index + chunks && loadChunk(i); ++i)
+        input += mChunks.value(i);
+    *atEnd = !loadChunk(index + chunks);
+
+    return input.mid(int(bytePos - quint64(index) * ChunkSize));
+}
+
+void DeflateDecoderPar::decodeDirectly(quint64 bitPos, quint64 stopBit, ChunkResult *result)
+{
+    quint8 window[HistorySize32];
+    currentWindow(window);
+
+    const quint64 bytePos = bitPos / 8;
+    for (int chunks = 2; ; chunks *= 2) {
+        bool atEnd;
+        QByteArray input = gatherInput(bytePos, chunks, &atEnd);
+
+        try {
+            mDecoder.decode(input, bitPos & 7, stopBit - bytePos * 8, window, result);
+            break;
+        } catch (Error) {
+            // a block reaching beyond the input: try again with more of it
+            if (atEnd || !mDecoder.exhausted())
+                throw;
+        }
+    }
+
+    result->startBit += bytePos * 8;
+    result->endBit += bytePos * 8;
+}
+
+void DeflateDecoderPar::currentWindow(quint8 *window) const
+{
+    mOutBuffer.copyHistory(window, HistorySize32);
+}
+
+void DeflateDecoderPar::writeResult(const ChunkResult& result)
+{
+    quint64 remaining = mBytesExpected ? mBytesExpected - mBytesWritten : ~Q_UINT64_C(0);
+
+    if (!result.marked.isEmpty()) {
+        // the markers refer to what has been written before this chunk
+        quint8 window[HistorySize32];
+        currentWindow(window);
+
+        const quint16 *src = result.marked.constData();
+        const int count = int(qMin(quint64(result.marked.size()), remaining));
+        quint8 buffer[4096];
+        for (int i = 0; i < count; ) {
+            const int n = qMin(count - i, int(sizeof(buffer)));
+            for (int j = 0; j < n; ++j) {
+                const quint16 value = src[i + j];
+                buffer[j] = (value < ChunkResult::MarkerBase) ? quint8(value) : window[value - ChunkResult::MarkerBase];
+            }
+            mOutBuffer.putBytes(buffer, n);
+            i += n;
+        }
+        mBytesWritten += count;
+        remaining -= count;
+    }
+
+    const int count = int(qMin(quint64(result.plain.size() - result.plainStart), remaining));
+    if (count > 0) {
+        mOutBuffer.putBytes(reinterpret_cast<const quint8 *>(result.plain.constData()) + result.plainStart, count);
+        mBytesWritten += count;
+    }
+}
+
+void DeflateDecoderPar::dropBefore(int index)
+{
+    QList<int> indexes = mJobs.keys();
+    for (int i = 0; i < indexes.count() && indexes.at(i) < index; ++i) {
+        ChunkJob *job = mJobs.take(indexes.at(i));
+        mQueue.discard(job);
+        delete job;
+    }
+
+    indexes = mChunks.keys();
+    for (int i = 0; i < indexes.count() && indexes.at(i) < index; ++i)
+        mChunks.remove(indexes.at(i));
+}
+
+void DeflateDecoderPar::cleanup()
+{
+    dropBefore(qMax(mNextJob, mLoadedChunks) + 1);
+    mSource = 0;
+}
+
+bool DeflateDecoderPar::stream(ReadStream *sourceStream, WriteStream *destinationStream)
+{
+    mInterrupted = 0;
+    mSource = sourceStream;
+    mSourceAtEnd = false;
+    mNextJob = 0;
+    mLoadedChunks = 0;
+    mBytesWritten = 0;
+    mBitsConsumed = 0;
+
+    mOutBuffer.setBackingStream(destinationStream);
+    mOutBuffer.setBufferSize(HistorySize32, OutputBufferSize);
+    mOutBuffer.clear();
+
+    while (mWorkers.count() < mThreadCount) {
+        ChunkWorkerThread *worker = new ChunkWorkerThread(&mQueue, this);
+        worker->start();
+        mWorkers.append(worker);
+    }
+
+    try {
+        quint64 bitPos = 0;
+        for (;;) {
+            if (mInterrupted) {
+                cleanup();
+                return false;
+            }
+
+            const int index = int(bitPos / ChunkBits);
+            dropBefore(index);
+            scheduleJobs(index);
+
+            ChunkJob *job = mJobs.value(index);
+            quint64 jobStart = ~Q_UINT64_C(0);
+            if (job) {
+                mQueue.waitFor(job);
+                if (job->result.valid)
+                    jobStart = job->result.startBit;
+            }
+
+            // only a worker that found the block we're at has the right
+            // result; otherwise we decode up to the chunk's end, or up to
+            // where the worker started if it found a later block
+            ChunkResult direct;
+            const ChunkResult *result = &direct;
+            if (jobStart == bitPos) {
+                result = &job->result;
+            } else {
+                quint64 stopBit = quint64(index + 1) * ChunkBits;
+                if (jobStart > bitPos && jobStart < stopBit)
+                    stopBit = jobStart;
+                decodeDirectly(bitPos, stopBit, &direct);
+            }
+
+            writeResult(*result);
+            bitPos = result->endBit;
+            mBitsConsumed = bitPos;
+
+            emit progress(bitPos / 8, mBytesWritten);
+
+            if (result->isFinal || (mBytesExpected && mBytesWritten >= mBytesExpected))
+                break;
+        }
+    } catch (Error) {
+        cleanup();
+        throw;
+    }
+
+    cleanup();
+    mOutBuffer.flush();
+    return true;
+}
+
+void DeflateDecoderPar::interrupt()
+{
+    mInterrupted = 1;
+}
+
+}
+}
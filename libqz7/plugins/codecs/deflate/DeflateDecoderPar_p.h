@@ -0,0 +1,186 @@
+#ifndef QZ7_DEFLATEDECODERPAR_P_H
+#define QZ7_DEFLATEDECODERPAR_P_H
+
+#include "qz7/BitIoLE.h"
+#include "qz7/JobQueue.h"
+#include "qz7/RingBuffer.h"
+
+#include "DeflateConst.h"
+#include "DeflateFixedTables_p.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QList>
+#include <QtCore/QMap>
+#include <QtCore/QThread>
+#include <QtCore/QVector>
+
+namespace qz7 {
+namespace deflate {
+
+// The output of a run of whole deflate blocks. When it was decoded without
+// knowing the window preceding it, back-references reaching before its start
+// are recorded as markers (MarkerBase plus the index into that 32 KB window)
+// in marked; once 32 KB of output without markers have come out, the rest
+// goes into plain as bytes.
+class ChunkResult {
+public:
+    ChunkResult() : valid(false), isFinal(false), startBit(0), endBit(0), plainStart(0) { }
+
+    enum { MarkerBase = 256 };
+
+    bool valid;
+    bool isFinal;
+    quint64 startBit;
+    quint64 endBit;
+
+    QVector<quint16> marked;
+    // plain starts with plainStart bytes of history that aren't part of the output
+    QByteArray plain;
+    int plainStart;
+};
+
+// ChunkDecoder decodes deflate blocks from memory, with or without the
+// preceding window
+class ChunkDecoder {
+public:
+    ChunkDecoder();
+
+    // decodes blocks from bit startBit of input on until one ends at or
+    // after stopBit, the final block is done or the output has grown large;
+    // window is the 32 KB of output preceding startBit, if it is known.
+    // Bit positions in the result are relative to the start of input.
+    void decode(const QByteArray& input, quint64 startBit, quint64 stopBit,
+                const quint8 *window, ChunkResult *result);
+
+    // a quick check whether a dynamic Huffman block with valid code tables
+    // could start at bit pos of input, as a filter before trying decode()
+    static bool isDynamicBlockStart(const QByteArray& input, quint64 pos);
+
+    // whether the last decode() failed for want of input
+    bool exhausted() const;
+
+private:
+    quint32 readBits(int numBits);
+    void decodeLevelTable(quint8 *values, int numSymbols);
+    void readTables();
+    quint32 nextSymbol(quint32 *len, quint32 *distance);
+    void decodeStored();
+    bool decodeMarked();
+    void decodePlain();
+    void switchToPlain();
+    void reserveMarked(int count);
+    void reservePlain(int count);
+
+    BitReaderLE mBitStream;
+    ChunkResult *mResult;
+    quint64 mBase;
+    quint64 mInputBits;
+
+    MainHuffmanDecoder mMainDecoder;
+    DistHuffmanDecoder mDistDecoder;
+    LevelHuffmanDecoder mLevelDecoder;
+
+    quint32 mStoredBlockSize;
+    quint32 mNumDistLevels;
+
+    int mMarkedPos;
+    int mLastMarker;
+    int mPlainPos;
+
+    bool mIsFinalBlock;
+    bool mStoredMode;
+    bool mFixedTables;
+    bool mPlainMode;
+};
+
+// A chunk of the compressed stream for a worker to decode. Its input holds
+// the chunk itself followed by the next one, so that the blocks started in
+// the chunk can be decoded to their end.
+class ChunkJob {
+public:
+    ChunkJob() : index(0), inputBit(0), chunkBits(0), knownStart(false), done(false) { }
+
+    int index;
+    QByteArray input;
+    quint64 inputBit;       // the position of input in the compressed stream
+    quint64 chunkBits;      // the size of the chunk itself
+    bool knownStart;        // the chunk starts with a block
+    bool done;
+
+    ChunkResult result;     // with positions in the compressed stream
+};
+
+typedef JobQueue<ChunkJob> ChunkJobQueue;
+
+class ChunkWorkerThread : public QThread {
+    Q_OBJECT
+
+public:
+    ChunkWorkerThread(ChunkJobQueue *jobQueue, QObject *parent);
+    virtual void run();
+
+private:
+    void decodeChunk(ChunkJob *job);
+
+    ChunkJobQueue *mQueue;
+    ChunkDecoder mDecoder;
+};
+
+// DeflateDecoderPar splits the compressed stream into chunks that worker
+// threads decode independently: each looks for the first block starting in
+// its chunk and decodes it without knowing the preceding window. The results
+// are stitched together in order, resolving the back-references into the
+// unknown window; where a worker guessed wrong, the chunk is decoded here.
+class DeflateDecoderPar : public QObject {
+    Q_OBJECT
+
+public:
+    DeflateDecoderPar(QObject *parent);
+    ~DeflateDecoderPar();
+
+    void setThreadCount(int threadCount) { mThreadCount = threadCount; }
+    void setBytesExpected(quint64 size) { mBytesExpected = size; }
+    void setAnalyzer(Analyzer *analyzer) { mOutBuffer.setAnalyzer(analyzer); }
+
+    bool stream(ReadStream *from, WriteStream *to);
+    void interrupt();
+    // how far into the input the last stream() got
+    quint64 bitsConsumed() const { return mBitsConsumed; }
+
+signals:
+    void progress(quint64 bytesIn, quint64 bytesOut);
+
+private:
+    bool loadChunk(int index);
+    void scheduleJobs(int first);
+    QByteArray gatherInput(quint64 bytePos, int chunks, bool *atEnd);
+    void decodeDirectly(quint64 bitPos, quint64 stopBit, ChunkResult *result);
+    void currentWindow(quint8 *window) const;
+    void writeResult(const ChunkResult& result);
+    void dropBefore(int index);
+    void cleanup();
+
+    QList<ChunkWorkerThread *> mWorkers;
+    ChunkJobQueue mQueue;
+    ChunkDecoder mDecoder;
+
+    RingBuffer mOutBuffer;
+    ReadStream *mSource;
+
+    QMap<int, QByteArray> mChunks;
+    QMap<int, ChunkJob *> mJobs;
+    int mNextJob;
+    int mLoadedChunks;
+    bool mSourceAtEnd;
+
+    int mThreadCount;
+    quint64 mBytesExpected;
+    quint64 mBytesWritten;
+    quint64 mBitsConsumed;
+    int mInterrupted;
+};
+
+}
+}
+
+#endif
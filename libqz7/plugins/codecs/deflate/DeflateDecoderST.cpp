@@ -12,11 +12,19 @@ namespace deflate {
 static const int LenIdFinished = -1;
 static const int LenIdNeedInit = -2;
 
+// decodeFast() needs room for a whole match, and enough buffered input for
+// two refills of the bit stream (the second only for Deflate64's long lengths)
+static const quint32 FastMinOutput = MatchMaxLen32;
+static const uint FastMinInput = 16;
+
 DeflateDecoderST::DeflateDecoderST(DeflateType type, QObject *parent)
     : QObject(parent)
     , mType(type)
     , mBytesExpected(0)
+    , mCheckpointInterval(0)
     , mKeepHistory(false)
+    , mFixedTables(false)
+    , mResume(false)
 {
 }
 
@@ -64,7 +72,8 @@ void DeflateDecoderST::decodeLevelTable(quint8 *values, int numSymbols)
     } while (i < numSymbols);
 }
 
-void DeflateDecoderST::readTables(void)
+template <class Traits>
+void DeflateDecoderST::readTables()
 {
     quint32 finalBlock = readBits(FinalBlockFieldSize);
     mIsFinalBlock = (finalBlock == FinalBlock);
@@ -78,7 +87,7 @@ void DeflateDecoderST::readTables(void)
         mBitStream.alignToByte();
         mStoredBlockSize = readBits(StoredBlockLengthFieldSize);
 
-        if (mType == DeflateNSIS)
+        if (!Traits::StoredLengthCheck)
             return;
 
         quint32 invBlockSize;
@@ -91,48 +100,116 @@ void DeflateDecoderST::readTables(void)
 
     mStoredMode = false;
 
-    Levels levels;
     if (blockType == BlockTypeFixedHuffman) {
-        levels.setFixedLevels();
-        mNumDistLevels = (mType == Deflate64) ? DistTableSize64 : DistTableSize32;
-    } else {
-        quint32 numLitLenLevels = readBits(NumLenCodesFieldSize) + NumLitLenCodesMin;
-        mNumDistLevels = readBits(NumDistCodesFieldSize) + NumDistCodesMin;
-        quint32 numLevelCodes = readBits(NumLevelCodesFieldSize) + NumLevelCodesMin;
-
-        if (mType != Deflate64)
-            if (mNumDistLevels > DistTableSize32)
-                throw CorruptedError();
-        else
-            if (mNumDistLevels > DistTableSize64)
-                throw CorruptedError();
-
-        quint8 levelLevels[LevelTableSize];
-        for (unsigned int i = 0; i < LevelTableSize; i++) {
-            int position = CodeLengthAlphabetOrder[i];
-            if (i < numLevelCodes) {
-                quint32 temp = readBits(LevelFieldSize);
-                levelLevels[position] = temp;
-            } else {
-                levelLevels[position] = 0;
-            }
+        mNumDistLevels = Traits::DistTableSize;
+        // the tables are left alone until the next dynamic block, so runs
+        // of fixed blocks (as sync flushes produce) only copy them in once
+        if (!mFixedTables) {
+            const FixedHuffmanTables& fixed = FixedHuffmanTables::instance();
+            mMainDecoder = fixed.mainDecoder;
+            mDistDecoder = fixed.distDecoder;
+            mFixedTables = true;
         }
+        return;
+    }
 
-        mLevelDecoder.setCodeLengths(levelLevels);
+    mFixedTables = false;
 
-        quint8 tmpLevels[FixedMainTableSize + FixedDistTableSize];
+    quint32 numLitLenLevels = readBits(NumLenCodesFieldSize) + NumLitLenCodesMin;
+    mNumDistLevels = readBits(NumDistCodesFieldSize) + NumDistCodesMin;
+    quint32 numLevelCodes = readBits(NumLevelCodesFieldSize) + NumLevelCodesMin;
 
-        decodeLevelTable(tmpLevels, numLitLenLevels + mNumDistLevels);
-        levels.clear();
+    if (mNumDistLevels > Traits::DistTableSize)
+        throw CorruptedError();
 
-        memcpy(levels.litLenLevels, tmpLevels, numLitLenLevels);
-        memcpy(levels.distLevels, tmpLevels + numLitLenLevels, mNumDistLevels);
+    quint8 levelLevels[LevelTableSize];
+    for (unsigned int i = 0; i < LevelTableSize; i++) {
+        int position = CodeLengthAlphabetOrder[i];
+        if (i < numLevelCodes) {
+            quint32 temp = readBits(LevelFieldSize);
+            levelLevels[position] = temp;
+        } else {
+            levelLevels[position] = 0;
+        }
     }
 
+    mLevelDecoder.setCodeLengths(levelLevels);
+
+    quint8 tmpLevels[FixedMainTableSize + FixedDistTableSize];
+
+    decodeLevelTable(tmpLevels, numLitLenLevels + mNumDistLevels);
+    Levels levels;
+    levels.clear();
+
+    memcpy(levels.litLenLevels, tmpLevels, numLitLenLevels);
+    memcpy(levels.distLevels, tmpLevels + numLitLenLevels, mNumDistLevels);
+
     mMainDecoder.setCodeLengths(levels.litLenLevels);
     mDistDecoder.setCodeLengths(levels.distLevels);
 }
 
+inline bool DeflateDecoderST::canDecodeFast(quint32 curSize) const
+{
+    return curSize >= FastMinOutput && mOutBuffer.available() >= FastMinOutput &&
+        mBitStream.bufferedBytes() >= FastMinInput;
+}
+
+// the inner loop for the bulk of a Huffman block: as long as canDecodeFast()
+// holds, nothing can run out, so symbols are decoded without any per-symbol
+// refill, truncation or flush checks. Returns true at the end of the block.
+template <class Traits>
+bool DeflateDecoderST::decodeFast(quint32& curSize)
+{
+    do {
+        // 56 bits cover a length code and its extra bits plus a distance
+        // code and its extra bits
+        mBitStream.refillFast();
+
+        quint32 symbol = mMainDecoder.decodeSymbolFast(mBitStream);
+
+        if (symbol < SymbolEndOfBlock) {
+            mOutBuffer.putByteNoFlush(quint8(symbol));
+            curSize--;
+            continue;
+        } else if (symbol == SymbolEndOfBlock) {
+            return true;
+        } else if (symbol >= MainTableSize) {
+            throw CorruptedError();
+        }
+
+        quint32 number = symbol - SymbolMatch;
+        quint32 len = Traits::lenStart(number) + mBitStream.readBitsFast(Traits::lenDirectBits(number));
+        if (Traits::LongMatches)
+            mBitStream.refillFast();
+
+        symbol = mDistDecoder.decodeSymbolFast(mBitStream);
+        if (symbol >= mNumDistLevels)
+            throw CorruptedError();
+
+        quint32 distance = DistStart[symbol] + mBitStream.readBitsFast(DistDirectBits[symbol]);
+
+        if (Traits::LongMatches && unlikely(len > FastMinOutput)) {
+            // only Deflate64 has lengths this long; they may need a flush
+            // midway or may not fit into this chunk at all
+            quint32 locLen = qMin(len, curSize);
+            mOutBuffer.repeatBytes(distance, locLen);
+            curSize -= locLen;
+            if (len != locLen) {
+                mRemainLen = qint32(len - locLen);
+                mRep0 = distance;
+                return false;
+            }
+            continue;
+        }
+
+        mOutBuffer.repeatBytesNoFlush(distance, len);
+        curSize -= len;
+    } while (canDecodeFast(curSize));
+
+    return false;
+}
+
+template <class Traits>
 void DeflateDecoderST::codeChunk(quint32 curSize)
 {
     if (mRemainLen == LenIdFinished)
@@ -140,9 +217,21 @@ void DeflateDecoderST::codeChunk(quint32 curSize)
 
     if (mRemainLen == LenIdNeedInit) {
         if (!mKeepHistory) {
-            mOutBuffer.setBufferSize(mType == Deflate64 ? HistorySize64 : HistorySize32);
+            mOutBuffer.setBufferSize(Traits::HistorySize, OutputBufferSize);
             mOutBuffer.clear();
         }
+        if (mResume) {
+            // the input starts with the byte holding the checkpoint's bit
+            if (uint(mResumePoint.window.size()) > mOutBuffer.historySize())
+                throw CorruptedError();
+            mOutBuffer.setHistory(reinterpret_cast<const quint8 *>(mResumePoint.window.constData()),
+                                  mResumePoint.window.size());
+            mBitStream.consumeBits(mResumePoint.compressedBitOffset & 7);
+            mResumePoint = DeflateCheckpoint();
+            mResume = false;
+        }
+        mOutStart = mOutBuffer.position();
+        mNextCheckpoint = mCheckpointInterval;
         mIsFinalBlock = false;
         mRemainLen = 0;
         mNeedReadTable = true;
@@ -164,19 +253,36 @@ void DeflateDecoderST::codeChunk(quint32 curSize)
                 mRemainLen = LenIdFinished;
                 break;
             }
-            readTables();
+            if (mCheckpointInterval != 0)
+                addCheckpoint();
+            readTables<Traits>();
             mNeedReadTable = false;
         }
 
         if (mStoredMode) {
-            for (; mStoredBlockSize > 0 && curSize > 0; mStoredBlockSize--, curSize--) {
-                uint byte = readBits(8);
-                mOutBuffer.putByte(quint8(byte));
+            // copied across as it is lent by the input
+            while (mStoredBlockSize > 0 && curSize > 0) {
+                uint n;
+                const quint8 *data = mBitStream.readAlignedBytes(qMin(mStoredBlockSize, curSize), &n);
+                if (!n)
+                    throw TruncatedArchiveError();
+                mOutBuffer.putBytes(data, n);
+                mStoredBlockSize -= n;
+                curSize -= n;
             }
             mNeedReadTable = (mStoredBlockSize == 0);
             continue;
         }
         while (curSize > 0) {
+            if (canDecodeFast(curSize)) {
+                if (decodeFast<Traits>(curSize)) {
+                    mNeedReadTable = true;
+                    break;
+                }
+                if (curSize == 0)
+                    break;
+            }
+
             quint32 symbol = mMainDecoder.decodeSymbol(mBitStream);
 
             if (symbol < SymbolEndOfBlock) {
@@ -190,17 +296,7 @@ void DeflateDecoderST::codeChunk(quint32 curSize)
                 quint32 len;
                 {
                     quint32 number = symbol - SymbolMatch;
-                    int numBits;
-                    if (mType == Deflate64) {
-                        len = LenStart64[number];
-                        numBits = LenDirectBits64[number];
-                    } else {
-                        len = LenStart32[number];
-                        numBits = LenDirectBits32[number];
-                    }
-                    quint32 val;
-                    val = readBits(numBits);
-                    len += val;
+                    len = Traits::lenStart(number) + readBits(Traits::lenDirectBits(number));
                 }
 
                 quint32 locLen = len;
@@ -234,9 +330,31 @@ void DeflateDecoderST::codeChunk(quint32 curSize)
     return;
 }
 
-bool DeflateDecoderST::stream(ReadStream *sourceStream, WriteStream *destinationStream)
+void DeflateDecoderST::addCheckpoint()
+{
+    const quint64 outPos = mOutBuffer.position() - mOutStart;
+    if (outPos < mNextCheckpoint)
+        return;
+
+    DeflateCheckpoint checkpoint;
+    checkpoint.uncompressedOffset = mOutBase + outPos;
+    checkpoint.compressedBitOffset = mBitBase + mBitStream.position();
+
+    const uint windowSize = uint(qMin(checkpoint.uncompressedOffset, quint64(mOutBuffer.historySize())));
+    checkpoint.window.resize(windowSize);
+    mOutBuffer.copyHistory(reinterpret_cast<quint8 *>(checkpoint.window.data()), windowSize);
+
+    mCheckpoints.append(checkpoint);
+    mNextCheckpoint = outPos + mCheckpointInterval;
+}
+
+template <class Traits>
+bool DeflateDecoderST::decodeStream(ReadStream *sourceStream, WriteStream *destinationStream)
 {
     mInterrupted = 0;
+    mCheckpoints.clear();
+    mOutBase = mResume ? mResumePoint.uncompressedOffset : 0;
+    mBitBase = mResume ? mResumePoint.compressedBitOffset & ~Q_UINT64_C(7) : 0;
     mBitStream.setBackingStream(sourceStream);
     mOutBuffer.setBackingStream(destinationStream);
 
@@ -257,7 +375,7 @@ bool DeflateDecoderST::stream(ReadStream *sourceStream, WriteStream *destination
             break;
 
         // actually do the decompression
-        codeChunk(curSize);
+        codeChunk<Traits>(curSize);
 
         if (mRemainLen == LenIdFinished)
             break;
@@ -270,6 +388,18 @@ bool DeflateDecoderST::stream(ReadStream *sourceStream, WriteStream *destination
     return true;
 }
 
+bool DeflateDecoderST::stream(ReadStream *sourceStream, WriteStream *destinationStream)
+{
+    switch (mType) {
+    case Deflate64:
+        return decodeStream<DeflateTraits<Deflate64> >(sourceStream, destinationStream);
+    case DeflateNSIS:
+        return decodeStream<DeflateTraits<DeflateNSIS> >(sourceStream, destinationStream);
+    default:
+        return decodeStream<DeflateTraits<BasicDeflate> >(sourceStream, destinationStream);
+    }
+}
+
 void DeflateDecoderST::interrupt()
 {
     mInterrupted = 1;
@@ -4,10 +4,12 @@
 #include "qz7/BitIoLE.h"
 #include "qz7/RingBuffer.h"
 
-#include "qz7/codec/HuffmanDecoder.h"
+#include "qz7/codec/DeflateCheckpoint.h"
 
 #include "DeflateDecoder.h"
 #include "DeflateConst.h"
+#include "DeflateFixedTables_p.h"
+#include "DeflateTraits_p.h"
 
 #include <QtCore/QObject>
 
@@ -22,9 +24,19 @@ public:
 
     void setKeepHistory(bool keepHistory) { mKeepHistory = keepHistory; }
     void setBytesExpected(quint64 size) { mBytesExpected = size; }
+    void setAnalyzer(Analyzer *analyzer) { mOutBuffer.setAnalyzer(analyzer); }
+
+    // record a checkpoint at the first block boundary after every interval
+    // bytes of output (0 for none)
+    void setCheckpointInterval(quint64 interval) { mCheckpointInterval = interval; }
+    const DeflateCheckpointList& checkpoints() const { return mCheckpoints; }
+    // make the next stream() start at checkpoint
+    void setResumePoint(const DeflateCheckpoint& checkpoint) { mResumePoint = checkpoint; mResume = true; }
 
     bool stream(ReadStream *from, WriteStream *to);
     void interrupt();
+    // how far into the input the last stream() got
+    quint64 bitsConsumed() const { return mBitStream.position(); }
 
 signals:
     void progress(quint64 bytesIn, quint64 bytesOut);
@@ -32,20 +44,34 @@ signals:
 private:
     quint32 readBits(int numBits);
     void decodeLevelTable(quint8 *values, int numSymbols);
-    void readTables();
-    void codeChunk(quint32 curSize);
+    bool canDecodeFast(quint32 curSize) const;
+    void addCheckpoint();
+
+    // instantiated for each DeflateType's traits; stream() picks one
+    template <class Traits> bool decodeStream(ReadStream *from, WriteStream *to);
+    template <class Traits> void readTables();
+    template <class Traits> bool decodeFast(quint32& curSize);
+    template <class Traits> void codeChunk(quint32 curSize);
 
     RingBuffer mOutBuffer;
     BitReaderLE mBitStream;
     DeflateType mType;
 
-    HuffmanDecoder<NumHuffmanBits, FixedMainTableSize> mMainDecoder;
-    HuffmanDecoder<NumHuffmanBits, FixedDistTableSize> mDistDecoder;
-    HuffmanDecoder<NumHuffmanBits, LevelTableSize> mLevelDecoder;
+    MainHuffmanDecoder mMainDecoder;
+    DistHuffmanDecoder mDistDecoder;
+    LevelHuffmanDecoder mLevelDecoder;
 
     quint64 mBytesExpected;
     int mInterrupted;
 
+    quint64 mCheckpointInterval;
+    quint64 mNextCheckpoint;
+    quint64 mOutStart;
+    quint64 mOutBase;
+    quint64 mBitBase;
+    DeflateCheckpointList mCheckpoints;
+    DeflateCheckpoint mResumePoint;
+
     quint32 mStoredBlockSize;
     quint32 mNumDistLevels;
     qint32 mRemainLen;
@@ -55,6 +81,8 @@ private:
     uint mNeedReadTable : 1;
     uint mIsFinalBlock : 1;
     uint mStoredMode : 1;
+    uint mFixedTables : 1;
+    uint mResume : 1;
 };
 
 }
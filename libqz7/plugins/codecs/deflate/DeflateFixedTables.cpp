@@ -0,0 +1,23 @@
+#include "DeflateFixedTables_p.h"
+
+namespace qz7 {
+namespace deflate {
+
+const FixedHuffmanTables FixedHuffmanTables::s_instance;
+
+FixedHuffmanTables::FixedHuffmanTables()
+{
+    Levels levels;
+    levels.setFixedLevels();
+
+    mainDecoder.setCodeLengths(levels.litLenLevels);
+    distDecoder.setCodeLengths(levels.distLevels);
+}
+
+const FixedHuffmanTables& FixedHuffmanTables::instance()
+{
+    return s_instance;
+}
+
+}
+}
@@ -0,0 +1,36 @@
+#ifndef QZ7_DEFLATEFIXEDTABLES_H
+#define QZ7_DEFLATEFIXEDTABLES_H
+
+#include "qz7/codec/HuffmanDecoder.h"
+
+#include "DeflateConst.h"
+
+namespace qz7 {
+namespace deflate {
+
+typedef HuffmanDecoder<NumHuffmanBits, FixedMainTableSize, HuffmanDecodeReversedTable, MainDecodeTableBits> MainHuffmanDecoder;
+typedef HuffmanDecoder<NumHuffmanBits, FixedDistTableSize, HuffmanDecodeReversedTable, DistDecodeTableBits> DistHuffmanDecoder;
+typedef HuffmanDecoder<NumLevelBits, LevelTableSize, HuffmanDecodeReversedTable, LevelDecodeTableBits> LevelHuffmanDecoder;
+
+// The decoding tables for the fixed Huffman code of RFC 1951. The code is
+// the same for deflate and deflate64 (only the number of distance codes in
+// use differs, which the decoders check themselves), so one set is built
+// when the library is loaded and every decoder copies it in for a fixed
+// block instead of rebuilding it.
+class FixedHuffmanTables {
+public:
+    static const FixedHuffmanTables& instance();
+
+    MainHuffmanDecoder mainDecoder;
+    DistHuffmanDecoder distDecoder;
+
+private:
+    FixedHuffmanTables();
+
+    static const FixedHuffmanTables s_instance;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef QZ7_DEFLATETRAITS_P_H
+#define QZ7_DEFLATETRAITS_P_H
+
+#include "DeflateDecoder.h"
+#include "DeflateConst.h"
+
+namespace qz7 {
+namespace deflate {
+
+// What sets the deflate variants apart, as compile-time constants: the
+// decoders instantiate their decoding loops once per DeflateType, so that
+// nothing in them branches on the type.
+template <DeflateType Type> struct DeflateTraits
+{
+    enum { HistorySize = HistorySize32 };
+    // of distance codes: all of them are in use in a fixed block, and no
+    // dynamic block may declare more
+    enum { DistTableSize = DistTableSize32 };
+    // whether a stored block's length is followed by its one's complement
+    enum { StoredLengthCheck = true };
+    // whether matches can be longer than MatchMaxLen32 (whose length then
+    // takes up to 16 extra bits)
+    enum { LongMatches = false };
+
+    static quint32 lenStart(quint32 number) { return LenStart32[number]; }
+    static int lenDirectBits(quint32 number) { return LenDirectBits32[number]; }
+};
+
+template <> struct DeflateTraits<Deflate64>
+{
+    enum { HistorySize = HistorySize64 };
+    enum { DistTableSize = DistTableSize64 };
+    enum { StoredLengthCheck = true };
+    enum { LongMatches = true };
+
+    static quint32 lenStart(quint32 number) { return LenStart64[number]; }
+    static int lenDirectBits(quint32 number) { return LenDirectBits64[number]; }
+};
+
+// NSIS leaves out the complement of the stored length, but is otherwise
+// plain deflate
+template <> struct DeflateTraits<DeflateNSIS> : DeflateTraits<BasicDeflate>
+{
+    enum { StoredLengthCheck = false };
+};
+
+}
+}
+
+#endif
@@ -1,7 +1,9 @@
 #include "SingleFileVolume.h"
 #include "qz7/Stream.h"
+#include "qz7/UringStream.h"
 
 #include <QtCore/QFile>
+#include <QtCore/QFileInfo>
 
 namespace qz7 {
 
@@ -18,6 +20,18 @@ SeekableReadStream * SingleFileVolume::openFile(uint n)
     QFile *file = new QFile(mFile, this);
 
     if (file->open(QIODevice::ReadOnly)) {
+        // QZ7_IO_URING=true has the kernel read ahead of the decoder, into a
+        // ring this stream sets up for itself
+        if (QFileInfo(mFile).isFile() && qgetenv("QZ7_IO_URING") == "true")
+            return new UringFileReadStream(file);
+
+        // regular files are read from a mapping where they can be mapped
+        if (QFileInfo(mFile).isFile() && qgetenv("QZ7_NO_MMAP") != "true") {
+            MappedFileReadStream *stream = new MappedFileReadStream(file);
+            if (stream->isMapped())
+                return stream;
+            delete stream;
+        }
         return new QioSeekableReadStream(file);
     }
 
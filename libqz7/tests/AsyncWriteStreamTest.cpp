@@ -0,0 +1,178 @@
+#include <QtTest/QtTest>
+#include <QtCore/QBuffer>
+#include <QtCore/QThread>
+
+#include "qz7/AsyncWriteStream.h"
+#include "qz7/Stream.h"
+
+using namespace qz7;
+
+// a target that can be made slow, or to fail after a number of bytes
+class TestTarget : public WriteStream {
+public:
+    TestTarget() : mFailAfter(-1), mDelay(0), mFlushes(0) { }
+
+    using WriteStream::write;
+
+    virtual bool write(const quint8 *buffer, int bytes)
+    {
+        if (mDelay)
+            QThread::usleep(mDelay);
+        if (mFailAfter >= 0 && mData.size() + bytes > mFailAfter)
+            return false;
+        mData.append(reinterpret_cast<const char *>(buffer), bytes);
+        return true;
+    }
+    virtual void flush() { mFlushes++; }
+    virtual qint64 bytesWritten() const { return mData.size(); }
+    virtual QString errorString() const { return QString("target failed"); }
+
+    QByteArray mData;
+    int mFailAfter;
+    int mDelay;
+    int mFlushes;
+};
+
+class AsyncWriteStreamTester : public QObject {
+    Q_OBJECT
+
+private slots:
+    void testOrder();
+    void testAcquireCommit();
+    void testBytesWritten();
+    void testErrorAtWrite();
+    void testErrorAtFlush();
+    void testDestroyWhileQueued();
+};
+
+static QByteArray pattern(int size, int seed)
+{
+    QByteArray ret(size, 0);
+    for (int i = 0; i < size; i++)
+        ret[i] = char((i * 7 + seed) ^ (i >> 8));
+    return ret;
+}
+
+// writes of all sizes, smaller and larger than a buffer, come out in order
+void AsyncWriteStreamTester::testOrder()
+{
+    TestTarget target;
+    QByteArray expected;
+    {
+        AsyncWriteStream aws(&target, 4096, 3);
+        for (int i = 0; i < 200; i++) {
+            const QByteArray data = pattern((i * 397) % 10000 + 1, i);
+            QVERIFY(aws.write(reinterpret_cast<const quint8 *>(data.constData()), data.size()));
+            expected += data;
+        }
+        aws.flush();
+        QVERIFY(!aws.hasError());
+        QCOMPARE(target.mData.size(), expected.size());
+        QVERIFY(target.mData == expected);
+        QVERIFY(target.mFlushes > 0);
+    }
+}
+
+void AsyncWriteStreamTester::testAcquireCommit()
+{
+    TestTarget target;
+    QByteArray expected;
+    {
+        AsyncWriteStream aws(&target, 4096, 2);
+        for (int i = 0; i < 100; i++) {
+            // some of them larger than a buffer, and committing less
+            const int size = (i % 10 == 9) ? 5000 : 100 + i * 13;
+            const QByteArray data = pattern(size, i);
+            quint8 *room = aws.acquireBuffer(size + 10);
+            QVERIFY(room);
+            ::memcpy(room, data.constData(), size);
+            QVERIFY(aws.commit(size));
+            expected += data;
+
+            const QByteArray more = pattern(i + 1, -i);
+            QVERIFY(aws.write(reinterpret_cast<const quint8 *>(more.constData()), more.size()));
+            expected += more;
+        }
+        aws.flush();
+    }
+    QVERIFY(target.mData == expected);
+}
+
+// counts what was accepted, whether or not it has reached the target
+void AsyncWriteStreamTester::testBytesWritten()
+{
+    TestTarget target;
+    target.mDelay = 1000;
+
+    AsyncWriteStream aws(&target, 4096, 2);
+    const QByteArray data = pattern(3000, 1);
+    qint64 total = 0;
+    for (int i = 0; i < 10; i++) {
+        QVERIFY(aws.write(reinterpret_cast<const quint8 *>(data.constData()), data.size()));
+        total += data.size();
+        QCOMPARE(aws.bytesWritten(), total);
+    }
+
+    aws.flush();
+    QCOMPARE(aws.bytesWritten(), total);
+    QCOMPARE(target.bytesWritten(), total);
+}
+
+// the target fails in the thread; the writer hears of it on a later write()
+void AsyncWriteStreamTester::testErrorAtWrite()
+{
+    TestTarget target;
+    target.mFailAfter = 10000;
+
+    AsyncWriteStream aws(&target, 4096, 2);
+    const QByteArray data = pattern(1000, 2);
+    bool failed = false;
+    for (int i = 0; i < 100 && !failed; i++)
+        failed = !aws.write(reinterpret_cast<const quint8 *>(data.constData()), data.size());
+    QVERIFY(failed);
+    QVERIFY(aws.hasError());
+    QCOMPARE(aws.errorString(), QString("target failed"));
+
+    // and it stays failed
+    QVERIFY(!aws.write(reinterpret_cast<const quint8 *>(data.constData()), data.size()));
+    QVERIFY(target.mData.size() <= 10000);
+}
+
+// a failure on the last buffer only shows after flush()
+void AsyncWriteStreamTester::testErrorAtFlush()
+{
+    TestTarget target;
+    target.mFailAfter = 0;
+
+    AsyncWriteStream aws(&target, 4096, 2);
+    const QByteArray data = pattern(100, 3);
+    QVERIFY(aws.write(reinterpret_cast<const quint8 *>(data.constData()), data.size()));
+    QVERIFY(!aws.hasError());
+
+    aws.flush();
+    QVERIFY(aws.hasError());
+    QCOMPARE(aws.errorString(), QString("target failed"));
+    QVERIFY(target.mData.isEmpty());
+}
+
+// whatever is still queued is written out before the stream goes away
+void AsyncWriteStreamTester::testDestroyWhileQueued()
+{
+    TestTarget target;
+    target.mDelay = 2000;
+    QByteArray expected;
+    {
+        AsyncWriteStream aws(&target, 4096, 4);
+        for (int i = 0; i < 5; i++) {
+            const QByteArray data = pattern(4096 + 100, i);
+            QVERIFY(aws.write(reinterpret_cast<const quint8 *>(data.constData()), data.size()));
+            expected += data;
+        }
+    }
+    QCOMPARE(target.mData.size(), expected.size());
+    QVERIFY(target.mData == expected);
+}
+
+QTEST_MAIN(AsyncWriteStreamTester)
+
+#include "AsyncWriteStreamTest.moc"
@@ -9,6 +9,7 @@
 
 #include <time.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "qz7/BitIoBE.h"
@@ -33,6 +34,7 @@ private slots:
     void readLE_data();
     void readLE();
     void readBigLE();
+    void readAlignedLE();
     void readExceptionLE();
     void readReversedLE_data();
     void readReversedLE();
@@ -161,6 +163,47 @@ void BitIoTester::readBigLE()
     }
 }
 
+void BitIoTester::readAlignedLE()
+{
+    QByteArray a1;
+    for (int i = 0; i < 20000; i++)
+        a1 += char(i * 7);
+
+    QBuffer b1(&a1);
+    b1.open(QIODevice::ReadOnly);
+    QioReadStream rs(&b1);
+    BitReaderLE r1(&rs);
+
+    // bytes lent in pieces of all sizes, in between reads through the bit
+    // buffer
+    int pos = 0;
+    uint chunk = 1;
+    while (pos < a1.size() - 2) {
+        QCOMPARE(r1.readBits(3), uint(quint8(a1[pos]) & 7));
+        r1.alignToByte();
+        pos++;
+
+        // leaving a byte to read after them
+        chunk = qMin(chunk, uint(a1.size() - pos - 1));
+        uint n;
+        const quint8 *data = r1.readAlignedBytes(chunk, &n);
+        QVERIFY(n > 0 && n <= chunk);
+        QVERIFY(!memcmp(data, a1.constData() + pos, n));
+        pos += n;
+        QCOMPARE(r1.position(), quint64(pos) * 8);
+
+        QCOMPARE(r1.readBits(8), uint(quint8(a1[pos])));
+        pos++;
+        chunk = chunk * 3 % 1021;
+    }
+
+    uint n;
+    while (r1.readAlignedBytes(4096, &n))
+        pos += n;
+    QCOMPARE(pos, a1.size());
+    QCOMPARE(n, 0u);
+}
+
 void BitIoTester::readReversedLE_data()
 {
     if (mBuffer.isOpen())
@@ -0,0 +1,141 @@
+#include <QtTest/QtTest>
+#include <QtCore/QByteArray>
+
+#include "qz7/Crc.h"
+
+#include "DeflateWriter.h"
+
+using namespace qz7;
+
+class CrcTester : public QObject {
+    Q_OBJECT
+
+private slots:
+    void testVectors();
+    void testTables();
+    void testLengths();
+    void testPieces();
+    void testCombine();
+};
+
+static QByteArray randomData(int size, quint32 seed)
+{
+    TestRandom random(seed);
+    QByteArray ret(size, 0);
+    for (int i = 0; i < size; ++i)
+        ret[i] = char(random.next());
+    return ret;
+}
+
+static quint32 crc32(const QByteArray& data)
+{
+    return CrcValue(CrcUpdate(CrcInitValue(), data.constData(), data.size()));
+}
+
+template <typename T> static typename T::Value templateCrc(const QByteArray& data)
+{
+    T crc;
+    crc.update(data.constData(), data.size());
+    return crc.value();
+}
+
+// the check values of the CRC catalogue, over "123456789"
+void CrcTester::testVectors()
+{
+    const QByteArray check("123456789");
+    QCOMPARE(crc32(check), quint32(0xCBF43926));
+    QCOMPARE(templateCrc<Crc32>(check), quint32(0xCBF43926));
+    QCOMPARE(templateCrc<Crc32BZip2>(check), quint32(0xFC891918));
+    QCOMPARE(templateCrc<Crc64>(check), Q_UINT64_C(0x995DC9BBDF1939FA));
+
+    QCOMPARE(crc32(QByteArray()), quint32(0));
+    QCOMPARE(crc32(QByteArray("The quick brown fox jumps over the lazy dog")), quint32(0x414FA339));
+}
+
+// the tables the compiler built are those of the polynomials
+template <typename T, T Poly, bool Reflected> static bool tableIsRight()
+{
+    for (uint i = 0; i < 256; ++i) {
+        T c;
+        if (Reflected) {
+            c = T(i);
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? T((c >> 1) ^ Poly) : T(c >> 1);
+        } else {
+            c = T(T(i) << (sizeof(T) * 8 - 8));
+            for (int k = 0; k < 8; ++k)
+                c = ((c >> (sizeof(T) * 8 - 1)) & 1) ? T((c << 1) ^ Poly) : T(c << 1);
+        }
+        if (Crc<T, Poly, Reflected>::table[i] != c)
+            return false;
+    }
+    return true;
+}
+
+void CrcTester::testTables()
+{
+    QVERIFY((tableIsRight<quint32, 0xEDB88320U, true>()));
+    QVERIFY((tableIsRight<quint32, 0x04C11DB7U, false>()));
+    QVERIFY((tableIsRight<quint64, Q_UINT64_C(0xC96C5795D7870F42), true>()));
+}
+
+// every length around the 16-byte slices and the 64-byte folds, at every
+// alignment
+void CrcTester::testLengths()
+{
+    const QByteArray data = randomData(70000, 1);
+    for (int offset = 0; offset < 16; ++offset) {
+        for (int length = 0; length < 300; ++length) {
+            const QByteArray piece = data.mid(offset, length);
+            if (crc32(piece) != referenceCrc32(piece))
+                QFAIL(qPrintable(QString("offset %1, length %2").arg(offset).arg(length)));
+        }
+    }
+    const int lengths[] = { 1023, 1024, 1025, 4096 + 63, 65536, 69000 };
+    for (uint i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i) {
+        const QByteArray piece = data.mid(3, lengths[i]);
+        QCOMPARE(crc32(piece), referenceCrc32(piece));
+    }
+}
+
+// the same data in pieces too short to be folded (so through the slicing
+// tables only) and in pieces that are, come to the same CRC
+void CrcTester::testPieces()
+{
+    const QByteArray data = randomData(100000, 2);
+    const quint32 expected = referenceCrc32(data);
+    const int sizes[] = { 1, 15, 63, 64, 100, 4097 };
+    for (uint i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        quint32 crc = CrcInitValue();
+        for (int pos = 0; pos < data.size(); pos += sizes[i])
+            crc = CrcUpdate(crc, data.constData() + pos, qMin(sizes[i], data.size() - pos));
+        QCOMPARE(CrcValue(crc), expected);
+    }
+
+    Crc32 crc;
+    for (int pos = 0; pos < data.size(); pos += 63)
+        crc.update(data.constData() + pos, qMin(63, data.size() - pos));
+    QCOMPARE(crc.value(), expected);
+}
+
+void CrcTester::testCombine()
+{
+    const QByteArray data = randomData(300000, 3);
+    const quint32 whole = crc32(data);
+    const int splits[] = { 0, 1, 7, 64, 1000, 65536, 299999, 300000 };
+    for (uint i = 0; i < sizeof(splits) / sizeof(splits[0]); ++i) {
+        const QByteArray a = data.left(splits[i]);
+        const QByteArray b = data.mid(splits[i]);
+        QCOMPARE(CrcCombine(crc32(a), crc32(b), quint64(b.size())), whole);
+    }
+
+    // three pieces, combined either way round
+    const quint32 a = crc32(data.left(1000)), b = crc32(data.mid(1000, 5000)), c = crc32(data.mid(6000));
+    const quint64 lb = 5000, lc = data.size() - 6000;
+    QCOMPARE(CrcCombine(CrcCombine(a, b, lb), c, lc), whole);
+    QCOMPARE(CrcCombine(a, CrcCombine(b, c, lc), lb + lc), whole);
+}
+
+QTEST_MAIN(CrcTester)
+
+#include "CrcTest.moc"
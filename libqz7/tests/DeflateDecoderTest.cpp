@@ -0,0 +1,115 @@
+#include <QtTest/QtTest>
+#include <QtCore/QBuffer>
+
+#include "qz7/Codec.h"
+#include "qz7/Plugin.h"
+#include "qz7/Stream.h"
+
+#include "DeflateWriter.h"
+
+using namespace qz7;
+
+// What sets Deflate64 apart from deflate, through the single-threaded
+// decoder (threadCount 1), the one that decodes and writes on separate
+// threads (2) and, for plain deflate, the chunk-parallel one (4).
+class DeflateDecoderTester : public QObject {
+    Q_OBJECT
+
+private slots:
+    void testLongMatches_data();
+    void testLongMatches();
+    void testDistanceCodeCount_data();
+    void testDistanceCodeCount();
+
+private:
+    void threadCounts();
+    static QByteArray decode(const QString& codecName, const QByteArray& compressed, int threadCount);
+};
+
+void DeflateDecoderTester::threadCounts()
+{
+    QTest::addColumn<int>("threadCount");
+
+    QTest::newRow("single-threaded") << 1;
+    QTest::newRow("two threads") << 2;
+    QTest::newRow("parallel") << 4;
+}
+
+QByteArray DeflateDecoderTester::decode(const QString& codecName, const QByteArray& compressed, int threadCount)
+{
+    Codec *codec = Registry::createDecoder(codecName, 0);
+    if (!codec)
+        return QByteArray();
+    codec->setProperty("threadCount", threadCount);
+
+    QByteArray input = compressed;
+    QBuffer inBuffer(&input);
+    inBuffer.open(QIODevice::ReadOnly);
+    QioReadStream in(&inBuffer);
+
+    QByteArray output;
+    QBuffer outBuffer(&output);
+    outBuffer.open(QIODevice::WriteOnly);
+    QioWriteStream out(&outBuffer);
+
+    const bool ok = codec->stream(&in, &out);
+    delete codec;
+    return ok ? output : QByteArray("failed");
+}
+
+void DeflateDecoderTester::testLongMatches_data() { threadCounts(); }
+
+// Length symbol 285 is 3 plus 16 extra bits in Deflate64 (where deflate has
+// it as 258 without any); these decoded 3 bytes short, and the shortest
+// one, to nothing at all. Distances past 32 KB come along with them.
+void DeflateDecoderTester::testLongMatches()
+{
+    QFETCH(int, threadCount);
+
+    TestRandom random(1);
+    DeflateWriter w(true);
+    w.beginBlock(false);
+    for (int i = 0; i < 70000; ++i)
+        w.literal(quint8(random.next()));
+    const int lengths[] = { 258, 259, 1000, 65538, 300, 3000 };
+    const int distances[] = { 1, 7, 32768, 32769, 65536, 50000 };
+    for (uint i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i) {
+        w.match(lengths[i], distances[i]);
+        w.literal(quint8(i));
+    }
+    w.endBlock();
+
+    // and 285 with nothing added: a length of 3
+    w.beginBlock(false);
+    w.literals("abc");
+    w.match(3, 3, true);
+    w.match(4, 1, true);
+    w.endBlock();
+    w.finish();
+
+    QCOMPARE(w.output().right(10), QByteArray("abcabccccc"));
+    const QByteArray out = decode("deflate64", w.data(), threadCount);
+    QCOMPARE(out.size(), w.output().size());
+    QVERIFY(out == w.output());
+}
+
+void DeflateDecoderTester::testDistanceCodeCount_data() { threadCounts(); }
+
+// a dynamic block may declare all 32 distance codes in Deflate64, but no
+// more than 30 in deflate
+void DeflateDecoderTester::testDistanceCodeCount()
+{
+    QFETCH(int, threadCount);
+
+    DeflateWriter w(true);
+    w.beginBlock(true);
+    w.literals("the block header has 32 distance codes");
+    w.endBlock();
+
+    QVERIFY(decode("deflate64", w.data(), threadCount) == w.output());
+    QVERIFY(decode("deflate", w.data(), threadCount) == "failed");
+}
+
+QTEST_MAIN(DeflateDecoderTester)
+
+#include "DeflateDecoderTest.moc"
@@ -0,0 +1,193 @@
+#include <QtTest/QtTest>
+#include <QtCore/QBuffer>
+
+#include "qz7/Codec.h"
+#include "qz7/Plugin.h"
+#include "qz7/Stream.h"
+
+#include "DeflateWriter.h"
+
+using namespace qz7;
+
+// The chunk-parallel decoder (threadCount > 2) against the single-threaded
+// one. Its workers get 1 MB chunks of the input; these streams are made to
+// trip it up at the boundaries.
+class DeflateParallelTester : public QObject {
+    Q_OBJECT
+
+private slots:
+    void testDecode_data();
+    void testDecode();
+    void testBytesExpected();
+
+private:
+    static QByteArray decode(const QByteArray& compressed, int threadCount, quint64 bytesExpected = 0);
+};
+
+static const int ChunkSize = 1 << 20;
+
+// random literals and matches, with distances anywhere in the window
+static void randomSymbols(DeflateWriter *w, TestRandom *random, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        if (w->output().size() < 16 || random->bounded(10) < 7)
+            w->literal(quint8(random->next()));
+        else
+            w->match(3 + random->bounded(16), 1 + random->bounded(qMin(w->output().size(), 32768)));
+    }
+}
+
+// dynamic blocks of 300000 symbols, most of them straddling a chunk boundary
+static void splitBlocks(DeflateWriter *w)
+{
+    TestRandom random(1);
+    while (w->bitPos() < quint64(3 * ChunkSize + ChunkSize / 2) * 8) {
+        w->beginBlock(false);
+        randomSymbols(w, &random, 300000);
+        w->endBlock();
+    }
+    w->finish();
+}
+
+// stored blocks between the Huffman ones, so that some chunks start inside
+// a stored block and some stored blocks are split
+static void storedBlocks(DeflateWriter *w)
+{
+    TestRandom random(2);
+    while (w->bitPos() < quint64(3 * ChunkSize + ChunkSize / 2) * 8) {
+        w->beginBlock(false);
+        randomSymbols(w, &random, 20000 + random.bounded(20000));
+        w->endBlock();
+
+        const int stored = 1 + random.bounded(3);
+        for (int i = 0; i < stored; ++i) {
+            QByteArray bytes(1 + random.bounded(0xffff), 0);
+            for (int j = 0; j < bytes.size(); ++j)
+                bytes[j] = char(random.next());
+            w->storedBlock(bytes, false);
+        }
+    }
+    w->finish();
+}
+
+// after each chunk boundary, a stretch of matches reaching as far back
+// as they can: the worker only has markers for these
+static void windowReferences(DeflateWriter *w)
+{
+    TestRandom random(3);
+    for (int chunk = 1; chunk <= 3; ++chunk) {
+        w->beginBlock(false);
+        while (w->bitPos() < quint64(chunk * ChunkSize) * 8)
+            randomSymbols(w, &random, 1000);
+        w->endBlock();
+
+        w->beginBlock(false);
+        for (int i = 0; i < 20000; ++i)
+            w->match(3 + random.bounded(256), 32768 - random.bounded(1024));
+        randomSymbols(w, &random, 20000);
+        w->endBlock();
+    }
+    w->finish();
+}
+
+// a stored block at the start of each chunk holds a final dynamic block of
+// its own: the worker decodes it without error, but it isn't part of the
+// stream, so the chunk has to be decoded here
+static void wrongGuesses(DeflateWriter *w)
+{
+    TestRandom random(4);
+
+    DeflateWriter fake;
+    fake.beginBlock(true);
+    fake.literals("not part of the output");
+    fake.endBlock();
+    const QByteArray fakeData = QByteArray(100, 0) + fake.data();
+
+    for (int chunk = 1; chunk <= 3; ++chunk) {
+        w->beginBlock(false);
+        while (w->bitPos() < quint64(chunk * ChunkSize - 50) * 8)
+            randomSymbols(w, &random, 100);
+        w->endBlock();
+        w->storedBlock(fakeData, false);
+        w->beginBlock(false);
+        randomSymbols(w, &random, 1000);
+        w->endBlock();
+    }
+    w->finish();
+}
+
+void DeflateParallelTester::testDecode_data()
+{
+    QTest::addColumn<QByteArray>("compressed");
+    QTest::addColumn<QByteArray>("expected");
+
+    DeflateWriter w1;
+    splitBlocks(&w1);
+    QTest::newRow("blocks split between chunks") << w1.data() << w1.output();
+
+    DeflateWriter w2;
+    storedBlocks(&w2);
+    QTest::newRow("stored blocks") << w2.data() << w2.output();
+
+    DeflateWriter w3;
+    windowReferences(&w3);
+    QTest::newRow("references into the unknown window") << w3.data() << w3.output();
+
+    DeflateWriter w4;
+    wrongGuesses(&w4);
+    QTest::newRow("wrong guesses") << w4.data() << w4.output();
+}
+
+QByteArray DeflateParallelTester::decode(const QByteArray& compressed, int threadCount, quint64 bytesExpected)
+{
+    Codec *codec = Registry::createDecoder("deflate", 0);
+    if (!codec)
+        return QByteArray();
+    codec->setProperty("threadCount", threadCount);
+    codec->setProperty("bytesExpected", bytesExpected);
+
+    QByteArray input = compressed;
+    QBuffer inBuffer(&input);
+    inBuffer.open(QIODevice::ReadOnly);
+    QioReadStream in(&inBuffer);
+
+    QByteArray output;
+    QBuffer outBuffer(&output);
+    outBuffer.open(QIODevice::WriteOnly);
+    QioWriteStream out(&outBuffer);
+
+    const bool ok = codec->stream(&in, &out);
+    delete codec;
+    return ok ? output : QByteArray("failed");
+}
+
+void DeflateParallelTester::testDecode()
+{
+    QFETCH(QByteArray, compressed);
+    QFETCH(QByteArray, expected);
+
+    QVERIFY(compressed.size() > 3 * ChunkSize);
+
+    const QByteArray st = decode(compressed, 1);
+    QVERIFY(st == expected);
+
+    const QByteArray par = decode(compressed, 4);
+    QCOMPARE(par.size(), st.size());
+    QVERIFY(par == st);
+}
+
+// stopping in the middle of a chunk
+void DeflateParallelTester::testBytesExpected()
+{
+    DeflateWriter w;
+    splitBlocks(&w);
+    const quint64 expected = w.output().size() / 2 + 12345;
+
+    const QByteArray par = decode(w.data(), 4, expected);
+    QCOMPARE(quint64(par.size()), expected);
+    QVERIFY(par == w.output().left(int(expected)));
+}
+
+QTEST_MAIN(DeflateParallelTester)
+
+#include "DeflateParallelTest.moc"
@@ -0,0 +1,242 @@
+#ifndef QZ7_TESTS_DEFLATEWRITER_H
+#define QZ7_TESTS_DEFLATEWRITER_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QtGlobal>
+
+// DeflateWriter puts together deflate streams with exactly the blocks a test
+// asks for, keeping the output they decode to alongside. Huffman blocks are
+// dynamic ones with the same (valid, complete) tables every time: literals
+// 0-225 take 8 bits, the other symbols 9, distances 4 or 5 bits.
+class DeflateWriter {
+public:
+    DeflateWriter(bool deflate64 = false)
+        : mDeflate64(deflate64), mBitBuf(0), mBitCount(0)
+    {
+        for (int i = 0; i < 286; ++i)
+            mMainLengths[i] = (i < 226) ? 8 : 9;
+        for (int i = 0; i < 32; ++i)
+            mDistLengths[i] = (deflate64 || i >= 2) ? 5 : 4;
+        assignCodes(mMainLengths, mMainCodes, 286);
+        assignCodes(mDistLengths, mDistCodes, distCount());
+    }
+
+    // the compressed stream so far, padded to a whole byte
+    QByteArray data() const
+    {
+        QByteArray ret = mData;
+        if (mBitCount)
+            ret += char(mBitBuf);
+        return ret;
+    }
+    // what it decodes to
+    const QByteArray& output() const { return mOutput; }
+    quint64 bitPos() const { return quint64(mData.size()) * 8 + mBitCount; }
+
+    void beginBlock(bool final)
+    {
+        writeBits(final, 1);
+        writeBits(2, 2);
+        writeBits(286 - 257, 5);
+        writeBits(distCount() - 1, 5);
+
+        // the code length code: 4, 5, 8 and 9 take two bits each, and
+        // come 12th, 10th, 5th and 7th
+        static const int order[12] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4 };
+        writeBits(12 - 4, 4);
+        for (int i = 0; i < 12; ++i)
+            writeBits((order[i] == 4 || order[i] == 5 || order[i] == 8 || order[i] == 9) ? 2 : 0, 3);
+        for (int i = 0; i < 286; ++i)
+            writeLevel(mMainLengths[i]);
+        for (int i = 0; i < distCount(); ++i)
+            writeLevel(mDistLengths[i]);
+    }
+
+    void literal(quint8 byte)
+    {
+        writeCode(mMainCodes[byte], mMainLengths[byte]);
+        mOutput += char(byte);
+    }
+
+    void literals(const QByteArray& bytes)
+    {
+        for (int i = 0; i < bytes.size(); ++i)
+            literal(quint8(bytes.at(i)));
+    }
+
+    // in Deflate64, length symbol 285 is followed by 16 bits of length - 3;
+    // it's used for lengths from 258, or for any with longCode
+    void match(int length, int distance, bool longCode = false)
+    {
+        Q_ASSERT(distance >= 1 && distance <= mOutput.size());
+        static const int lenBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+            35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+        static const int lenExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+            3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+        static const int distBase[32] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+            257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+            32769, 49153 };
+        static const int distExtra[32] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+            7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13, 14, 14 };
+
+        if (mDeflate64 && (length > 257 || longCode)) {
+            writeCode(mMainCodes[285], mMainLengths[285]);
+            writeBits(length - 3, 16);
+        } else {
+            Q_ASSERT(length >= 3 && length <= 258);
+            int l = 28;
+            while (lenBase[l] > length || (mDeflate64 && l == 28))
+                --l;
+            writeCode(mMainCodes[257 + l], mMainLengths[257 + l]);
+            writeBits(length - lenBase[l], lenExtra[l]);
+        }
+
+        int d = distCount() - 1;
+        while (distBase[d] > distance)
+            --d;
+        writeCode(mDistCodes[d], mDistLengths[d]);
+        writeBits(distance - distBase[d], distExtra[d]);
+
+        const int from = mOutput.size() - distance;
+        for (int i = 0; i < length; ++i)
+            mOutput += mOutput.at(from + i);
+    }
+
+    void endBlock()
+    {
+        writeCode(mMainCodes[256], mMainLengths[256]);
+    }
+
+    // bytes that needn't be part of the output, as when a stored block
+    // holds something other than what the test decodes
+    void storedBlock(const QByteArray& bytes, bool final, bool addToOutput = true)
+    {
+        Q_ASSERT(bytes.size() <= 0xffff);
+        writeBits(final, 1);
+        writeBits(0, 2);
+        alignToByte();
+        writeBits(bytes.size(), 16);
+        writeBits(~bytes.size() & 0xffff, 16);
+        mData += bytes;
+        if (addToOutput)
+            mOutput += bytes;
+    }
+
+    // the final empty block
+    void finish()
+    {
+        beginBlock(true);
+        endBlock();
+    }
+
+    void alignToByte()
+    {
+        if (mBitCount) {
+            mData += char(mBitBuf);
+            mBitBuf = 0;
+            mBitCount = 0;
+        }
+    }
+
+    void writeBits(quint32 value, int bits)
+    {
+        for (int i = 0; i < bits; ++i) {
+            mBitBuf |= ((value >> i) & 1) << mBitCount;
+            if (++mBitCount == 8) {
+                mData += char(mBitBuf);
+                mBitBuf = 0;
+                mBitCount = 0;
+            }
+        }
+    }
+
+private:
+    int distCount() const { return mDeflate64 ? 32 : 30; }
+
+    static void assignCodes(const int *lengths, quint32 *codes, int count)
+    {
+        quint32 code = 0;
+        for (int len = 1; len <= 15; ++len) {
+            for (int i = 0; i < count; ++i)
+                if (lengths[i] == len)
+                    codes[i] = code++;
+            code <<= 1;
+        }
+    }
+
+    // Huffman codes go out starting with their most significant bit
+    void writeCode(quint32 code, int length)
+    {
+        for (int i = length - 1; i >= 0; --i)
+            writeBits((code >> i) & 1, 1);
+    }
+
+    void writeLevel(int length)
+    {
+        // code length symbols 4, 5, 8 and 9 are 00, 01, 10 and 11
+        writeCode(length == 4 ? 0 : length == 5 ? 1 : length == 8 ? 2 : 3, 2);
+    }
+
+    bool mDeflate64;
+    int mMainLengths[286];
+    quint32 mMainCodes[286];
+    int mDistLengths[32];
+    quint32 mDistCodes[32];
+
+    QByteArray mData;
+    QByteArray mOutput;
+    quint32 mBitBuf;
+    int mBitCount;
+};
+
+// the CRC of gzip computed bit by bit, so as not to rely on the one under test
+inline quint32 referenceCrc32(const QByteArray& data)
+{
+    quint32 crc = 0xffffffff;
+    for (int i = 0; i < data.size(); ++i) {
+        crc ^= quint8(data.at(i));
+        for (int k = 0; k < 8; ++k)
+            crc = (crc >> 1) ^ (0xEDB88320U & (0U - (crc & 1)));
+    }
+    return ~crc;
+}
+
+// a gzip member around a deflate stream, with an extra field if given
+inline QByteArray gzipMember(const DeflateWriter& deflate, const QByteArray& extra = QByteArray())
+{
+    QByteArray ret;
+    ret += char(0x1f);
+    ret += char(0x8b);
+    ret += char(8);
+    ret += char(extra.isEmpty() ? 0 : 4);
+    ret += QByteArray(4, 0);    // no mtime
+    ret += char(0);
+    ret += char(3);             // Unix
+    if (!extra.isEmpty()) {
+        ret += char(extra.size() & 0xff);
+        ret += char(extra.size() >> 8);
+        ret += extra;
+    }
+    ret += deflate.data();
+
+    const quint32 crc = referenceCrc32(deflate.output());
+    const quint32 size = quint32(deflate.output().size());
+    for (int i = 0; i < 4; ++i)
+        ret += char(crc >> (8 * i));
+    for (int i = 0; i < 4; ++i)
+        ret += char(size >> (8 * i));
+    return ret;
+}
+
+// reproducible pseudo-random numbers
+class TestRandom {
+public:
+    TestRandom(quint32 seed) : mState(seed) { }
+    quint32 next() { mState = mState * 1103515245U + 12345U; return mState >> 8; }
+    int bounded(int n) { return int(next() % quint32(n)); }
+
+private:
+    quint32 mState;
+};
+
+#endif
@@ -0,0 +1,507 @@
+#include <QtTest/QtTest>
+#include <QtCore/QBuffer>
+#include <QtCore/QFile>
+#include <QtCore/QTemporaryFile>
+
+#include "qz7/Stream.h"
+#include "qz7/Volume.h"
+
+#include "GzipArchive.h"
+#include "DeflateWriter.h"
+
+using namespace qz7;
+using namespace qz7::gzip;
+
+// a gzip file in memory
+class BufferVolume : public Volume {
+public:
+    BufferVolume(const QByteArray& data) : Volume(QString()), mData(data), mBuffer(&mData), mStream(&mBuffer)
+    {
+        mBuffer.open(QIODevice::ReadOnly);
+    }
+
+    virtual SeekableReadStream *openFile(uint n) { return n == 0 ? &mStream : 0; }
+
+private:
+    QByteArray mData;
+    QBuffer mBuffer;
+    QioSeekableReadStream mStream;
+};
+
+// a gzip file on disk, read through QFile (as SingleFileVolume does where a
+// file can't be mapped), which is what the input is read ahead for
+class FileVolume : public Volume {
+public:
+    FileVolume(const QByteArray& data) : Volume(QString()), mFile(0), mStream(0)
+    {
+        mTemp.open();
+        mTemp.write(data.constData(), data.size());
+        mTemp.flush();
+        mFile = new QFile(mTemp.fileName());
+        mFile->open(QIODevice::ReadOnly);
+        mStream = new QioSeekableReadStream(mFile);
+    }
+    ~FileVolume()
+    {
+        delete mStream;
+        delete mFile;
+    }
+
+    virtual SeekableReadStream *openFile(uint n) { return n == 0 ? mStream : 0; }
+
+private:
+    QTemporaryFile mTemp;
+    QFile *mFile;
+    QioSeekableReadStream *mStream;
+};
+
+class GzipArchiveTester : public QObject {
+    Q_OBJECT
+
+private slots:
+    void testExtract_data();
+    void testExtract();
+    void testItemSize_data();
+    void testItemSize();
+    void testCorrupted_data();
+    void testCorrupted();
+    void testExtractRange_data();
+    void testExtractRange();
+    void testIndexRoundTrip();
+    void testExtractBgzf_data();
+    void testExtractBgzf();
+};
+
+static DeflateWriter randomMember(quint32 seed, int symbols)
+{
+    TestRandom random(seed);
+    DeflateWriter w;
+    w.beginBlock(true);
+    for (int i = 0; i < symbols; ++i) {
+        if (w.output().size() < 8 || random.bounded(4) != 0)
+            w.literal(quint8('a' + random.bounded(26)));
+        else
+            w.match(3 + random.bounded(30), 1 + random.bounded(qMin(w.output().size(), 32768)));
+    }
+    w.endBlock();
+    return w;
+}
+
+// small members with a large one among them, which the workers leave to
+// be decoded directly
+static void multiMember(QByteArray *file, QByteArray *output)
+{
+    for (int i = 0; i < 20; ++i) {
+        const DeflateWriter w = randomMember(i + 1, (i == 7) ? 5000000 : 1000 + 500 * i);
+        *file += gzipMember(w);
+        *output += w.output();
+    }
+}
+
+// pigz writes a single member from independently compressed pieces, each
+// ending in an empty stored block
+static void pigz(QByteArray *file, QByteArray *output)
+{
+    TestRandom random(99);
+    DeflateWriter w;
+    for (int piece = 0; piece < 8; ++piece) {
+        w.beginBlock(false);
+        for (int i = 0; i < 100000; ++i) {
+            if (w.output().size() < 8 || random.bounded(3) != 0)
+                w.literal(quint8(random.next()));
+            else
+                w.match(3 + random.bounded(100), 1 + random.bounded(qMin(w.output().size(), 32768)));
+        }
+        w.endBlock();
+        w.storedBlock(QByteArray(), false);
+    }
+    w.finish();
+    *file = gzipMember(w);
+    *output = w.output();
+}
+
+// blocks of at most 64 KB that give their size in a BC field, and the empty
+// one BGZF ends with; where each block starts, in the file and in the output
+static void bgzf(QByteArray *file, QByteArray *output, QList<qint64> *blocks = 0, QList<int> *outputs = 0)
+{
+    for (int i = 0; i <= 40; ++i) {
+        const DeflateWriter w = (i < 40) ? randomMember(100 + i, 2000 + 100 * i) : randomMember(0, 0);
+        QByteArray extra("BC\2\0\0\0", 6);
+        const int blockSize = 12 + 6 + w.data().size() + 8;
+        extra[4] = char((blockSize - 1) & 0xff);
+        extra[5] = char((blockSize - 1) >> 8);
+        if (blocks)
+            blocks->append(file->size());
+        if (outputs)
+            outputs->append(output->size());
+        *file += gzipMember(w, extra);
+        *output += w.output();
+    }
+}
+
+static QByteArray extract(GzipArchive *archive, bool *ok)
+{
+    QByteArray output;
+    QBuffer buffer(&output);
+    buffer.open(QIODevice::WriteOnly);
+    QioWriteStream ws(&buffer);
+    *ok = archive->extractTo(0, &ws);
+    return output;
+}
+
+void GzipArchiveTester::testExtract_data()
+{
+    QTest::addColumn<QByteArray>("file");
+    QTest::addColumn<QByteArray>("expected");
+    QTest::addColumn<int>("threadCount");
+    QTest::addColumn<bool>("onDisk");
+
+    QByteArray file, output;
+    const DeflateWriter single = randomMember(1, 50000);
+    QTest::newRow("single member") << gzipMember(single) << single.output() << 1 << false;
+    QTest::newRow("single member, 4 threads") << gzipMember(single) << single.output() << 4 << false;
+    QTest::newRow("single member from a file, 4 threads") << gzipMember(single) << single.output() << 4 << true;
+
+    multiMember(&file, &output);
+    QTest::newRow("multi-member") << file << output << 1 << false;
+    QTest::newRow("multi-member, 4 threads") << file << output << 4 << false;
+    QTest::newRow("multi-member with padding, 4 threads") << file + QByteArray(1000, 0) << output << 4 << false;
+    QTest::newRow("multi-member from a file") << file << output << 1 << true;
+    QTest::newRow("multi-member from a file, 4 threads") << file << output << 4 << true;
+
+    file.clear();
+    output.clear();
+    pigz(&file, &output);
+    QTest::newRow("pigz") << file << output << 1 << false;
+    QTest::newRow("pigz, 4 threads") << file << output << 4 << false;
+
+    file.clear();
+    output.clear();
+    bgzf(&file, &output);
+    QTest::newRow("BGZF") << file << output << 1 << false;
+    QTest::newRow("BGZF, 4 threads") << file << output << 4 << false;
+}
+
+void GzipArchiveTester::testExtract()
+{
+    QFETCH(QByteArray, file);
+    QFETCH(QByteArray, expected);
+    QFETCH(int, threadCount);
+    QFETCH(bool, onDisk);
+
+    BufferVolume buffered(file);
+    FileVolume stored(file);
+    GzipArchive *archive = new GzipArchive(onDisk ? static_cast<Volume *>(&stored) : &buffered);
+    archive->setThreadCount(threadCount);
+    QVERIFY(archive->open());
+    QCOMPARE(archive->count(), uint(1));
+
+    bool ok;
+    const QByteArray output = extract(archive, &ok);
+    QVERIFY(ok);
+    QCOMPARE(output.size(), expected.size());
+    QVERIFY(output == expected);
+
+    // and again, with the workers and the codec reused
+    QVERIFY(extract(archive, &ok) == expected);
+    QVERIFY(ok);
+}
+
+void GzipArchiveTester::testItemSize_data()
+{
+    QTest::addColumn<QByteArray>("file");
+    QTest::addColumn<QByteArray>("expected");
+    QTest::addColumn<bool>("knownAtOpen");
+
+    QByteArray file, output;
+    const DeflateWriter single = randomMember(1, 50000);
+    QTest::newRow("single member") << gzipMember(single) << single.output() << true;
+
+    pigz(&file, &output);
+    QTest::newRow("pigz") << file << output << true;
+
+    file.clear();
+    output.clear();
+    bgzf(&file, &output);
+    QTest::newRow("BGZF") << file << output << true;
+
+    // only the last member's trailer can be found without decoding
+    file.clear();
+    output.clear();
+    multiMember(&file, &output);
+    QTest::newRow("multi-member") << file << output << false;
+}
+
+void GzipArchiveTester::testItemSize()
+{
+    QFETCH(QByteArray, file);
+    QFETCH(QByteArray, expected);
+    QFETCH(bool, knownAtOpen);
+
+    BufferVolume volume(file);
+    GzipArchive *archive = new GzipArchive(&volume);
+    archive->setThreadCount(4);
+    QVERIFY(archive->open());
+
+    if (knownAtOpen) {
+        QCOMPARE(archive->item(0).uncompressedSize(), quint64(expected.size()));
+        QCOMPARE(archive->item(0).crc(), referenceCrc32(expected));
+    }
+
+    bool ok;
+    extract(archive, &ok);
+    QVERIFY(ok);
+    QCOMPARE(archive->item(0).uncompressedSize(), quint64(expected.size()));
+    QCOMPARE(archive->item(0).crc(), referenceCrc32(expected));
+}
+
+void GzipArchiveTester::testCorrupted_data()
+{
+    QTest::addColumn<QByteArray>("file");
+    QTest::addColumn<int>("threadCount");
+
+    QByteArray file, output;
+    const DeflateWriter single = randomMember(1, 50000);
+    QByteArray crc = gzipMember(single);
+    crc[crc.size() - 8] = char(crc.at(crc.size() - 8) ^ 1);
+    QByteArray size = gzipMember(single);
+    size[size.size() - 4] = char(size.at(size.size() - 4) + 1);
+    QTest::newRow("CRC mismatch") << crc << 1;
+    QTest::newRow("CRC mismatch, 4 threads") << crc << 4;
+    QTest::newRow("ISIZE mismatch") << size << 1;
+    QTest::newRow("ISIZE mismatch, 4 threads") << size << 4;
+
+    // in a member a worker decodes
+    for (int i = 0; i < 5; ++i) {
+        const DeflateWriter w = randomMember(i + 1, 1000);
+        QByteArray member = gzipMember(w);
+        if (i == 3)
+            member[member.size() - 8] = char(member.at(member.size() - 8) ^ 1);
+        file += member;
+    }
+    QTest::newRow("CRC mismatch in a later member") << file << 1;
+    QTest::newRow("CRC mismatch in a later member, 4 threads") << file << 4;
+
+    file.clear();
+    for (int i = 0; i < 5; ++i) {
+        const DeflateWriter w = randomMember(i + 1, 1000);
+        QByteArray member = gzipMember(w);
+        if (i == 3)
+            member[member.size() - 4] = char(member.at(member.size() - 4) + 1);
+        file += member;
+    }
+    QTest::newRow("ISIZE mismatch in a later member") << file << 1;
+    QTest::newRow("ISIZE mismatch in a later member, 4 threads") << file << 4;
+}
+
+void GzipArchiveTester::testCorrupted()
+{
+    QFETCH(QByteArray, file);
+    QFETCH(int, threadCount);
+
+    BufferVolume volume(file);
+    GzipArchive *archive = new GzipArchive(&volume);
+    archive->setThreadCount(threadCount);
+    QVERIFY(archive->open());
+
+    bool ok;
+    extract(archive, &ok);
+    QVERIFY(!ok);
+    QVERIFY(!archive->errorString().isEmpty());
+}
+
+typedef QList<QPair<quint64, quint64> > Ranges;
+Q_DECLARE_METATYPE(Ranges)
+
+// the start, the end, either side of a checkpoint and across members
+static Ranges ranges(int size)
+{
+    Ranges ret;
+    const quint64 s = quint64(size);
+    ret << qMakePair(quint64(0), quint64(1000)) << qMakePair(quint64(0), s);
+    ret << qMakePair(s - 1, quint64(1)) << qMakePair(s - 5000, quint64(5000));
+    ret << qMakePair(quint64(16383), quint64(2)) << qMakePair(quint64(16384), quint64(100));
+    ret << qMakePair(s / 3, quint64(70000)) << qMakePair(s / 2 + 12345, s / 4);
+    ret << qMakePair(s - 10, quint64(1000));
+    return ret;
+}
+
+static QByteArray extractRange(GzipArchive *archive, quint64 offset, quint64 length, bool *ok)
+{
+    QByteArray output;
+    QBuffer buffer(&output);
+    buffer.open(QIODevice::WriteOnly);
+    QioWriteStream ws(&buffer);
+    *ok = archive->extractRange(0, offset, length, &ws);
+    return output;
+}
+
+void GzipArchiveTester::testExtractRange_data()
+{
+    QTest::addColumn<QByteArray>("file");
+    QTest::addColumn<QByteArray>("expected");
+    QTest::addColumn<int>("threadCount");
+
+    QByteArray file, output;
+    const DeflateWriter single = randomMember(1, 200000);
+    QTest::newRow("single member") << gzipMember(single) << single.output() << 1;
+    QTest::newRow("single member, 4 threads") << gzipMember(single) << single.output() << 4;
+
+    for (int i = 0; i < 10; ++i) {
+        const DeflateWriter w = randomMember(i + 1, 5000 + 3000 * i);
+        file += gzipMember(w);
+        output += w.output();
+    }
+    QTest::newRow("multi-member") << file << output << 1;
+    QTest::newRow("multi-member, 4 threads") << file << output << 4;
+
+    file.clear();
+    output.clear();
+    pigz(&file, &output);
+    QTest::newRow("pigz") << file << output << 1;
+}
+
+// ranges come out the same with and without an index
+void GzipArchiveTester::testExtractRange()
+{
+    QFETCH(QByteArray, file);
+    QFETCH(QByteArray, expected);
+    QFETCH(int, threadCount);
+
+    BufferVolume volume(file);
+    GzipArchive *archive = new GzipArchive(&volume);
+    archive->setThreadCount(threadCount);
+    QVERIFY(archive->open());
+
+    const Ranges r = ranges(expected.size());
+    bool ok;
+    for (int i = 0; i < r.count(); ++i) {
+        const QByteArray range = extractRange(archive, r.at(i).first, r.at(i).second, &ok);
+        QVERIFY(ok);
+        QVERIFY(range == expected.mid(int(r.at(i).first), int(r.at(i).second)));
+    }
+
+    QVERIFY(!archive->hasIndex(0));
+    QVERIFY(archive->buildIndex(0, 16384));
+    QVERIFY(archive->hasIndex(0));
+    for (int i = 0; i < r.count(); ++i) {
+        const QByteArray range = extractRange(archive, r.at(i).first, r.at(i).second, &ok);
+        QVERIFY(ok);
+        QVERIFY(range == expected.mid(int(r.at(i).first), int(r.at(i).second)));
+    }
+
+    // and the whole item is still fine afterwards
+    QVERIFY(extract(archive, &ok) == expected);
+    QVERIFY(ok);
+}
+
+// a saved index serves another archive over the same file, and no other
+void GzipArchiveTester::testIndexRoundTrip()
+{
+    QByteArray file, expected;
+    pigz(&file, &expected);
+
+    QByteArray index;
+    {
+        BufferVolume volume(file);
+        GzipArchive *archive = new GzipArchive(&volume);
+        QVERIFY(archive->open());
+        QVERIFY(archive->buildIndex(0, 32768));
+        QBuffer buffer(&index);
+        buffer.open(QIODevice::WriteOnly);
+        QVERIFY(archive->saveIndex(&buffer));
+    }
+    QVERIFY(!index.isEmpty());
+
+    BufferVolume volume(file);
+    GzipArchive *archive = new GzipArchive(&volume);
+    QVERIFY(archive->open());
+    QBuffer buffer(&index);
+    buffer.open(QIODevice::ReadOnly);
+    QVERIFY(archive->loadIndex(&buffer));
+    QVERIFY(archive->hasIndex(0));
+    const Ranges r = ranges(expected.size());
+    bool ok;
+    for (int i = 0; i < r.count(); ++i) {
+        const QByteArray range = extractRange(archive, r.at(i).first, r.at(i).second, &ok);
+        QVERIFY(ok);
+        QVERIFY(range == expected.mid(int(r.at(i).first), int(r.at(i).second)));
+    }
+
+    // the same size, but another trailer
+    QByteArray other = file;
+    other[other.size() - 8] = char(other.at(other.size() - 8) ^ 1);
+    BufferVolume otherVolume(other);
+    GzipArchive *otherArchive = new GzipArchive(&otherVolume);
+    QVERIFY(otherArchive->open());
+    buffer.seek(0);
+    QVERIFY(!otherArchive->loadIndex(&buffer));
+    QVERIFY(!otherArchive->hasIndex(0));
+
+    // and something that isn't an index at all
+    QByteArray garbage(100, 'x');
+    QBuffer garbageBuffer(&garbage);
+    garbageBuffer.open(QIODevice::ReadOnly);
+    QVERIFY(!archive->loadIndex(&garbageBuffer));
+    QVERIFY(archive->hasIndex(0));
+}
+
+void GzipArchiveTester::testExtractBgzf_data()
+{
+    QTest::addColumn<int>("threadCount");
+
+    QTest::newRow("1 thread") << 1;
+    QTest::newRow("4 threads") << 4;
+}
+
+// virtual offsets at and into blocks, for ranges within a block and across
+// many of them
+void GzipArchiveTester::testExtractBgzf()
+{
+    QFETCH(int, threadCount);
+
+    QByteArray file, expected;
+    QList<qint64> blocks;
+    QList<int> outputs;
+    bgzf(&file, &expected, &blocks, &outputs);
+
+    BufferVolume volume(file);
+    GzipArchive *archive = new GzipArchive(&volume);
+    archive->setThreadCount(threadCount);
+    QVERIFY(archive->open());
+    QVERIFY(archive->isBgzf());
+
+    const int cases[][3] = {
+        // block, offset into it, length
+        { 0, 0, 100 }, { 0, 0, 20000 }, { 3, 17, 50 }, { 5, 1000, 200000 },
+        { 20, 0, 1 }, { 38, 2500, 100000 }, { 39, 0, 1 }
+    };
+    for (uint i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        const int block = cases[i][0], offset = cases[i][1], length = cases[i][2];
+        QByteArray output;
+        QBuffer buffer(&output);
+        buffer.open(QIODevice::WriteOnly);
+        QioWriteStream ws(&buffer);
+        QVERIFY(archive->extractBgzf(GzipArchive::bgzfVirtualOffset(blocks.at(block), offset), length, &ws));
+        QVERIFY(output == expected.mid(outputs.at(block) + offset, length));
+    }
+
+    // not the start of a block
+    QByteArray output;
+    QBuffer buffer(&output);
+    buffer.open(QIODevice::WriteOnly);
+    QioWriteStream ws(&buffer);
+    QVERIFY(!archive->extractBgzf(GzipArchive::bgzfVirtualOffset(blocks.at(2) + 1, 0), 10, &ws));
+
+    // and a file that isn't BGZF
+    const DeflateWriter single = randomMember(1, 1000);
+    BufferVolume plainVolume(gzipMember(single));
+    GzipArchive *plain = new GzipArchive(&plainVolume);
+    QVERIFY(plain->open());
+    QVERIFY(!plain->isBgzf());
+    QVERIFY(!plain->extractBgzf(0, 10, &ws));
+}
+
+QTEST_MAIN(GzipArchiveTester)
+
+#include "GzipArchiveTest.moc"
@@ -0,0 +1,283 @@
+#include <QtTest/QtTest>
+#include <QtCore/QBuffer>
+#include <QtCore/QByteArray>
+#include <QtCore/QList>
+
+#include "qz7/BitIoLE.h"
+#include "qz7/Error.h"
+#include "qz7/Stream.h"
+#include "qz7/codec/HuffmanDecoder.h"
+
+#include "DeflateWriter.h"
+
+using namespace qz7;
+
+enum { MaxBits = 15, NumSymbols = 288 };
+
+// deflate-style codes: canonical, MSB first in an LSB-first stream
+class CodeWriter {
+public:
+    CodeWriter(const QList<int>& lengths) : mBitBuf(0), mBitCount(0)
+    {
+        int count[MaxBits + 1], next[MaxBits + 1];
+        for (int i = 0; i <= MaxBits; ++i)
+            count[i] = 0;
+        for (int s = 0; s < lengths.count(); ++s)
+            count[lengths.at(s)]++;
+        count[0] = 0;
+        int code = 0;
+        for (int i = 1; i <= MaxBits; ++i) {
+            code = (code + count[i - 1]) << 1;
+            next[i] = code;
+        }
+        for (int s = 0; s < lengths.count(); ++s)
+            mCodes.append(lengths.at(s) ? next[lengths.at(s)]++ : 0);
+        mLengths = lengths;
+    }
+
+    void symbol(int s) { writeCode(mCodes.at(s), mLengths.at(s)); }
+    void writeCode(int code, int length)
+    {
+        for (int i = length - 1; i >= 0; --i) {
+            mBitBuf |= quint32((code >> i) & 1) << mBitCount;
+            if (++mBitCount == 8) {
+                mData += char(mBitBuf);
+                mBitBuf = 0;
+                mBitCount = 0;
+            }
+        }
+    }
+    QByteArray data() const
+    {
+        // padded out with more than a code's worth of zeroes
+        QByteArray ret = mData;
+        if (mBitCount)
+            ret += char(mBitBuf);
+        return ret + QByteArray(4, 0);
+    }
+
+private:
+    QList<int> mLengths;
+    QList<int> mCodes;
+    QByteArray mData;
+    quint32 mBitBuf;
+    int mBitCount;
+};
+
+typedef QList<int> Lengths;
+Q_DECLARE_METATYPE(Lengths)
+
+class HuffmanDecoderTester : public QObject {
+    Q_OBJECT
+
+private slots:
+    void testDecode_data();
+    void testDecode();
+    void testUnusedCode();
+    void testOversubscribed();
+};
+
+// a complete code, by splitting leaves of a code tree until there are
+// enough; deep splits put long codes (and so second-level tables) in
+static Lengths randomCode(quint32 seed, int symbols, int deepPercent)
+{
+    TestRandom random(seed);
+    QList<int> leaves;
+    leaves.append(0);
+    while (leaves.count() < symbols) {
+        int i = random.bounded(leaves.count());
+        if (int(random.bounded(100)) < deepPercent) {
+            for (int j = 0; j < leaves.count(); ++j) {
+                if (leaves.at(j) > leaves.at(i))
+                    i = j;
+            }
+        }
+        if (leaves.at(i) == MaxBits) {
+            // full at this depth; try a shallower one
+            i = 0;
+            for (int j = 0; j < leaves.count(); ++j) {
+                if (leaves.at(j) < leaves.at(i))
+                    i = j;
+            }
+            if (leaves.at(i) == MaxBits)
+                break;
+        }
+        const int depth = leaves.at(i) + 1;
+        leaves[i] = depth;
+        leaves.append(depth);
+    }
+
+    // handed out to symbols in a scrambled order
+    Lengths lengths;
+    for (int s = 0; s < NumSymbols; ++s)
+        lengths.append(0);
+    for (int i = 0; i < leaves.count(); ++i) {
+        int s = random.bounded(NumSymbols);
+        while (lengths.at(s))
+            s = (s + 1) % NumSymbols;
+        lengths[s] = leaves.at(i);
+    }
+    return lengths;
+}
+
+template <HuffmanDecodeMode MODE, uint TABLE_BITS>
+static bool decodes(const Lengths& lengths, const QList<int>& symbols, const QByteArray& data)
+{
+    quint8 codeLengths[NumSymbols];
+    for (int s = 0; s < NumSymbols; ++s)
+        codeLengths[s] = quint8(lengths.at(s));
+    HuffmanDecoder<MaxBits, NumSymbols, MODE, TABLE_BITS> *decoder = new HuffmanDecoder<MaxBits, NumSymbols, MODE, TABLE_BITS>;
+    decoder->setCodeLengths(codeLengths);
+
+    QByteArray input = data;
+    QBuffer buffer(&input);
+    buffer.open(QIODevice::ReadOnly);
+    QioReadStream stream(&buffer);
+    BitReaderLE reader(&stream);
+
+    bool ok = true;
+    for (int i = 0; i < symbols.count() && ok; ++i)
+        ok = (int(decoder->decodeSymbol(reader)) == symbols.at(i));
+    delete decoder;
+    return ok;
+}
+
+void HuffmanDecoderTester::testDecode_data()
+{
+    QTest::addColumn<Lengths>("lengths");
+
+    QTest::newRow("fixed literal/length code") << Lengths();
+    QTest::newRow("balanced") << randomCode(1, 280, 0);
+    QTest::newRow("some long codes") << randomCode(2, 280, 30);
+    QTest::newRow("mostly long codes") << randomCode(3, 280, 90);
+    QTest::newRow("few symbols, long codes") << randomCode(4, 20, 100);
+    QTest::newRow("two symbols") << randomCode(5, 2, 0);
+
+    // a single code, which deflate allows for distances
+    Lengths single;
+    for (int s = 0; s < NumSymbols; ++s)
+        single.append(s == 17 ? 1 : 0);
+    QTest::newRow("single code") << single;
+}
+
+// every mode, and root tables both shorter than the longest code and as
+// long as it, decode the same symbols
+void HuffmanDecoderTester::testDecode()
+{
+    QFETCH(Lengths, lengths);
+
+    if (lengths.isEmpty()) {
+        for (int s = 0; s < NumSymbols; ++s)
+            lengths.append(s < 144 ? 8 : s < 256 ? 9 : s < 280 ? 7 : 8);
+    }
+
+    QList<int> used;
+    for (int s = 0; s < NumSymbols; ++s) {
+        if (lengths.at(s))
+            used.append(s);
+    }
+
+    TestRandom random(42);
+    CodeWriter writer(lengths);
+    QList<int> symbols;
+    for (int i = 0; i < 20000; ++i) {
+        // every symbol at least once, then at random
+        const int s = (i < used.count()) ? used.at(i) : used.at(random.bounded(used.count()));
+        writer.symbol(s);
+        symbols.append(s);
+    }
+    const QByteArray data = writer.data();
+
+    QVERIFY((decodes<HuffmanDecodeLimits, 9>(lengths, symbols, data)));
+    QVERIFY((decodes<HuffmanDecodeTable, 9>(lengths, symbols, data)));
+    QVERIFY((decodes<HuffmanDecodeReversedTable, 9>(lengths, symbols, data)));
+    QVERIFY((decodes<HuffmanDecodeTable, 6>(lengths, symbols, data)));
+    QVERIFY((decodes<HuffmanDecodeReversedTable, 6>(lengths, symbols, data)));
+    QVERIFY((decodes<HuffmanDecodeTable, 15>(lengths, symbols, data)));
+    QVERIFY((decodes<HuffmanDecodeReversedTable, 15>(lengths, symbols, data)));
+}
+
+template <HuffmanDecodeMode MODE, uint TABLE_BITS>
+static bool rejects(const Lengths& lengths, int code, int length)
+{
+    CodeWriter writer(lengths);
+    writer.writeCode(code, length);
+    const QByteArray data = writer.data();
+
+    quint8 codeLengths[NumSymbols];
+    for (int s = 0; s < NumSymbols; ++s)
+        codeLengths[s] = quint8(lengths.at(s));
+    HuffmanDecoder<MaxBits, NumSymbols, MODE, TABLE_BITS> decoder;
+    decoder.setCodeLengths(codeLengths);
+
+    QByteArray input = data;
+    QBuffer buffer(&input);
+    buffer.open(QIODevice::ReadOnly);
+    QioReadStream stream(&buffer);
+    BitReaderLE reader(&stream);
+    try {
+        decoder.decodeSymbol(reader);
+    } catch (CorruptedError) {
+        return true;
+    }
+    return false;
+}
+
+// the codes an incomplete code leaves unused, in the root table and in a
+// second-level one, are corrupt input
+void HuffmanDecoderTester::testUnusedCode()
+{
+    Lengths single;
+    for (int s = 0; s < NumSymbols; ++s)
+        single.append(s == 17 ? 1 : 0);
+    QVERIFY((rejects<HuffmanDecodeTable, 9>(single, 1, 1)));
+    QVERIFY((rejects<HuffmanDecodeReversedTable, 9>(single, 1, 1)));
+
+    // 0, 10, 110, ..., then one 12-bit code and nothing after it
+    Lengths deep;
+    for (int s = 0; s < NumSymbols; ++s)
+        deep.append(s < 12 ? s + 1 : 0);
+    const int unused = (1 << 12) - 1;
+    QVERIFY((rejects<HuffmanDecodeTable, 9>(deep, unused, 12)));
+    QVERIFY((rejects<HuffmanDecodeReversedTable, 9>(deep, unused, 12)));
+
+    // and the codes that are there still decode
+    QList<int> symbols;
+    CodeWriter writer(deep);
+    for (int s = 11; s >= 0; --s) {
+        writer.symbol(s);
+        symbols.append(s);
+    }
+    QVERIFY((decodes<HuffmanDecodeTable, 9>(deep, symbols, writer.data())));
+    QVERIFY((decodes<HuffmanDecodeReversedTable, 9>(deep, symbols, writer.data())));
+}
+
+// lengths that describe more codes than there is room for
+void HuffmanDecoderTester::testOversubscribed()
+{
+    quint8 codeLengths[NumSymbols];
+    for (int s = 0; s < NumSymbols; ++s)
+        codeLengths[s] = (s < 3) ? 1 : 0;
+
+    bool thrown = false;
+    try {
+        HuffmanDecoder<MaxBits, NumSymbols, HuffmanDecodeTable> table;
+        table.setCodeLengths(codeLengths);
+    } catch (CorruptedError) {
+        thrown = true;
+    }
+    QVERIFY(thrown);
+
+    thrown = false;
+    try {
+        HuffmanDecoder<MaxBits, NumSymbols, HuffmanDecodeReversedTable> reversed;
+        reversed.setCodeLengths(codeLengths);
+    } catch (CorruptedError) {
+        thrown = true;
+    }
+    QVERIFY(thrown);
+}
+
+QTEST_MAIN(HuffmanDecoderTester)
+
+#include "HuffmanDecoderTest.moc"
@@ -0,0 +1,99 @@
+#include <QtTest/QtTest>
+#include <QtCore/QByteArray>
+
+#include "qz7/MatchCopy.h"
+
+#include "DeflateWriter.h"
+
+using namespace qz7;
+
+class MatchCopyTester : public QObject {
+    Q_OBJECT
+
+private slots:
+    void testCopy_data();
+    void testCopy();
+    void testLongVariants();
+};
+
+// what a back-reference means: one byte at a time
+static void referenceCopy(quint8 *dst, uint distance, uint length)
+{
+    for (uint i = 0; i < length; ++i)
+        dst[i] = dst[int(i) - int(distance)];
+}
+
+// copies with every variant of the long copy, and checks that nothing past
+// the slack was touched
+static bool copiesLike(uint distance, uint length, quint32 seed)
+{
+    const int history = 70000;
+    const int guard = 64;
+    QByteArray expected(history + int(length) + MatchCopySlack + guard, 0);
+    TestRandom random(seed);
+    for (int i = 0; i < expected.size(); ++i)
+        expected[i] = char(random.next());
+    QByteArray actual = expected;
+
+    quint8 *e = reinterpret_cast<quint8 *>(expected.data()) + history;
+    quint8 *a = reinterpret_cast<quint8 *>(actual.data()) + history;
+    referenceCopy(e, distance, length);
+    copyMatch(a, distance, length);
+
+    if (::memcmp(e - history, a - history, history + length) != 0)
+        return false;
+    const int after = history + int(length) + MatchCopySlack;
+    return ::memcmp(expected.constData() + after, actual.constData() + after, guard) == 0;
+}
+
+void MatchCopyTester::testCopy_data()
+{
+    QTest::addColumn<uint>("distance");
+
+    // memset, short patterns, 8-byte pieces, and the long copy (which only
+    // takes distances from 32)
+    const uint distances[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 12, 15, 16, 17, 24, 31, 32, 33, 48, 64, 100, 4096, 32768, 65536 };
+    for (uint i = 0; i < sizeof(distances) / sizeof(distances[0]); ++i)
+        QTest::newRow(QByteArray::number(distances[i]).constData()) << distances[i];
+}
+
+void MatchCopyTester::testCopy()
+{
+    QFETCH(uint, distance);
+
+    const uint lengths[] = { 1, 2, 3, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65, 66, 100, 258, 1000, 65538 };
+    for (uint i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i) {
+        if (!copiesLike(distance, lengths[i], distance * 1000 + i))
+            QFAIL(qPrintable(QString("length %1").arg(lengths[i])));
+    }
+}
+
+// the long copies take over from 32 bytes apart and over 64 bytes long; each
+// variant this CPU has gets the same copies
+void MatchCopyTester::testLongVariants()
+{
+    MatchCopyFunction variants[MaxLongMatchCopies];
+    const int count = supportedLongMatchCopies(variants);
+    QVERIFY(count >= 1);
+    QVERIFY(copyLongMatch == variants[count - 1]);
+
+    const MatchCopyFunction selected = copyLongMatch;
+    const uint distances[] = { 32, 33, 40, 63, 64, 65, 1000, 32768 };
+    const uint lengths[] = { 65, 66, 95, 96, 97, 128, 258, 4000, 65538 };
+    for (int v = 0; v < count; ++v) {
+        copyLongMatch = variants[v];
+        for (uint d = 0; d < sizeof(distances) / sizeof(distances[0]); ++d) {
+            for (uint l = 0; l < sizeof(lengths) / sizeof(lengths[0]); ++l) {
+                if (!copiesLike(distances[d], lengths[l], d * 100 + l)) {
+                    copyLongMatch = selected;
+                    QFAIL(qPrintable(QString("variant %1, distance %2, length %3").arg(v).arg(distances[d]).arg(lengths[l])));
+                }
+            }
+        }
+    }
+    copyLongMatch = selected;
+}
+
+QTEST_MAIN(MatchCopyTester)
+
+#include "MatchCopyTest.moc"
@@ -0,0 +1,219 @@
+#include <QtTest/QtTest>
+#include <QtCore/QBuffer>
+
+#include "qz7/PrefetchReadStream.h"
+#include "qz7/Stream.h"
+
+using namespace qz7;
+
+// small buffers, so that everything crosses their boundaries
+static const int BufferSize = 4096;
+
+// a source that fails once it has given out a number of bytes
+class FailingSource : public ReadStream {
+public:
+    FailingSource(const QByteArray& data, int failAt) : mData(data), mPos(0), mFailAt(failAt) { }
+
+    using ReadStream::read;
+    using ReadStream::readSome;
+
+    virtual bool read(quint8 *buffer, int bytes) { return readSome(buffer, bytes, bytes) == bytes; }
+    virtual int readSome(quint8 *buffer, int, int maxBytes)
+    {
+        if (mPos >= mFailAt)
+            return -1;
+        const int n = qMin(maxBytes, mFailAt - mPos);
+        ::memcpy(buffer, mData.constData() + mPos, n);
+        mPos += n;
+        return n;
+    }
+    virtual bool skipForward(qint64) { return false; }
+    virtual bool atEnd() const { return false; }
+    virtual qint64 bytesRead() const { return mPos; }
+    virtual QString errorString() const { return QString("source failed"); }
+
+private:
+    QByteArray mData;
+    int mPos;
+    int mFailAt;
+};
+
+class PrefetchReadStreamTester : public QObject {
+    Q_OBJECT
+
+private slots:
+    void testPeekZeroCopy();
+    void testPeekAcrossBuffers();
+    void testMixed_data();
+    void testMixed();
+    void testEnd();
+    void testSourceError();
+};
+
+static QByteArray pattern(int size)
+{
+    QByteArray ret(size, 0);
+    for (int i = 0; i < size; i++)
+        ret[i] = char(i * 13 + (i >> 9));
+    return ret;
+}
+
+// at the start of a buffer, a peek is lent the whole of it
+void PrefetchReadStreamTester::testPeekZeroCopy()
+{
+    QByteArray data = pattern(BufferSize * 5);
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::ReadOnly);
+    QioReadStream source(&buffer);
+    PrefetchReadStream prefetch(&source, BufferSize, 2);
+
+    for (int i = 0; i < 5; i++) {
+        int bytes;
+        const quint8 *p = prefetch.peekBuffer(1, &bytes);
+        QVERIFY(p);
+        QCOMPARE(bytes, BufferSize);
+        QVERIFY(::memcmp(p, data.constData() + i * BufferSize, bytes) == 0);
+
+        // and what is left of it after a part is consumed
+        prefetch.consume(100);
+        const quint8 *q = prefetch.peekBuffer(1, &bytes);
+        QVERIFY(q == p + 100);
+        QCOMPARE(bytes, BufferSize - 100);
+        prefetch.consume(bytes);
+        QCOMPARE(prefetch.bytesRead(), qint64((i + 1) * BufferSize));
+    }
+    QVERIFY(prefetch.atEnd());
+}
+
+// a peek the current buffer can't satisfy is put together from the next ones
+void PrefetchReadStreamTester::testPeekAcrossBuffers()
+{
+    QByteArray data = pattern(BufferSize * 6);
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::ReadOnly);
+    QioReadStream source(&buffer);
+    PrefetchReadStream prefetch(&source, BufferSize, 3);
+
+    QVERIFY(prefetch.skipForward(BufferSize - 10));
+    int bytes;
+    const quint8 *p = prefetch.peekBuffer(2 * BufferSize + 20, &bytes);
+    QVERIFY(p);
+    QVERIFY(bytes >= 2 * BufferSize + 20);
+    QVERIFY(::memcmp(p, data.constData() + BufferSize - 10, 2 * BufferSize + 20) == 0);
+
+    // consumed in pieces, then read on past what was put together
+    prefetch.consume(30);
+    p = prefetch.peekBuffer(10, &bytes);
+    QVERIFY(p);
+    QVERIFY(::memcmp(p, data.constData() + BufferSize + 20, 10) == 0);
+    prefetch.consume(10);
+
+    QByteArray rest(data.size() - (BufferSize + 30), 0);
+    QVERIFY(prefetch.read(reinterpret_cast<quint8 *>(rest.data()), rest.size()));
+    QVERIFY(rest == data.mid(BufferSize + 30));
+    QVERIFY(prefetch.atEnd());
+    QCOMPARE(prefetch.bytesRead(), qint64(data.size() - (BufferSize - 10)));
+}
+
+void PrefetchReadStreamTester::testMixed_data()
+{
+    QTest::addColumn<int>("size");
+    QTest::addColumn<int>("bufferCount");
+
+    QTest::newRow("exactly full buffers") << BufferSize * 8 << 2;
+    QTest::newRow("partial last buffer") << BufferSize * 8 + 123 << 2;
+    QTest::newRow("more buffers") << BufferSize * 20 + 1 << 4;
+    QTest::newRow("less than a buffer") << 1000 << 3;
+}
+
+// reads, peeks and skips of all sizes, in any order, see the data in order
+void PrefetchReadStreamTester::testMixed()
+{
+    QFETCH(int, size);
+    QFETCH(int, bufferCount);
+
+    QByteArray data = pattern(size);
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::ReadOnly);
+    QioReadStream source(&buffer);
+    PrefetchReadStream prefetch(&source, BufferSize, bufferCount);
+
+    int pos = 0;
+    quint32 seed = 1;
+    QByteArray chunk;
+    while (pos < size) {
+        seed = seed * 1103515245 + 12345;
+        const int n = qMin(int((seed >> 16) % (BufferSize * 3)) + 1, size - pos);
+        chunk.resize(n);
+        quint8 *out = reinterpret_cast<quint8 *>(chunk.data());
+        switch ((seed >> 8) % 4) {
+        case 0:
+            QVERIFY(prefetch.read(out, n));
+            QVERIFY(chunk == data.mid(pos, n));
+            break;
+        case 1: {
+            const int r = prefetch.readSome(out, 1, n);
+            QCOMPARE(r, n);
+            QVERIFY(chunk == data.mid(pos, n));
+            break;
+        }
+        case 2: {
+            int bytes;
+            const quint8 *p = prefetch.peekBuffer(n, &bytes);
+            QVERIFY(p && bytes >= n);
+            QVERIFY(::memcmp(p, data.constData() + pos, n) == 0);
+            prefetch.consume(n);
+            break;
+        }
+        default:
+            QVERIFY(prefetch.skipForward(n));
+            break;
+        }
+        pos += n;
+        QVERIFY(prefetch.atEnd() == (pos == size));
+    }
+}
+
+// the end of the source shows as a short read, and stays
+void PrefetchReadStreamTester::testEnd()
+{
+    QByteArray data = pattern(BufferSize + 500);
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::ReadOnly);
+    QioReadStream source(&buffer);
+    PrefetchReadStream prefetch(&source, BufferSize, 2);
+
+    QByteArray out(BufferSize + 1000, 0);
+    QVERIFY(!prefetch.read(reinterpret_cast<quint8 *>(out.data()), out.size()));
+    QVERIFY(prefetch.atEnd());
+    QCOMPARE(prefetch.readSome(reinterpret_cast<quint8 *>(out.data()), 1, 100), 0);
+    QVERIFY(!prefetch.skipForward(1));
+
+    int bytes = -1;
+    prefetch.peekBuffer(1, &bytes);
+    QCOMPARE(bytes, 0);
+    QVERIFY(prefetch.errorString().isEmpty());
+}
+
+// the source's error is passed on once the data before it has been read (a
+// short read would have been taken for its end)
+void PrefetchReadStreamTester::testSourceError()
+{
+    const QByteArray data = pattern(BufferSize * 4);
+    FailingSource source(data, BufferSize * 2);
+    PrefetchReadStream prefetch(&source, BufferSize, 2);
+
+    QByteArray out(BufferSize * 2, 0);
+    QCOMPARE(prefetch.readSome(reinterpret_cast<quint8 *>(out.data()), out.size(), out.size()), out.size());
+    QVERIFY(out == data.left(out.size()));
+
+    QCOMPARE(prefetch.readSome(reinterpret_cast<quint8 *>(out.data()), 1, 100), -1);
+    QCOMPARE(prefetch.errorString(), QString("source failed"));
+
+    int bytes;
+    QVERIFY(prefetch.peekBuffer(1, &bytes) == 0);
+}
+
+QTEST_MAIN(PrefetchReadStreamTester)
+
+#include "PrefetchReadStreamTest.moc"
@@ -0,0 +1,95 @@
+#include <QtTest/QtTest>
+#include <QtCore/QByteArray>
+#include <QtCore/QVariant>
+
+#include "qz7/Codec.h"
+#include "qz7/Plugin.h"
+
+using namespace qz7;
+
+// a codec that tells when it goes away
+class TestCodec : public Codec {
+public:
+    TestCodec(bool *deleted) : mDeleted(deleted) { }
+    ~TestCodec() { *mDeleted = true; }
+
+    virtual bool stream(ReadStream *, WriteStream *) { return false; }
+    virtual QString errorString() const { return QString(); }
+    virtual void interrupt() { }
+    virtual bool setProperty(const QString&, const QVariant&) { return false; }
+    virtual QVariant property(const QString&) const { return QVariant(); }
+    virtual QByteArray serializeProperties() const { return QByteArray(); }
+    virtual bool applySerializedProperties(const QByteArray&) { return false; }
+
+private:
+    bool *mDeleted;
+};
+
+class RegistryTester : public QObject {
+    Q_OBJECT
+
+private slots:
+    void testReuse();
+    void testDistinct();
+    void testNotPooled();
+};
+
+// a released decoder comes back, with its properties at their defaults
+void RegistryTester::testReuse()
+{
+    Codec *fresh = Registry::createDecoder("deflate", 0);
+    QVERIFY(fresh);
+
+    Codec *codec = Registry::acquireDecoder("deflate");
+    QVERIFY(codec);
+    QVERIFY(codec->parent() == 0);
+    QVERIFY(codec->setProperty("threadCount", 7));
+    QVERIFY(codec->setProperty("keepHistory", true));
+    QVERIFY(codec->setProperty("bytesExpected", quint64(12345)));
+    QVERIFY(codec->setProperty("checksum", QString("crc32")));
+    QVERIFY(codec->setProperty("checkpointInterval", quint64(1000)));
+    Registry::releaseDecoder(codec);
+
+    Codec *again = Registry::acquireDecoder("deflate");
+    QVERIFY(again == codec);
+    QCOMPARE(again->property("threadCount").toUInt(), fresh->property("threadCount").toUInt());
+    QCOMPARE(again->property("keepHistory").toBool(), false);
+    QCOMPARE(again->property("bytesExpected").toULongLong(), quint64(0));
+    QCOMPARE(again->property("checksum").toString(), QString());
+    QCOMPARE(again->property("checkpointInterval").toULongLong(), quint64(0));
+    QVERIFY(again->errorString().isEmpty());
+
+    Registry::releaseDecoder(again);
+    delete fresh;
+}
+
+// only released decoders are handed out again, and only under their name
+void RegistryTester::testDistinct()
+{
+    Codec *a = Registry::acquireDecoder("deflate");
+    Codec *b = Registry::acquireDecoder("deflate");
+    QVERIFY(a && b && a != b);
+    Registry::releaseDecoder(a);
+
+    Codec *c = Registry::acquireDecoder("deflate64");
+    QVERIFY(c && c != a);
+    Codec *d = Registry::acquireDecoder("deflate");
+    QVERIFY(d == a);
+
+    Registry::releaseDecoder(b);
+    Registry::releaseDecoder(c);
+    Registry::releaseDecoder(d);
+    QVERIFY(Registry::acquireDecoder("nonexistent") == 0);
+}
+
+// a codec that the pool didn't hand out is deleted on release
+void RegistryTester::testNotPooled()
+{
+    bool deleted = false;
+    Registry::releaseDecoder(new TestCodec(&deleted));
+    QVERIFY(deleted);
+}
+
+QTEST_MAIN(RegistryTester)
+
+#include "RegistryTest.moc"
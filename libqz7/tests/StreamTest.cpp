@@ -0,0 +1,516 @@
+#include <QtTest/QtTest>
+#include <QtCore/QBuffer>
+#include <QtCore/QFile>
+#include <QtCore/QList>
+#include <QtCore/QTemporaryFile>
+
+#include "qz7/Stream.h"
+
+using namespace qz7;
+
+// the same data in a QBuffer, whose data is lent out as it is, or in a file,
+// which is peeked at through the stream's own buffer
+class TestDevice {
+public:
+    TestDevice(const QByteArray& data, bool inFile) : mData(data), mBuffer(&mData), mFile(0)
+    {
+        if (!inFile) {
+            mBuffer.open(QIODevice::ReadOnly);
+            return;
+        }
+        mTemp.open();
+        mTemp.write(data.constData(), data.size());
+        mTemp.flush();
+        mFile = new QFile(mTemp.fileName());
+        mFile->open(QIODevice::ReadOnly);
+    }
+    ~TestDevice() { delete mFile; }
+
+    QIODevice *device() { return mFile ? static_cast<QIODevice *>(mFile) : &mBuffer; }
+
+private:
+    QByteArray mData;
+    QBuffer mBuffer;
+    QTemporaryFile mTemp;
+    QFile *mFile;
+};
+
+// a file with the given data, opened read-only the way volumes open it
+class MappedFile {
+public:
+    MappedFile(const QByteArray& data) : mFile(0)
+    {
+        mTemp.open();
+        mTemp.write(data.constData(), data.size());
+        mTemp.flush();
+        reopen();
+    }
+    ~MappedFile() { delete mFile; }
+
+    QTemporaryFile& temp() { return mTemp; }
+    QFile *file() { return mFile; }
+    void reopen()
+    {
+        delete mFile;
+        mFile = new QFile(mTemp.fileName());
+        mFile->open(QIODevice::ReadOnly);
+    }
+
+private:
+    QTemporaryFile mTemp;
+    QFile *mFile;
+};
+
+// a stream of the given length that only overrides the int versions, and
+// notes down what they were asked for; it never touches the buffers
+class ChunkReadStream : public ReadStream {
+public:
+    ChunkReadStream(qint64 length) : mLeft(length) { }
+    virtual bool read(quint8 *buffer, int bytes)
+    {
+        note(buffer, bytes);
+        if (bytes > mLeft)
+            return false;
+        mLeft -= bytes;
+        return true;
+    }
+    virtual int readSome(quint8 *buffer, int minBytes, int maxBytes)
+    {
+        Q_UNUSED(minBytes);
+        note(buffer, maxBytes);
+        const int bytes = int(qMin(qint64(maxBytes), mLeft));
+        mLeft -= bytes;
+        return bytes;
+    }
+    virtual bool skipForward(qint64 bytes) { mLeft -= bytes; return true; }
+    virtual bool atEnd() const { return mLeft == 0; }
+    virtual qint64 bytesRead() const { return 0; }
+    virtual QString errorString() const { return QString(); }
+    virtual const quint8 *peekBuffer(int minBytes, int *bytes)
+    {
+        note(0, minBytes);
+        *bytes = int(qMin(qint64(minBytes), mLeft));
+        return mFake;
+    }
+    virtual void consume(int bytes)
+    {
+        note(0, bytes);
+        mLeft -= bytes;
+    }
+    using ReadStream::read;
+    using ReadStream::readSome;
+    using ReadStream::peekBuffer;
+    using ReadStream::consume;
+
+    QList<quintptr> buffers;
+    QList<qint64> counts;
+
+private:
+    void note(quint8 *buffer, int bytes)
+    {
+        buffers.append(quintptr(buffer));
+        counts.append(bytes);
+    }
+
+    qint64 mLeft;
+    quint8 mFake[1];
+};
+
+class ChunkWriteStream : public WriteStream {
+public:
+    virtual bool write(const quint8 *buffer, int bytes)
+    {
+        buffers.append(quintptr(buffer));
+        counts.append(bytes);
+        return true;
+    }
+    virtual void flush() { }
+    virtual qint64 bytesWritten() const { return 0; }
+    virtual QString errorString() const { return QString(); }
+    using WriteStream::write;
+
+    QList<quintptr> buffers;
+    QList<qint64> counts;
+};
+
+class StreamTester : public QObject {
+    Q_OBJECT
+
+private slots:
+    void testPeekConsume_data();
+    void testPeekConsume();
+    void testAtEnd_data();
+    void testAtEnd();
+    void testSkipForward_data();
+    void testSkipForward();
+    void testSetPos_data();
+    void testSetPos();
+    void testLimited_data();
+    void testLimited();
+    void testMapped();
+    void testMappedEmpty();
+    void testMappedHuge();
+    void testChunks();
+    void testLimitedChunks();
+
+private:
+    void devices();
+};
+
+static QByteArray pattern(int size)
+{
+    QByteArray ret(size, 0);
+    for (int i = 0; i < size; i++)
+        ret[i] = char(i * 7 + (i >> 10));
+    return ret;
+}
+
+void StreamTester::devices()
+{
+    QTest::addColumn<bool>("inFile");
+
+    QTest::newRow("QBuffer") << false;
+    QTest::newRow("QFile") << true;
+}
+
+// consume() moves past part of what was peeked, and the next peek goes on
+// from there, however much is asked for
+void StreamTester::testPeekConsume()
+{
+    QFETCH(bool, inFile);
+
+    const QByteArray data = pattern(300000);
+    TestDevice device(data, inFile);
+    QioSeekableReadStream stream(device.device());
+
+    int bytes;
+    const quint8 *p = stream.peekBuffer(1, &bytes);
+    QVERIFY(p && bytes >= 1);
+    QVERIFY(::memcmp(p, data.constData(), bytes) == 0);
+    stream.consume(10);
+    QCOMPARE(stream.pos(), qint64(10));
+
+    // more than the stream's own buffer holds
+    p = stream.peekBuffer(100000, &bytes);
+    QVERIFY(p && bytes >= 100000);
+    QVERIFY(::memcmp(p, data.constData() + 10, bytes) == 0);
+    stream.consume(99990);
+    QCOMPARE(stream.pos(), qint64(100000));
+
+    qint64 pos = 100000;
+    while (pos < data.size()) {
+        p = stream.peekBuffer(1, &bytes);
+        QVERIFY(p && bytes >= 1);
+        QVERIFY(::memcmp(p, data.constData() + pos, bytes) == 0);
+        const int n = qMin(bytes, 7777);
+        stream.consume(n);
+        pos += n;
+        QCOMPARE(stream.pos(), pos);
+    }
+
+    p = stream.peekBuffer(1, &bytes);
+    QVERIFY(p);
+    QCOMPARE(bytes, 0);
+}
+
+// the device may be at its end while what was peeked hasn't been consumed
+void StreamTester::testAtEnd()
+{
+    QFETCH(bool, inFile);
+
+    const QByteArray data = pattern(100);
+    TestDevice device(data, inFile);
+    QioReadStream stream(device.device());
+
+    int bytes;
+    QVERIFY(stream.peekBuffer(1, &bytes));
+    QCOMPARE(bytes, 100);
+    QVERIFY(!stream.atEnd());
+    stream.consume(99);
+    QVERIFY(!stream.atEnd());
+    stream.consume(1);
+    QVERIFY(stream.atEnd());
+}
+
+// skipping goes through what was peeked first, then the device
+void StreamTester::testSkipForward()
+{
+    QFETCH(bool, inFile);
+
+    const QByteArray data = pattern(200000);
+    TestDevice device(data, inFile);
+    QioSeekableReadStream stream(device.device());
+
+    int bytes;
+    QVERIFY(stream.peekBuffer(1000, &bytes));
+    stream.consume(10);
+    QVERIFY(stream.skipForward(50));
+    QCOMPARE(stream.pos(), qint64(60));
+    const quint8 *p = stream.peekBuffer(100, &bytes);
+    QVERIFY(p && bytes >= 100);
+    QVERIFY(::memcmp(p, data.constData() + 60, 100) == 0);
+
+    // past all of it
+    QVERIFY(stream.skipForward(150000));
+    QCOMPARE(stream.pos(), qint64(150060));
+    p = stream.peekBuffer(100, &bytes);
+    QVERIFY(p && bytes >= 100);
+    QVERIFY(::memcmp(p, data.constData() + 150060, 100) == 0);
+
+    // and to the end exactly
+    QVERIFY(stream.skipForward(data.size() - 150060));
+    QVERIFY(stream.atEnd());
+}
+
+// a seek drops what was peeked
+void StreamTester::testSetPos()
+{
+    QFETCH(bool, inFile);
+
+    const QByteArray data = pattern(200000);
+    TestDevice device(data, inFile);
+    QioSeekableReadStream stream(device.device());
+
+    int bytes;
+    QVERIFY(stream.peekBuffer(5000, &bytes));
+    stream.consume(1234);
+    QVERIFY(stream.setPos(100));
+    QCOMPARE(stream.pos(), qint64(100));
+    const quint8 *p = stream.peekBuffer(100, &bytes);
+    QVERIFY(p && bytes >= 100);
+    QVERIFY(::memcmp(p, data.constData() + 100, 100) == 0);
+
+    stream.consume(50);
+    QVERIFY(stream.setPos(180000));
+    QCOMPARE(stream.pos(), qint64(180000));
+    p = stream.peekBuffer(1, &bytes);
+    QVERIFY(p && bytes >= 1);
+    QVERIFY(::memcmp(p, data.constData() + 180000, bytes) == 0);
+
+    // reading after a seek is allowed again
+    QVERIFY(stream.setPos(500));
+    QByteArray out(100, 0);
+    QVERIFY(stream.read(reinterpret_cast<quint8 *>(out.data()), out.size()));
+    QVERIFY(out == data.mid(500, 100));
+}
+
+// a limited stream never lends out more than its limit, whatever its source
+// holds; the source is where it was left by a seek afterwards, as when the
+// gzip trailer is read after a member
+void StreamTester::testLimited()
+{
+    QFETCH(bool, inFile);
+
+    const QByteArray data = pattern(200000);
+    TestDevice device(data, inFile);
+    QioSeekableReadStream source(device.device());
+    QVERIFY(source.setPos(500));
+    LimitedReadStream stream(static_cast<SeekableReadStream *>(&source), 1000);
+
+    int bytes;
+    const quint8 *p = stream.peekBuffer(1, &bytes);
+    QVERIFY(p);
+    QCOMPARE(bytes, 1000);
+    QVERIFY(::memcmp(p, data.constData() + 500, bytes) == 0);
+    stream.consume(300);
+    QCOMPARE(stream.bytesRead(), qint64(300));
+
+    p = stream.peekBuffer(5000, &bytes);
+    QVERIFY(p);
+    QCOMPARE(bytes, 700);
+    QVERIFY(::memcmp(p, data.constData() + 800, bytes) == 0);
+    stream.consume(700);
+    QVERIFY(stream.atEnd());
+
+    p = stream.peekBuffer(1, &bytes);
+    QVERIFY(p);
+    QCOMPARE(bytes, 0);
+    quint8 byte;
+    QCOMPARE(stream.readSome(&byte, 1, 1), 0);
+
+    QVERIFY(source.setPos(1500));
+    QByteArray out(8, 0);
+    QVERIFY(source.read(reinterpret_cast<quint8 *>(out.data()), out.size()));
+    QVERIFY(out == data.mid(1500, 8));
+}
+
+// everything is lent out of the mapping itself, all that is left at once
+void StreamTester::testMapped()
+{
+    const QByteArray data = pattern(300000);
+    MappedFile file(data);
+    MappedFileReadStream stream(file.file());
+    QVERIFY(stream.isMapped());
+    QCOMPARE(stream.size(), qint64(data.size()));
+
+    qint64 bytes;
+    const quint8 *p = stream.peekBuffer(qint64(1), &bytes);
+    QVERIFY(p);
+    QCOMPARE(bytes, qint64(data.size()));
+    QVERIFY(::memcmp(p, data.constData(), data.size()) == 0);
+    stream.consume(qint64(1000));
+    const quint8 *q = stream.peekBuffer(qint64(1), &bytes);
+    QVERIFY(q == p + 1000);
+    QCOMPARE(bytes, qint64(data.size() - 1000));
+    QCOMPARE(stream.pos(), qint64(1000));
+
+    QByteArray out(500, 0);
+    QVERIFY(stream.read(reinterpret_cast<quint8 *>(out.data()), out.size()));
+    QVERIFY(out == data.mid(1000, 500));
+
+    // skipped bytes aren't counted as read
+    QVERIFY(stream.skipForward(8500));
+    QCOMPARE(stream.pos(), qint64(10000));
+    QCOMPARE(stream.bytesRead(), qint64(1500));
+
+    QVERIFY(stream.setPos(data.size() - 100));
+    QCOMPARE(stream.readSome(reinterpret_cast<quint8 *>(out.data()), 1, out.size()), 100);
+    QVERIFY(out.left(100) == data.right(100));
+    QVERIFY(stream.atEnd());
+
+    // reading or seeking past the end fails without moving
+    QVERIFY(stream.setPos(data.size() - 10));
+    QVERIFY(!stream.read(reinterpret_cast<quint8 *>(out.data()), 11));
+    QVERIFY(!stream.skipForward(11));
+    QVERIFY(!stream.setPos(data.size() + 1));
+    QVERIFY(!stream.setPos(-1));
+    QCOMPARE(stream.pos(), qint64(data.size() - 10));
+    QVERIFY(stream.setPos(0));
+    QVERIFY(stream.peekBuffer(qint64(1), &bytes) == p);
+}
+
+// there's nothing to map in an empty file; volumes go back to reading it
+void StreamTester::testMappedEmpty()
+{
+    MappedFile file((QByteArray()));
+    MappedFileReadStream stream(file.file());
+    QVERIFY(!stream.isMapped());
+}
+
+// past 2 and 4 GB: a sparse file, so it costs no disk space
+void StreamTester::testMappedHuge()
+{
+    if (sizeof(void *) < 8)
+        QSKIP("no room for the mapping", SkipSingle);
+
+    const qint64 size = Q_INT64_C(5) << 30;
+    const qint64 markerPos = (Q_INT64_C(9) << 29) + 3;
+    const QByteArray marker("marker");
+    MappedFile file((QByteArray()));
+    if (!file.temp().resize(size))
+        QSKIP("can't make the file", SkipSingle);
+    QVERIFY(file.temp().seek(markerPos));
+    file.temp().write(marker.constData(), marker.size());
+    file.temp().flush();
+    file.reopen();
+
+    MappedFileReadStream stream(file.file());
+    QVERIFY(stream.isMapped());
+    QCOMPARE(stream.size(), size);
+
+    // the int version lends out at most 1 GB, the 64-bit one all of it
+    int intBytes;
+    const quint8 *p = stream.peekBuffer(1, &intBytes);
+    QVERIFY(p);
+    QCOMPARE(intBytes, 1 << 30);
+    qint64 bytes;
+    QVERIFY(stream.peekBuffer(qint64(1), &bytes) == p);
+    QCOMPARE(bytes, size);
+
+    stream.consume(Q_INT64_C(3) << 30);
+    QCOMPARE(stream.pos(), Q_INT64_C(3) << 30);
+    QVERIFY(stream.skipForward(markerPos - (Q_INT64_C(3) << 30)));
+    QByteArray out(marker.size(), 0);
+    QVERIFY(stream.read(reinterpret_cast<quint8 *>(out.data()), out.size()));
+    QVERIFY(out == marker);
+
+    QVERIFY(stream.setPos(markerPos));
+    QVERIFY(stream.peekBuffer(qint64(1), &bytes) == p + markerPos);
+    QCOMPARE(bytes, size - markerPos);
+    QVERIFY(stream.setPos(size));
+    QVERIFY(stream.atEnd());
+}
+
+typedef QList<qint64> Counts;
+
+static const qint64 GB = Q_INT64_C(1) << 30;
+
+// 1 GB pieces, each going on where the last one stopped
+template <typename T> static bool chunked(const T& stream, quintptr start, const Counts& expected)
+{
+    if (stream.counts != expected)
+        return false;
+    quintptr buffer = start;
+    for (int i = 0; i < expected.count(); ++i) {
+        if (stream.buffers.at(i) != buffer)
+            return false;
+        buffer += quintptr(expected.at(i));
+    }
+    return true;
+}
+
+// the default 64-bit versions go through the int ones a gigabyte at a time
+void StreamTester::testChunks()
+{
+    if (sizeof(void *) < 8)
+        QSKIP("the counts don't fit in a pointer", SkipSingle);
+
+    // never written to or read from; only where each piece would start
+    quint8 *const buffer = reinterpret_cast<quint8 *>(quintptr(1) << 40);
+    const qint64 length = 2 * GB + 5;
+
+    ChunkReadStream reader(length);
+    QVERIFY(reader.read(buffer, length));
+    QVERIFY(chunked(reader, quintptr(buffer), Counts() << GB << GB << 5));
+    QVERIFY(reader.atEnd());
+
+    // readSome() stops at the first short piece
+    ChunkReadStream some(length);
+    QCOMPARE(some.readSome(buffer, qint64(1), 3 * GB), length);
+    QVERIFY(chunked(some, quintptr(buffer), Counts() << GB << GB << GB));
+
+    // and read() fails with a piece that can't be read
+    ChunkReadStream past(length);
+    QVERIFY(!past.read(buffer, 3 * GB));
+
+    ChunkReadStream peeker(length);
+    qint64 bytes;
+    QVERIFY(peeker.peekBuffer(3 * GB, &bytes));
+    QCOMPARE(bytes, GB);
+    peeker.consume(length);
+    QVERIFY(peeker.atEnd());
+    QVERIFY(peeker.counts == (Counts() << GB << GB << GB << 5));
+
+    ChunkWriteStream writer;
+    QVERIFY(writer.write(buffer, 3 * GB + 1));
+    QVERIFY(chunked(writer, quintptr(buffer), Counts() << GB << GB << GB << 1));
+}
+
+// a limit past 2 GB holds for the 64-bit versions
+void StreamTester::testLimitedChunks()
+{
+    if (sizeof(void *) < 8)
+        QSKIP("the counts don't fit in a pointer", SkipSingle);
+
+    quint8 *const buffer = reinterpret_cast<quint8 *>(quintptr(1) << 40);
+    ChunkReadStream source(5 * GB);
+    LimitedReadStream stream(&source, 3 * GB);
+
+    QVERIFY(!stream.read(buffer, 3 * GB + 1));
+    QVERIFY(source.counts.isEmpty());
+    QCOMPARE(stream.readSome(buffer, qint64(1), 4 * GB), 3 * GB);
+    QVERIFY(chunked(source, quintptr(buffer), Counts() << GB << GB << GB));
+    QCOMPARE(stream.bytesRead(), 3 * GB);
+    QVERIFY(stream.atEnd());
+    QCOMPARE(stream.readSome(buffer, qint64(1), GB), qint64(0));
+}
+
+void StreamTester::testPeekConsume_data() { devices(); }
+void StreamTester::testAtEnd_data() { devices(); }
+void StreamTester::testSkipForward_data() { devices(); }
+void StreamTester::testSetPos_data() { devices(); }
+void StreamTester::testLimited_data() { devices(); }
+
+QTEST_MAIN(StreamTester)
+
+#include "StreamTest.moc"
@@ -0,0 +1,152 @@
+#include <QtTest/QtTest>
+#include <QtCore/QFile>
+#include <QtCore/QTemporaryFile>
+
+#include "qz7/UringStream.h"
+
+using namespace qz7;
+
+// small blocks, so that everything crosses their boundaries
+static const int BlockSize = 4096;
+static const int BlockCount = 4;
+
+class UringStreamTester : public QObject {
+    Q_OBJECT
+
+private slots:
+    void testRead_data();
+    void testRead();
+    void testWrite_data();
+    void testWrite();
+};
+
+static QByteArray pattern(int size)
+{
+    QByteArray ret(size, 0);
+    for (int i = 0; i < size; i++)
+        ret[i] = char(i * 31 + (i >> 11));
+    return ret;
+}
+
+static QByteArray fileContents(const QString& name)
+{
+    QFile file(name);
+    file.open(QIODevice::ReadOnly);
+    QByteArray ret(int(file.size()), 0);
+    if (file.read(ret.data(), ret.size()) != ret.size())
+        ret.clear();
+    return ret;
+}
+
+void UringStreamTester::testRead_data()
+{
+    QTest::addColumn<bool>("useRing");
+
+    QTest::newRow("pread") << false;
+    QTest::newRow("io_uring") << true;
+}
+
+// the same reads, peeks and seeks see the same data either way
+void UringStreamTester::testRead()
+{
+    QFETCH(bool, useRing);
+
+    const QByteArray data = pattern(BlockSize * BlockCount * 3 + 777);
+    QTemporaryFile temp;
+    QVERIFY(temp.open());
+    QCOMPARE(temp.write(data.constData(), data.size()), qint64(data.size()));
+    temp.flush();
+
+    QFile file(temp.fileName());
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    UringFileReadStream stream(&file, BlockSize, BlockCount, useRing);
+    if (useRing && !stream.usesRing())
+        QSKIP("io_uring isn't available here", SkipSingle);
+    QVERIFY(stream.usesRing() == useRing);
+    QCOMPARE(stream.size(), qint64(data.size()));
+
+    // all of it, in pieces that don't line up with the blocks
+    QByteArray out(data.size(), 0);
+    int pos = 0;
+    while (pos < data.size()) {
+        const int n = qMin(1000 + pos % 3000, data.size() - pos);
+        QVERIFY(stream.read(reinterpret_cast<quint8 *>(out.data()) + pos, n));
+        pos += n;
+    }
+    QVERIFY(out == data);
+    QVERIFY(stream.atEnd());
+    QCOMPARE(stream.readSome(reinterpret_cast<quint8 *>(out.data()), 1, 100), 0);
+
+    // back, and a peek across the end of a block
+    QVERIFY(stream.setPos(BlockSize - 50));
+    int bytes;
+    const quint8 *p = stream.peekBuffer(200, &bytes);
+    QVERIFY(p && bytes >= 200);
+    QVERIFY(::memcmp(p, data.constData() + BlockSize - 50, 200) == 0);
+    stream.consume(200);
+    QCOMPARE(stream.pos(), qint64(BlockSize + 150));
+
+    // forward past what was read ahead
+    QVERIFY(stream.skipForward(BlockSize * BlockCount * 2));
+    const qint64 at = stream.pos();
+    QCOMPARE(stream.readSome(reinterpret_cast<quint8 *>(out.data()), 1, 5000), 5000);
+    QVERIFY(::memcmp(out.constData(), data.constData() + at, 5000) == 0);
+
+    // the short last block
+    QVERIFY(stream.setPos(data.size() - 10));
+    p = stream.peekBuffer(100, &bytes);
+    QVERIFY(p);
+    QCOMPARE(bytes, 10);
+    QVERIFY(::memcmp(p, data.constData() + data.size() - 10, 10) == 0);
+    QVERIFY(!stream.skipForward(11));
+    QVERIFY(stream.errorString().isEmpty());
+}
+
+void UringStreamTester::testWrite_data()
+{
+    QTest::addColumn<bool>("useRing");
+
+    QTest::newRow("pwrite") << false;
+    QTest::newRow("io_uring") << true;
+}
+
+// writes and acquired buffers of all sizes end up in the file in order
+void UringStreamTester::testWrite()
+{
+    QFETCH(bool, useRing);
+
+    QTemporaryFile temp;
+    QVERIFY(temp.open());
+    QByteArray expected("header");
+    QCOMPARE(temp.write(expected.constData(), expected.size()), qint64(expected.size()));
+
+    {
+        UringFileWriteStream stream(&temp, BlockSize, BlockCount, useRing);
+        if (useRing && !stream.usesRing())
+            QSKIP("io_uring isn't available here", SkipSingle);
+        QVERIFY(stream.usesRing() == useRing);
+
+        for (int i = 0; i < 60; i++) {
+            const QByteArray data = pattern(1 + (i * 997) % 6000).mid(i % 7);
+            if (i % 3 == 0) {
+                quint8 *room = stream.acquireBuffer(data.size() + 5);
+                QVERIFY(room);
+                ::memcpy(room, data.constData(), data.size());
+                QVERIFY(stream.commit(data.size()));
+            } else {
+                QVERIFY(stream.write(reinterpret_cast<const quint8 *>(data.constData()), data.size()));
+            }
+            expected += data;
+        }
+        stream.flush();
+        QVERIFY(!stream.hasError());
+        QCOMPARE(stream.bytesWritten(), qint64(expected.size() - 6));
+        QCOMPARE(temp.pos(), qint64(expected.size()));
+    }
+
+    QVERIFY(fileContents(temp.fileName()) == expected);
+}
+
+QTEST_MAIN(UringStreamTester)
+
+#include "UringStreamTest.moc"